@@ -0,0 +1,250 @@
+/*-----------------------------------------------------------------------------
+ * file:  inet_cksum.c
+ *
+ * Description:
+ *
+ * One's complement sum kernels, see inet_cksum.h.
+ *
+ * All kernels rely on 2^16 == 1 (mod 0xffff): a wider word is congruent to
+ * the sum of its 16 bit halves, so words can be added in any width and the
+ * carries folded back in at the end.  The scalar kernel adds 32 bit halves
+ * of 64 bit loads into a 64 bit accumulator, which cannot overflow for any
+ * buffer shorter than 2^34 bytes.  The SIMD kernels widen 16 bit lanes to
+ * 32 bits and flush the lanes into a 64 bit total before they can overflow.
+ *
+ * This file is also compiled as C++98 by the STCP build (g++ -ansi), so
+ * keep it to the common subset of both languages.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "inet_cksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INET_CKSUM_X86
+#endif
+
+/* 32 bit lanes gain at most 2 * 0xffff per vector, so flush well before
+   2^32 / 2^17 vectors */
+#define CSUM_SIMD_FLUSH  16384
+
+static uint32_t csum_reduce(uint64_t acc)
+{
+    acc = (acc & 0xffffffffu) + (acc >> 32);
+    acc = (acc & 0xffffffffu) + (acc >> 32);
+    return (uint32_t)acc;
+}
+
+/*---------------------------------------------------------------------
+ * Method: csum_tail(..)
+ * Scope: Local
+ *
+ * Add the last len < 8 bytes.  Loads go through memcpy so the buffer
+ * may have any alignment.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint64_t csum_tail(const uint8_t* p, size_t len, uint64_t acc)
+{
+    uint32_t w32;
+    uint16_t w16;
+
+    if(len & 4)
+    {
+        memcpy(&w32, p, 4);
+        acc += w32;
+        p += 4;
+    }
+    if(len & 2)
+    {
+        memcpy(&w16, p, 2);
+        acc += w16;
+        p += 2;
+    }
+    if(len & 1)
+    {
+        /* pad with a zero byte in memory order, whatever the host order */
+        w16 = 0;
+        memcpy(&w16, p, 1);
+        acc += w16;
+    }
+    return acc;
+} /* -- csum_tail -- */
+
+static uint64_t csum_words(const uint8_t* p, size_t len, uint64_t acc)
+{
+    uint64_t a = 0, b = 0, c = 0, d = 0;
+    uint64_t w[4];
+
+    while(len >= 32)
+    {
+        memcpy(w, p, 32);
+        a += (w[0] & 0xffffffffu) + (w[0] >> 32);
+        b += (w[1] & 0xffffffffu) + (w[1] >> 32);
+        c += (w[2] & 0xffffffffu) + (w[2] >> 32);
+        d += (w[3] & 0xffffffffu) + (w[3] >> 32);
+        p += 32;
+        len -= 32;
+    }
+    while(len >= 8)
+    {
+        memcpy(w, p, 8);
+        a += (w[0] & 0xffffffffu) + (w[0] >> 32);
+        p += 8;
+        len -= 8;
+    }
+
+    return csum_tail(p, len, acc + a + b + c + d);
+} /* -- csum_words -- */
+
+uint32_t csum_partial_scalar(const void* data, size_t len, uint32_t sum)
+{
+    return csum_reduce(csum_words((const uint8_t*)data, len, sum));
+} /* -- csum_partial_scalar -- */
+
+#ifdef INET_CKSUM_X86
+
+__attribute__((target("sse2")))
+static uint64_t csum_hsum_sse2(__m128i v)
+{
+    uint32_t lanes[4];
+
+    _mm_storeu_si128((__m128i*)lanes, v);
+    return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("sse2")))
+uint32_t csum_partial_sse2(const void* data, size_t len, uint32_t sum)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t acc = sum;
+
+    while(len >= 32)
+    {
+        __m128i lanes = zero;
+        size_t  n = len / 32;
+
+        if(n > CSUM_SIMD_FLUSH / 2)
+        { n = CSUM_SIMD_FLUSH / 2; }
+        len -= n * 32;
+
+        while(n--)
+        {
+            __m128i v0 = _mm_loadu_si128((const __m128i*)p);
+            __m128i v1 = _mm_loadu_si128((const __m128i*)(p + 16));
+
+            lanes = _mm_add_epi32(lanes, _mm_add_epi32(
+                        _mm_unpacklo_epi16(v0, zero), _mm_unpackhi_epi16(v0, zero)));
+            lanes = _mm_add_epi32(lanes, _mm_add_epi32(
+                        _mm_unpacklo_epi16(v1, zero), _mm_unpackhi_epi16(v1, zero)));
+            p += 32;
+        }
+        acc += csum_hsum_sse2(lanes);
+    }
+
+    return csum_reduce(csum_words(p, len, acc));
+} /* -- csum_partial_sse2 -- */
+
+__attribute__((target("avx2")))
+uint32_t csum_partial_avx2(const void* data, size_t len, uint32_t sum)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t acc = sum;
+
+    while(len >= 64)
+    {
+        __m256i lanes = zero;
+        size_t  n = len / 64;
+        uint32_t out[8];
+
+        if(n > CSUM_SIMD_FLUSH / 2)
+        { n = CSUM_SIMD_FLUSH / 2; }
+        len -= n * 64;
+
+        while(n--)
+        {
+            __m256i v0 = _mm256_loadu_si256((const __m256i*)p);
+            __m256i v1 = _mm256_loadu_si256((const __m256i*)(p + 32));
+
+            lanes = _mm256_add_epi32(lanes, _mm256_add_epi32(
+                        _mm256_unpacklo_epi16(v0, zero), _mm256_unpackhi_epi16(v0, zero)));
+            lanes = _mm256_add_epi32(lanes, _mm256_add_epi32(
+                        _mm256_unpacklo_epi16(v1, zero), _mm256_unpackhi_epi16(v1, zero)));
+            p += 64;
+        }
+
+        _mm256_storeu_si256((__m256i*)out, lanes);
+        acc += (uint64_t)out[0] + out[1] + out[2] + out[3]
+             + out[4] + out[5] + out[6] + out[7];
+    }
+
+    return csum_reduce(csum_words(p, len, acc));
+} /* -- csum_partial_avx2 -- */
+
+#endif /* INET_CKSUM_X86 */
+
+/*---------------------------------------------------------------------
+ * Method: csum_partial(..)
+ * Scope: Global
+ *
+ * Dispatch to the best kernel for this CPU.  The choice is made on the
+ * first call; two threads racing on it store the same pointer.  Header
+ * sized buffers go straight to the scalar kernel, which beats the vector
+ * setup below a couple of vectors.
+ *
+ *---------------------------------------------------------------------*/
+
+static csum_partial_fn csum_impl = 0;
+static const char*     csum_name = "scalar";
+
+static csum_partial_fn csum_select(void)
+{
+    csum_partial_fn fn = csum_partial_scalar;
+
+#ifdef INET_CKSUM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+    {
+        fn = csum_partial_avx2;
+        csum_name = "avx2";
+    }
+    else if(__builtin_cpu_supports("sse2"))
+    {
+        fn = csum_partial_sse2;
+        csum_name = "sse2";
+    }
+#endif
+
+    csum_impl = fn;
+    return fn;
+} /* -- csum_select -- */
+
+uint32_t csum_partial(const void* data, size_t len, uint32_t sum)
+{
+    csum_partial_fn fn = csum_impl;
+
+    if(len < 64)
+    { return csum_partial_scalar(data, len, sum); }
+
+    if(!fn)
+    { fn = csum_select(); }
+    return fn(data, len, sum);
+} /* -- csum_partial -- */
+
+uint16_t csum_fold(uint32_t sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+} /* -- csum_fold -- */
+
+const char* csum_impl_name(void)
+{
+    if(!csum_impl)
+    { csum_select(); }
+    return csum_name;
+} /* -- csum_impl_name -- */
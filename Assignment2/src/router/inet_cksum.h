@@ -0,0 +1,52 @@
+/*-----------------------------------------------------------------------------
+ * file:  inet_cksum.h
+ *
+ * Description:
+ *
+ * One's complement (Internet checksum, RFC 1071) sum kernel shared by the
+ * router (sr_utils.c) and STCP (Assignment3 tcp_sum.c).
+ *
+ * csum_partial adds the 16 bit words of a buffer, taken in memory order,
+ * to a running 32 bit sum.  Because one's complement addition does not
+ * care about byte order, the folded result can be stored into a header
+ * as is.  An odd trailing byte is padded with zero, so a buffer may only
+ * end on an odd length in the last call of a chain.
+ *
+ * csum_partial picks the widest implementation the CPU supports on first
+ * use (AVX2, then SSE2, then portable 64 bit scalar).  The individual
+ * kernels are exported for benchmarking.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef INET_CKSUM_H
+#define INET_CKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t (*csum_partial_fn)(const void *data, size_t len, uint32_t sum);
+
+uint32_t csum_partial(const void *data, size_t len, uint32_t sum);
+
+/* fold to 16 bits and complement, ready to store in a checksum field;
+   a header that verifies folds to 0 */
+uint16_t csum_fold(uint32_t sum);
+
+uint32_t csum_partial_scalar(const void *data, size_t len, uint32_t sum);
+#if defined(__x86_64__) || defined(__i386__)
+uint32_t csum_partial_sse2(const void *data, size_t len, uint32_t sum);
+uint32_t csum_partial_avx2(const void *data, size_t len, uint32_t sum);
+#endif
+
+/* name of the kernel csum_partial dispatches to */
+const char *csum_impl_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* -- INET_CKSUM_H -- */
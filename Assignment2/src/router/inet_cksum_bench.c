@@ -0,0 +1,171 @@
+/*-----------------------------------------------------------------------------
+ * file:  inet_cksum_bench.c
+ *
+ * Description:
+ *
+ * Microbenchmark for the inet_cksum.h kernels at IP header (20 byte) and
+ * full frame (1500 byte) sizes, against the byte-at-a-time loop the router
+ * used before.  Every kernel is first cross-checked against that loop over
+ * random lengths and misalignments.
+ *
+ * Usage: cksum_bench [seed]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+
+#include "inet_cksum.h"
+
+#define CKSUM_BENCH_BYTES  (1u << 30)
+#define CKSUM_CHECK_ROUNDS 20000
+#define CKSUM_BUF_SZ       (64 * 1024)
+
+static uint64_t bench_rng;
+
+static uint32_t bench_rand(void)
+{
+    /* xorshift64*, good enough and independent of libc rand() */
+    bench_rng ^= bench_rng >> 12;
+    bench_rng ^= bench_rng << 25;
+    bench_rng ^= bench_rng >> 27;
+    return (uint32_t)((bench_rng * 2685821657736338717ULL) >> 32);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the old sr_utils.c loop, returning the same memory order partial sum */
+static uint32_t csum_partial_bytewise(const void* _data, size_t len, uint32_t sum)
+{
+    const uint8_t* data = (const uint8_t*)_data;
+    uint32_t s = 0;
+    uint16_t r;
+
+    for(; len >= 2; data += 2, len -= 2)
+    { s += data[0] << 8 | data[1]; }
+    if(len > 0)
+    { s += data[0] << 8; }
+    while(s > 0xffff)
+    { s = (s >> 16) + (s & 0xffff); }
+
+    r = htons((uint16_t)s);    /* back to memory order */
+    s = (uint32_t)r + sum;
+    return (s & 0xffff) + (s >> 16);
+}
+
+struct bench_impl
+{
+    const char*     name;
+    csum_partial_fn fn;
+    int             usable;
+};
+
+int main(int argc, char** argv)
+{
+    static const size_t sizes[] = { 20, 1500 };
+    struct bench_impl impls[] =
+    {
+        { "bytewise", csum_partial_bytewise, 1 },
+        { "scalar",   csum_partial_scalar,   1 },
+#if defined(__x86_64__) || defined(__i386__)
+        { "sse2",     csum_partial_sse2,     0 },
+        { "avx2",     csum_partial_avx2,     0 },
+#endif
+        { "dispatch", csum_partial,          1 },
+    };
+    unsigned int nimpls = sizeof(impls) / sizeof(impls[0]);
+    uint8_t* buf = (uint8_t*)malloc(CKSUM_BUF_SZ + 64);
+    volatile uint32_t sink = 0;
+    unsigned int i, j, k;
+
+    bench_rng = (argc > 1) ? strtoull(argv[1], 0, 0) : 0x5eed5eedULL;
+    if(bench_rng == 0)
+    { bench_rng = 1; }
+
+    if(!buf)
+    {
+        fprintf(stderr, "cksum_bench: out of memory\n");
+        return 1;
+    }
+    for(i = 0; i < CKSUM_BUF_SZ + 64; i++)
+    { buf[i] = (uint8_t)bench_rand(); }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    impls[2].usable = __builtin_cpu_supports("sse2");
+    impls[3].usable = __builtin_cpu_supports("avx2");
+#endif
+
+    printf("dispatch selects %s\n", csum_impl_name());
+
+    for(j = 1; j < nimpls; j++)
+    {
+        unsigned int bad = 0;
+
+        if(!impls[j].usable)
+        { continue; }
+        for(k = 0; k < CKSUM_CHECK_ROUNDS; k++)
+        {
+            size_t off = bench_rand() % 64;
+            size_t len = (k & 1) ? bench_rand() % 2048 : bench_rand() % CKSUM_BUF_SZ;
+            uint32_t seed = bench_rand() & 0xffff;
+
+            if(csum_fold(impls[j].fn(buf + off, len, seed)) !=
+               csum_fold(csum_partial_bytewise(buf + off, len, seed)))
+            { bad++; }
+        }
+        if(bad)
+        {
+            fprintf(stderr, "cksum_bench: %s disagrees with bytewise on %u/%u buffers\n",
+                    impls[j].name, bad, CKSUM_CHECK_ROUNDS);
+            return 1;
+        }
+    }
+
+    printf("%9s %6s %10s %10s\n", "impl", "bytes", "ns/op", "GB/s");
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        size_t len = sizes[i];
+        unsigned int iters = CKSUM_BENCH_BYTES / len;
+
+        for(j = 0; j < nimpls; j++)
+        {
+            double t0, t;
+
+            if(!impls[j].usable)
+            {
+                printf("%9s %6u %10s %10s\n", impls[j].name, (unsigned int)len, "-", "-");
+                continue;
+            }
+            if(j == 0)
+            { iters /= 8; }
+
+            t0 = bench_now();
+            for(k = 0; k < iters; k++)
+            {
+                /* walk the buffer so the loads are not all one cache line */
+                size_t off = (k * 64) % (CKSUM_BUF_SZ - len);
+                sink += impls[j].fn(buf + off, len, 0);
+            }
+            t = bench_now() - t0;
+
+            printf("%9s %6u %10.2f %10.2f\n", impls[j].name, (unsigned int)len,
+                   t * 1e9 / iters, (double)len * iters / t / 1e9);
+
+            if(j == 0)
+            { iters *= 8; }
+        }
+    }
+
+    free(buf);
+    return 0;
+}
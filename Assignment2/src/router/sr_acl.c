@@ -0,0 +1,513 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_acl.c
+ *
+ * Description:
+ *
+ * Reading, compiling and matching access control lists, see sr_acl.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_acl.h"
+#include "sr_flow.h"
+
+/* masked addresses and protocol -> slot, before masking to the table */
+static inline uint32_t sr_acl_hash(uint32_t src, uint32_t dst, uint8_t proto)
+{
+    uint64_t h = (((uint64_t)src << 32) | dst) ^ ((uint64_t)proto << 24);
+
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(h >> 32) ^ (uint32_t)(h >> 7);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_match(..)
+ * Scope: Global
+ *
+ * Action of the first rule of compiled list that matches key (only its
+ * addresses, protocol and ports are looked at), SR_ACL_PERMIT if none
+ * does.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_acl_match(const struct sr_acl_list* list, const struct sr_flow_key* key)
+{
+    const struct sr_acl_tuple* t   = list->tuples;
+    const struct sr_acl_tuple* end = t + list->ntuples;
+    const struct sr_acl_rule*  best = 0;
+    uint32_t best_prio = 0xffffffffu;
+    uint16_t sport = ntohs(key->sport);
+    uint16_t dport = ntohs(key->dport);
+
+    /* -- tuples come by their earliest rule, none after the first one
+          whose earliest is past the match can improve on it -- */
+    for(; t < end && t->best < best_prio; t++)
+    {
+        uint32_t src   = key->src & t->smask;
+        uint32_t dst   = key->dst & t->dmask;
+        uint8_t  proto = key->proto & t->pmask;
+        uint32_t mask  = t->nslots - 1;
+        uint32_t h     = sr_acl_hash(src, dst, proto);
+        uint32_t bit   = h & (t->nslots * SR_ACL_FILTER - 1);
+
+        if(!(t->filter[bit >> 6] & (1ULL << (bit & 63))))
+        { continue; }
+        for(h &= mask; t->slots[h].n; h = (h + 1) & mask)
+        {
+            const struct sr_acl_slot* slot = &t->slots[h];
+            const struct sr_acl_rule* r;
+            const struct sr_acl_rule* rend;
+
+            if(slot->src != src || slot->dst != dst || slot->proto != proto)
+            { continue; }
+
+            r    = list->rules + slot->first;
+            rend = r + slot->n;
+            for(; r < rend && r->prio < best_prio; r++)
+            {
+                if(sport >= r->sport_lo && sport <= r->sport_hi &&
+                   dport >= r->dport_lo && dport <= r->dport_hi)
+                {
+                    best = r;
+                    best_prio = r->prio;
+                    break;
+                }
+            }
+            break;
+        }
+    }
+    return best ? best->action : SR_ACL_PERMIT;
+} /* -- sr_acl_match -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_filter(..)
+ * Scope: Global
+ *
+ * Action of the list of acl bound to interface ifidx for direction dir
+ * on the IP packet ip_pkt (ip_len bytes from the IP header on, header
+ * length already checked).  SR_ACL_PERMIT if there is no such list.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_acl_filter(const struct sr_acl* acl, unsigned int ifidx, int dir,
+                  const uint8_t* ip_pkt, unsigned int ip_len)
+{
+    const struct sr_acl_list* list;
+    struct sr_flow_key key;
+
+    if(ifidx >= SR_IF_MAX || (list = acl->by_if[ifidx][dir]) == 0)
+    { return SR_ACL_PERMIT; }
+
+    sr_flow_key_of(ip_pkt, ip_len, 0, &key);
+    return sr_acl_match(list, &key);
+} /* -- sr_acl_filter -- */
+
+/* compile order: by tuple, then key, then position in the list */
+static int sr_acl_rule_cmp(const void* a, const void* b)
+{
+    const struct sr_acl_rule* x = (const struct sr_acl_rule*)a;
+    const struct sr_acl_rule* y = (const struct sr_acl_rule*)b;
+
+    if(x->smask != y->smask) { return x->smask < y->smask ? -1 : 1; }
+    if(x->dmask != y->dmask) { return x->dmask < y->dmask ? -1 : 1; }
+    if(x->pmask != y->pmask) { return x->pmask < y->pmask ? -1 : 1; }
+    if(x->src   != y->src)   { return x->src   < y->src   ? -1 : 1; }
+    if(x->dst   != y->dst)   { return x->dst   < y->dst   ? -1 : 1; }
+    if(x->proto != y->proto) { return x->proto < y->proto ? -1 : 1; }
+    return (x->prio > y->prio) - (x->prio < y->prio);
+}
+
+static int sr_acl_tuple_cmp(const void* a, const void* b)
+{
+    uint32_t x = ((const struct sr_acl_tuple*)a)->best;
+    uint32_t y = ((const struct sr_acl_tuple*)b)->best;
+
+    return (x > y) - (x < y);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_compile(..)
+ * Scope: Global
+ *
+ * Build the tuple tables of list from its rules, which it reorders.
+ * Each rule's prio must be its position in the list as written.
+ * Returns 0 on success, -1 if out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_acl_compile(struct sr_acl_list* list)
+{
+    struct sr_acl_rule* r = list->rules;
+    uint32_t n = list->nrules;
+    uint32_t i, j, k, nkeys;
+    struct sr_acl_tuple* t;
+
+    list->tuples  = 0;
+    list->ntuples = 0;
+    if(n == 0)
+    { return 0; }
+
+    qsort(r, n, sizeof(struct sr_acl_rule), sr_acl_rule_cmp);
+    for(i = 0; i < n; i++)
+    {
+        if(i == 0 || r[i].smask != r[i - 1].smask || r[i].dmask != r[i - 1].dmask ||
+           r[i].pmask != r[i - 1].pmask)
+        { list->ntuples++; }
+    }
+    list->tuples = (struct sr_acl_tuple*)calloc(list->ntuples, sizeof(struct sr_acl_tuple));
+    if(!list->tuples)
+    { goto nomem; }
+
+    /* -- rules of a tuple, then of a key, are now next to each other:
+          count a tuple's keys, then hash them into a table twice that -- */
+    for(t = list->tuples, i = 0; i < n; i = j, t++)
+    {
+        t->smask = r[i].smask;
+        t->dmask = r[i].dmask;
+        t->pmask = r[i].pmask;
+        t->best  = r[i].prio;
+        for(j = i, nkeys = 0; j < n && r[j].smask == t->smask && r[j].dmask == t->dmask &&
+                              r[j].pmask == t->pmask; j++)
+        {
+            if(j == i || r[j].src != r[j - 1].src || r[j].dst != r[j - 1].dst ||
+               r[j].proto != r[j - 1].proto)
+            { nkeys++; }
+            if(r[j].prio < t->best)
+            { t->best = r[j].prio; }
+        }
+        for(t->nslots = 8; t->nslots < 2 * nkeys; t->nslots <<= 1)
+        { }
+        t->slots  = (struct sr_acl_slot*)calloc(t->nslots, sizeof(struct sr_acl_slot));
+        t->filter = (uint64_t*)calloc(t->nslots * SR_ACL_FILTER / 64, sizeof(uint64_t));
+        if(!t->slots || !t->filter)
+        { goto nomem; }
+
+        for(k = i; k < j; k++)
+        {
+            struct sr_acl_slot* slot;
+            uint32_t h, bit;
+
+            if(k != i && r[k].src == r[k - 1].src && r[k].dst == r[k - 1].dst &&
+               r[k].proto == r[k - 1].proto)
+            { continue; }
+            h = sr_acl_hash(r[k].src, r[k].dst, r[k].proto);
+            bit = h & (t->nslots * SR_ACL_FILTER - 1);
+            t->filter[bit >> 6] |= 1ULL << (bit & 63);
+            for(h &= t->nslots - 1; t->slots[h].n; h = (h + 1) & (t->nslots - 1))
+            { }
+            slot = &t->slots[h];
+            slot->src   = r[k].src;
+            slot->dst   = r[k].dst;
+            slot->proto = r[k].proto;
+            slot->first = k;
+            while(k + slot->n < j && r[k + slot->n].src == slot->src &&
+                  r[k + slot->n].dst == slot->dst && r[k + slot->n].proto == slot->proto)
+            { slot->n++; }
+        }
+    }
+    qsort(list->tuples, list->ntuples, sizeof(struct sr_acl_tuple), sr_acl_tuple_cmp);
+    return 0;
+
+nomem:
+    fprintf(stderr, "Error compiling ACL, out of memory\n");
+    if(list->tuples)
+    {
+        for(i = 0; i < list->ntuples; i++)
+        {
+            free(list->tuples[i].slots);
+            free(list->tuples[i].filter);
+        }
+    }
+    free(list->tuples);
+    list->tuples  = 0;
+    list->ntuples = 0;
+    return -1;
+} /* -- sr_acl_compile -- */
+
+void sr_acl_list_free(struct sr_acl_list* list)
+{
+    uint32_t i;
+
+    for(i = 0; i < list->ntuples; i++)
+    {
+        free(list->tuples[i].slots);
+        free(list->tuples[i].filter);
+    }
+    free(list->tuples);
+    free(list->rules);
+    list->tuples = 0;
+    list->rules  = 0;
+}
+
+/* "any" or a.b.c.d[/len]; 0 on success */
+static int sr_acl_parse_prefix(const char* s, uint32_t* addr, uint32_t* mask)
+{
+    char  buf[32];
+    char* slash;
+    char* end;
+    struct in_addr in;
+    long  len = 32;
+
+    if(strcasecmp(s, "any") == 0)
+    {
+        *addr = 0;
+        *mask = 0;
+        return 0;
+    }
+    strncpy(buf, s, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    if((slash = strchr(buf, '/')) != 0)
+    {
+        *slash = 0;
+        len = strtol(slash + 1, &end, 10);
+        if(*end || end == slash + 1 || len < 0 || len > 32)
+        { return -1; }
+    }
+    if(inet_aton(buf, &in) == 0)
+    { return -1; }
+    *mask = htonl(len ? 0xffffffffu << (32 - len) : 0);
+    *addr = in.s_addr & *mask;
+    return 0;
+}
+
+/* "any", N or N-M; 0 on success */
+static int sr_acl_parse_ports(const char* s, uint16_t* lo, uint16_t* hi)
+{
+    char* end;
+    long  a, b;
+
+    if(strcasecmp(s, "any") == 0)
+    {
+        *lo = 0;
+        *hi = 0xffff;
+        return 0;
+    }
+    a = strtol(s, &end, 10);
+    if(end == s)
+    { return -1; }
+    b = a;
+    if(*end == '-')
+    {
+        s = end + 1;
+        b = strtol(s, &end, 10);
+        if(end == s)
+        { return -1; }
+    }
+    if(*end || a < 0 || b > 0xffff || a > b)
+    { return -1; }
+    *lo = (uint16_t)a;
+    *hi = (uint16_t)b;
+    return 0;
+}
+
+/* "any", tcp, udp, icmp or a number; 0 on success */
+static int sr_acl_parse_proto(const char* s, uint8_t* proto, uint8_t* pmask)
+{
+    char* end;
+    long  p;
+
+    *pmask = 0xff;
+    if(strcasecmp(s, "any") == 0)
+    {
+        *proto = 0;
+        *pmask = 0;
+        return 0;
+    }
+    if(strcasecmp(s, "tcp") == 0)  { *proto = ip_protocol_tcp;  return 0; }
+    if(strcasecmp(s, "udp") == 0)  { *proto = ip_protocol_udp;  return 0; }
+    if(strcasecmp(s, "icmp") == 0) { *proto = ip_protocol_icmp; return 0; }
+    p = strtol(s, &end, 10);
+    if(end == s || *end || p < 0 || p > 0xff)
+    { return -1; }
+    *proto = (uint8_t)p;
+    return 0;
+}
+
+/* the list of acl for iface and dir, added if new; 0 if out of memory */
+static struct sr_acl_list* sr_acl_list_get(struct sr_acl* acl, const char* iface, int dir)
+{
+    struct sr_acl_list* lists;
+    unsigned int i;
+
+    for(i = 0; i < acl->nlists; i++)
+    {
+        if(acl->lists[i].dir == dir &&
+           strncmp(acl->lists[i].iface, iface, sr_IFACE_NAMELEN) == 0)
+        { return &acl->lists[i]; }
+    }
+    lists = (struct sr_acl_list*)realloc(acl->lists, (acl->nlists + 1) * sizeof(struct sr_acl_list));
+    if(!lists)
+    { return 0; }
+    acl->lists = lists;
+    memset(&lists[acl->nlists], 0, sizeof(struct sr_acl_list));
+    /* -- the memset leaves the name terminated, the parser's %31s keeps it short -- */
+    memcpy(lists[acl->nlists].iface, iface, strnlen(iface, sr_IFACE_NAMELEN - 1));
+    lists[acl->nlists].dir = dir;
+    return &lists[acl->nlists++];
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_load(..)
+ * Scope: Global
+ *
+ * Read the access lists in filename (format in sr_acl.h) and compile
+ * them.  They apply once sr_acl_bind has matched them to interfaces.
+ * Returns NULL, having said why, on error.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_acl* sr_acl_load(const char* filename)
+{
+    FILE* fp;
+    char  line[BUFSIZ];
+    char  f[8][32];
+    const char* why = 0;
+    unsigned int lineno = 0, i;
+    struct sr_acl* acl;
+
+    if((fp = fopen(filename, "r")) == 0)
+    {
+        perror("fopen(..):sr_acl_load");
+        return 0;
+    }
+    if((acl = (struct sr_acl*)calloc(1, sizeof(struct sr_acl))) == 0)
+    {
+        fclose(fp);
+        fprintf(stderr, "Error loading ACL %s, out of memory\n", filename);
+        return 0;
+    }
+
+    while(!why && fgets(line, BUFSIZ, fp) != 0)
+    {
+        struct sr_acl_list* list;
+        struct sr_acl_rule  rule;
+        char* hash;
+        int   n, dir;
+
+        lineno++;
+        if((hash = strchr(line, '#')) != 0)
+        { *hash = 0; }
+        n = sscanf(line, "%31s %31s %31s %31s %31s %31s %31s %31s",
+                   f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7]);
+        if(n <= 0)
+        { continue; } /* -- blank line -- */
+        if(n != 8)
+        { why = "expected iface in|out permit|deny src dst proto sport dport"; break; }
+
+        memset(&rule, 0, sizeof(rule));
+        if(strcmp(f[1], "in") == 0)
+        { dir = SR_ACL_IN; }
+        else if(strcmp(f[1], "out") == 0)
+        { dir = SR_ACL_OUT; }
+        else
+        { why = "direction must be in or out"; break; }
+
+        if(strcmp(f[2], "permit") == 0)
+        { rule.action = SR_ACL_PERMIT; }
+        else if(strcmp(f[2], "deny") == 0)
+        { rule.action = SR_ACL_DENY; }
+        else
+        { why = "action must be permit or deny"; break; }
+
+        if(sr_acl_parse_prefix(f[3], &rule.src, &rule.smask) != 0 ||
+           sr_acl_parse_prefix(f[4], &rule.dst, &rule.dmask) != 0)
+        { why = "bad prefix"; break; }
+        if(sr_acl_parse_proto(f[5], &rule.proto, &rule.pmask) != 0)
+        { why = "bad protocol"; break; }
+        if(sr_acl_parse_ports(f[6], &rule.sport_lo, &rule.sport_hi) != 0 ||
+           sr_acl_parse_ports(f[7], &rule.dport_lo, &rule.dport_hi) != 0)
+        { why = "bad port range"; break; }
+
+        if((list = sr_acl_list_get(acl, f[0], dir)) == 0)
+        { why = "out of memory"; break; }
+        if(list->nrules == list->cap)
+        {
+            uint32_t cap = list->cap ? 2 * list->cap : 64;
+            struct sr_acl_rule* rules =
+                (struct sr_acl_rule*)realloc(list->rules, cap * sizeof(struct sr_acl_rule));
+
+            if(!rules)
+            { why = "out of memory"; break; }
+            list->rules = rules;
+            list->cap   = cap;
+        }
+        rule.prio = list->nrules;
+        list->rules[list->nrules++] = rule;
+    } /* -- while -- */
+    fclose(fp);
+
+    if(why)
+    {
+        fprintf(stderr, "Error loading ACL %s, line %u: %s\n", filename, lineno, why);
+        sr_acl_destroy(acl);
+        return 0;
+    }
+    for(i = 0; i < acl->nlists; i++)
+    {
+        if(sr_acl_compile(&acl->lists[i]) != 0)
+        {
+            sr_acl_destroy(acl);
+            return 0;
+        }
+    }
+    return acl;
+} /* -- sr_acl_load -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_bind(..)
+ * Scope: Global
+ *
+ * Match the lists of acl to the interfaces of if_list by name.  Returns
+ * 0 on success, -1 if a list names an interface the router does not
+ * have.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_acl_bind(struct sr_acl* acl, struct sr_if* if_list)
+{
+    struct sr_if* iface;
+    unsigned int i;
+    int ret = 0;
+
+    memset(acl->by_if, 0, sizeof(acl->by_if));
+    acl->egress = 0;
+    for(i = 0; i < acl->nlists; i++)
+    {
+        struct sr_acl_list* list = &acl->lists[i];
+
+        for(iface = if_list; iface; iface = iface->next)
+        {
+            if(strncmp(iface->name, list->iface, sr_IFACE_NAMELEN) == 0)
+            { break; }
+        }
+        if(!iface || iface->index >= SR_IF_MAX)
+        {
+            fprintf(stderr, "ACL for interface %s, which the router does not have\n",
+                    list->iface);
+            ret = -1;
+            continue;
+        }
+        acl->by_if[iface->index][list->dir] = list;
+        acl->egress |= (list->dir == SR_ACL_OUT);
+    }
+    return ret;
+} /* -- sr_acl_bind -- */
+
+void sr_acl_destroy(struct sr_acl* acl)
+{
+    unsigned int i;
+
+    if(!acl)
+    { return; }
+    for(i = 0; i < acl->nlists; i++)
+    { sr_acl_list_free(&acl->lists[i]); }
+    free(acl->lists);
+    free(acl);
+} /* -- sr_acl_destroy -- */
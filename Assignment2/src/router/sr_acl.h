@@ -0,0 +1,128 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_acl.h
+ *
+ * Description:
+ *
+ * Access control lists.  Each interface can have an ingress list, for
+ * packets it receives, and an egress list, for packets forwarded out of
+ * it.  A rule matches on source and destination prefix, protocol and
+ * source and destination port ranges; the first rule of a list that
+ * matches decides, and a packet no rule matches is permitted.  Ports are
+ * those of sr_flow_key_of, 0 for fragments, the first included, and for
+ * protocols other than TCP and UDP.
+ *
+ * Lists are read from a file (sr -a, sr_replay -a), one rule a line:
+ *
+ *    iface in|out permit|deny src[/len] dst[/len] proto sport dport
+ *
+ * with "any" allowed for src, dst, proto and ports, proto a name (tcp,
+ * udp, icmp) or number and ports N or N-M.  '#' starts a comment.
+ *
+ * A list is compiled for tuple space search: rules are grouped by tuple,
+ * their source and destination prefix lengths and whether they name a
+ * protocol, and each tuple is a hash table keyed by the masked addresses
+ * and protocol.  A lookup probes one table per tuple, in the order of
+ * the earliest rule each holds, and stops once no tuple left can hold a
+ * rule earlier than the match it has, so its cost follows the number of
+ * tuples rather than of rules.  Most probes find nothing; a bitmap per
+ * tuple, small enough to stay in cache, answers most of those without
+ * touching the table.  Port ranges are checked on the rules of
+ * the one key that matched, in rule order.
+ *
+ * The forwarding path only classifies packets the flow cache misses:
+ * a cached flow was permitted when it was learned, and the lists do not
+ * change while the router runs.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ACL_H
+#define SR_ACL_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+#include "sr_if.h"
+
+#define SR_ACL_IN     0
+#define SR_ACL_OUT    1
+
+#define SR_ACL_PERMIT 0
+#define SR_ACL_DENY   1
+
+#define SR_ACL_FILTER 8     /* filter bits per slot, power of two */
+
+struct sr_flow_key;
+
+struct sr_acl_rule
+{
+    uint32_t src;               /* network byte order, masked */
+    uint32_t smask;
+    uint32_t dst;
+    uint32_t dmask;
+    uint16_t sport_lo;          /* host byte order, inclusive */
+    uint16_t sport_hi;
+    uint16_t dport_lo;
+    uint16_t dport_hi;
+    uint8_t  proto;             /* 0 with pmask 0 for any */
+    uint8_t  pmask;
+    uint8_t  action;            /* SR_ACL_PERMIT or SR_ACL_DENY */
+    uint32_t prio;              /* position in the list, lower wins */
+};
+
+/* slot of a tuple's hash table, empty if n is 0 */
+struct sr_acl_slot
+{
+    uint32_t src;
+    uint32_t dst;
+    uint32_t first;             /* rules[first..first + n) have this key */
+    uint32_t n;
+    uint8_t  proto;
+};
+
+struct sr_acl_tuple
+{
+    uint32_t smask;
+    uint32_t dmask;
+    uint8_t  pmask;
+    uint32_t best;              /* prio of the earliest rule it holds */
+    uint32_t nslots;            /* power of two */
+    struct sr_acl_slot* slots;
+    uint64_t* filter;           /* SR_ACL_FILTER bits a slot, set for keys held */
+};
+
+struct sr_acl_list
+{
+    char     iface[sr_IFACE_NAMELEN];
+    int      dir;               /* SR_ACL_IN or SR_ACL_OUT */
+    struct sr_acl_rule*  rules; /* by tuple and key once compiled */
+    uint32_t nrules;
+    uint32_t cap;
+    struct sr_acl_tuple* tuples;    /* by best */
+    uint32_t ntuples;
+};
+
+struct sr_acl
+{
+    struct sr_acl_list* lists;
+    unsigned int nlists;
+    struct sr_acl_list* by_if[SR_IF_MAX][2];    /* sr_acl_bind, by index and dir */
+    int egress;                 /* any egress list bound */
+};
+
+struct sr_acl* sr_acl_load(const char* filename);
+int            sr_acl_bind(struct sr_acl* acl, struct sr_if* if_list);
+int            sr_acl_filter(const struct sr_acl* acl, unsigned int ifidx, int dir,
+                             const uint8_t* ip_pkt, unsigned int ip_len);
+void           sr_acl_destroy(struct sr_acl* acl);
+
+int            sr_acl_compile(struct sr_acl_list* list);
+int            sr_acl_match(const struct sr_acl_list* list, const struct sr_flow_key* key);
+void           sr_acl_list_free(struct sr_acl_list* list);
+
+#endif /* -- SR_ACL_H -- */
@@ -0,0 +1,228 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_acl_bench.c
+ *
+ * Description:
+ *
+ * Microbenchmark for sr_acl_match against a first-match scan of the rule
+ * list, at 100, 1k and 10k rules.  Rules are made up the way firewall
+ * lists tend to look: host and subnet addresses drawn from a few hundred
+ * sites, mostly TCP and UDP, destination ports mostly well known, source
+ * ports mostly any, and a last rule that permits everything.  Most
+ * packets are drawn from a rule, the rest are random headers between the
+ * same sites.  Every scanned packet is also checked against the
+ * classifier.
+ *
+ * Usage: acl_bench [seed]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_acl.h"
+#include "sr_flow.h"
+
+#define ACL_BENCH_PACKETS  1000000
+#define SCAN_BENCH_VISITS  400000000.0
+#define ACL_BENCH_SITES    256
+
+static uint64_t bench_rng;
+static uint32_t bench_sites[ACL_BENCH_SITES];
+
+static uint32_t bench_rand(void)
+{
+    /* xorshift64*, good enough and independent of libc rand() */
+    bench_rng ^= bench_rng >> 12;
+    bench_rng ^= bench_rng << 25;
+    bench_rng ^= bench_rng >> 27;
+    return (uint32_t)((bench_rng * 2685821657736338717ULL) >> 32);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* host order address inside one of the sites (each a /16) */
+static uint32_t bench_addr(void)
+{
+    return bench_sites[bench_rand() % ACL_BENCH_SITES] | (bench_rand() & 0xffff);
+}
+
+static uint32_t bench_mask(int len)
+{
+    return htonl(len ? 0xffffffffu << (32 - len) : 0);
+}
+
+static const uint16_t bench_ports[] = { 22, 25, 53, 80, 123, 443, 993, 3306, 8080 };
+#define BENCH_NPORTS (sizeof(bench_ports) / sizeof(bench_ports[0]))
+
+static void bench_rule(struct sr_acl_rule* r, uint32_t prio)
+{
+    static const int slens[] = { 0, 8, 16, 24, 24, 24, 28, 32, 32 };
+    static const int dlens[] = { 16, 24, 24, 28, 30, 32, 32 };
+    uint32_t p = bench_rand() % 100;
+
+    memset(r, 0, sizeof(*r));
+    r->smask = bench_mask(slens[bench_rand() % 9]);
+    r->dmask = bench_mask(dlens[bench_rand() % 7]);
+    r->src   = htonl(bench_addr()) & r->smask;
+    r->dst   = htonl(bench_addr()) & r->dmask;
+
+    r->pmask = 0xff;
+    if(p < 60)      { r->proto = ip_protocol_tcp; }
+    else if(p < 85) { r->proto = ip_protocol_udp; }
+    else if(p < 90) { r->proto = ip_protocol_icmp; }
+    else            { r->pmask = 0; }
+
+    r->sport_hi = r->dport_hi = 0xffff;
+    if(r->proto == ip_protocol_tcp || r->proto == ip_protocol_udp)
+    {
+        p = bench_rand() % 100;
+        if(p < 50)
+        { r->dport_lo = r->dport_hi = bench_ports[bench_rand() % BENCH_NPORTS]; }
+        else if(p < 65)
+        { r->dport_lo = 1024; }
+        if(bench_rand() % 10 == 0)
+        { r->sport_lo = r->sport_hi = bench_ports[bench_rand() % BENCH_NPORTS]; }
+    }
+    r->action = (bench_rand() & 1) ? SR_ACL_DENY : SR_ACL_PERMIT;
+    r->prio   = prio;
+}
+
+/* a packet r matches, unless a rule before it does */
+static void bench_packet_of(const struct sr_acl_rule* r, struct sr_flow_key* k)
+{
+    memset(k, 0, sizeof(*k));
+    k->src   = r->src | (htonl(bench_rand()) & ~r->smask);
+    k->dst   = r->dst | (htonl(bench_rand()) & ~r->dmask);
+    k->proto = r->pmask ? r->proto : ip_protocol_tcp;
+    if(k->proto == ip_protocol_tcp || k->proto == ip_protocol_udp)
+    {
+        k->sport = htons(r->sport_lo + bench_rand() % (r->sport_hi - r->sport_lo + 1u));
+        k->dport = htons(r->dport_lo + bench_rand() % (r->dport_hi - r->dport_lo + 1u));
+    }
+}
+
+static int scan_match(const struct sr_acl_rule* rules, uint32_t n, const struct sr_flow_key* k)
+{
+    uint16_t sport = ntohs(k->sport);
+    uint16_t dport = ntohs(k->dport);
+    uint32_t i;
+
+    for(i = 0; i < n; i++)
+    {
+        const struct sr_acl_rule* r = &rules[i];
+
+        if((k->src & r->smask) == r->src && (k->dst & r->dmask) == r->dst &&
+           (k->proto & r->pmask) == r->proto &&
+           sport >= r->sport_lo && sport <= r->sport_hi &&
+           dport >= r->dport_lo && dport <= r->dport_hi)
+        { return r->action; }
+    }
+    return SR_ACL_PERMIT;
+}
+
+static void bench_run(uint32_t nrules)
+{
+    struct sr_acl_list  list;
+    struct sr_acl_rule* rules = (struct sr_acl_rule*)malloc(nrules * sizeof(struct sr_acl_rule));
+    struct sr_flow_key* keys  = (struct sr_flow_key*)malloc(ACL_BENCH_PACKETS * sizeof(struct sr_flow_key));
+    unsigned int i, nscan, mismatches = 0;
+    double t0, build, t_tss, t_scan;
+    volatile unsigned long sink = 0;
+
+    memset(&list, 0, sizeof(list));
+    list.rules = (struct sr_acl_rule*)malloc(nrules * sizeof(struct sr_acl_rule));
+    if(!rules || !keys || !list.rules)
+    {
+        fprintf(stderr, "acl_bench: out of memory\n");
+        exit(1);
+    }
+
+    for(i = 0; i + 1 < nrules; i++)
+    { bench_rule(&rules[i], i); }
+    memset(&rules[i], 0, sizeof(struct sr_acl_rule));
+    rules[i].sport_hi = rules[i].dport_hi = 0xffff;
+    rules[i].prio = i;
+
+    /* -- 3 in 4 packets come from a rule, the rest are random -- */
+    for(i = 0; i < ACL_BENCH_PACKETS; i++)
+    {
+        if(i % 4 != 3)
+        { bench_packet_of(&rules[bench_rand() % nrules], &keys[i]); }
+        else
+        {
+            memset(&keys[i], 0, sizeof(struct sr_flow_key));
+            keys[i].src   = htonl(bench_addr());
+            keys[i].dst   = htonl(bench_addr());
+            keys[i].proto = (bench_rand() & 1) ? ip_protocol_tcp : ip_protocol_udp;
+            keys[i].sport = htons(1024 + bench_rand() % 64512);
+            keys[i].dport = htons(bench_ports[bench_rand() % BENCH_NPORTS]);
+        }
+    }
+
+    memcpy(list.rules, rules, nrules * sizeof(struct sr_acl_rule));
+    list.nrules = list.cap = nrules;
+    t0 = bench_now();
+    if(sr_acl_compile(&list) != 0)
+    {
+        fprintf(stderr, "acl_bench: sr_acl_compile failed\n");
+        exit(1);
+    }
+    build = bench_now() - t0;
+
+    t0 = bench_now();
+    for(i = 0; i < ACL_BENCH_PACKETS; i++)
+    { sink += sr_acl_match(&list, &keys[i]); }
+    t_tss = (bench_now() - t0) / ACL_BENCH_PACKETS;
+
+    nscan = (unsigned int)(SCAN_BENCH_VISITS / nrules);
+    if(nscan > ACL_BENCH_PACKETS) { nscan = ACL_BENCH_PACKETS; }
+
+    t0 = bench_now();
+    for(i = 0; i < nscan; i++)
+    { sink += scan_match(rules, nrules, &keys[i]); }
+    t_scan = (bench_now() - t0) / nscan;
+
+    for(i = 0; i < nscan; i++)
+    {
+        if(scan_match(rules, nrules, &keys[i]) != sr_acl_match(&list, &keys[i]))
+        { mismatches++; }
+    }
+
+    printf("%7u %7u %9.2f %9.1f %10.2f %11.1f %10.3f %10u\n",
+           nrules, list.ntuples, build * 1e3, t_tss * 1e9, 1e-6 / t_tss,
+           t_scan * 1e9, 1e-6 / t_scan, mismatches);
+
+    sr_acl_list_free(&list);
+    free(keys);
+    free(rules);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int i;
+
+    bench_rng = (argc > 1) ? strtoull(argv[1], 0, 0) : 0x5eed5eedULL;
+    if(bench_rng == 0)
+    { bench_rng = 1; }
+    for(i = 0; i < ACL_BENCH_SITES; i++)
+    { bench_sites[i] = bench_rand() & 0xffff0000u; }
+
+    printf("%d packets, 3 in 4 drawn from a rule\n", ACL_BENCH_PACKETS);
+    printf("%7s %7s %9s %9s %10s %11s %10s %10s\n",
+           "rules", "tuples", "build ms", "tss ns", "tss Mpps", "scan ns", "scan Mpps",
+           "mismatch");
+    bench_run(100);
+    bench_run(1000);
+    bench_run(10000);
+    return 0;
+}
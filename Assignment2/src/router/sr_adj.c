@@ -0,0 +1,85 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_adj.c
+ *
+ * Description:
+ *
+ * Route adjacencies, see sr_adj.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <netinet/in.h>
+
+#include "sr_adj.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+
+void sr_adj_init(struct sr_adj* adj)
+{
+    memset(adj, 0, sizeof(struct sr_adj));
+    adj->arp_seq = 1;           /* the ARP seq is even whenever it is valid */
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_adj_get(..)
+ * Scope: Global
+ *
+ * If adj was filled at ARP cache seq arp_seq, write its Ethernet header
+ * over the start of frame, return the egress interface through iface
+ * and return 0.  Otherwise return -1 and leave frame alone; its source
+ * MAC is still the sender's, which an ICMP error needs.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_adj_get(struct sr_adj* adj, unsigned int arp_seq,
+               uint8_t* frame, struct sr_if** iface)
+{
+    unsigned int seq = __atomic_load_n(&adj->seq, __ATOMIC_ACQUIRE);
+    uint8_t hdr[SR_ADJ_HDR_LEN];
+    struct sr_if* out;
+
+    if((seq & 1) || adj->arp_seq != arp_seq)
+    { return -1; }
+
+    memcpy(hdr, adj->hdr, SR_ADJ_HDR_LEN);
+    out = adj->iface;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&adj->seq, __ATOMIC_RELAXED) != seq)
+    { return -1; }
+
+    memcpy(frame, hdr, SR_ADJ_HDR_LEN);
+    *iface = out;
+    return 0;
+} /* -- sr_adj_get -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_adj_set(..)
+ * Scope: Global
+ *
+ * Fill adj for next hop mac out of iface, as seen at ARP cache seq
+ * arp_seq (read before the lookup that found mac).  Gives up quietly if
+ * another thread is filling adj right now.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_adj_set(struct sr_adj* adj, unsigned int arp_seq,
+                struct sr_if* iface, const unsigned char* mac)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)adj->hdr;
+    unsigned int seq = __atomic_load_n(&adj->seq, __ATOMIC_RELAXED);
+
+    if((seq & 1) || (arp_seq & 1) ||
+       !__atomic_compare_exchange_n(&adj->seq, &seq, seq + 1, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    { return; }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(eth->ether_dhost, mac, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+    adj->iface = iface;
+    adj->arp_seq = arp_seq;
+
+    __atomic_store_n(&adj->seq, seq + 2, __ATOMIC_RELEASE);
+} /* -- sr_adj_set -- */
@@ -0,0 +1,59 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_adj.h
+ *
+ * Description:
+ *
+ * Next hop adjacency of a route: the egress interface and the ready made
+ * Ethernet header (next hop MAC, interface MAC, IP ethertype) that a
+ * forwarded packet gets.  With a valid adjacency forwarding is the route
+ * lookup plus a 14 byte copy; no interface or ARP lookups.
+ *
+ * An adjacency is filled from the ARP cache on the slow path and stamped
+ * with the cache's seqlock counter.  Every ARP insert, expiry or eviction
+ * moves that counter on, so any change to the cache invalidates every
+ * adjacency and each is refilled by the next packet that uses it.  That
+ * is coarse, but cheap: checking is one load and a compare.
+ *
+ * Only routes with a gateway get one.  On a route without a gateway the
+ * next hop is the destination itself, which differs per packet.
+ *
+ * Several threads may forward over one route.  Filling takes the
+ * adjacency's own seq odd with a compare-and-swap (a thread that loses
+ * just skips filling).  Readers copy it out and then check seq once;
+ * a reader that races a fill falls back to the slow path, no retries.
+ *
+ * Hits do not set the ARP entry's CLOCK bit.  Next hops are few next to
+ * the cache capacity, so eviction should not reach them in practice.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ADJ_H
+#define SR_ADJ_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_ADJ_HDR_LEN 14   /* sizeof(sr_ethernet_hdr_t) */
+
+struct sr_if;
+
+struct sr_adj
+{
+    unsigned int  seq;          /* odd while being filled */
+    unsigned int  arp_seq;      /* ARP cache seq it was filled at, odd = never */
+    struct sr_if* iface;        /* egress interface */
+    uint8_t       hdr[SR_ADJ_HDR_LEN];
+};
+
+void sr_adj_init(struct sr_adj* adj);
+int  sr_adj_get(struct sr_adj* adj, unsigned int arp_seq,
+                uint8_t* frame, struct sr_if** iface);
+void sr_adj_set(struct sr_adj* adj, unsigned int arp_seq,
+                struct sr_if* iface, const unsigned char* mac);
+
+#endif /* -- SR_ADJ_H -- */
@@ -1,4 +1,5 @@
 #include <netinet/in.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -10,187 +11,339 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_log.h"
+#include "sr_stats.h"
+#include "sr_epoch.h"
 
-/*
-  This function gets called every second. For each request sent out, we keep
-  checking whether we should resend an request or destroy the arp request.
-  See the comments in the header file for an idea of what it should look like.
-*/
-void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-    struct sr_arpreq *req = sr->cache.requests;
-    while (req) {
-        struct sr_arpreq *temp = req;
-        req = req->next;
-        handle_arpreq(sr, temp); // handle arpreq destroys temp, so it's good that we saved the next pointer
-    }
+static void sr_arpcache_arm(struct sr_arpcache *cache, struct sr_timer *t, uint64_t expires);
+
+/* Retry timer of a request: resend, or give up after SR_ARPREQ_MAX_SENT.
+   Runs on the timeout thread with the cache lock held. */
+static void sr_arpreq_retry(struct sr_timer *t, void *sr_ptr) {
+    struct sr_arpreq *request = (struct sr_arpreq *)((char *)t - offsetof(struct sr_arpreq, retry));
+    handle_arpreq((struct sr_instance *)sr_ptr, request);
+}
+
+/* Sends an ARP request for ip out of iface: broadcast, or unicast to mac
+   when refreshing an entry we already have. */
+static int sr_arp_send_request(struct sr_instance *sr, struct sr_if *iface, uint32_t ip,
+                               const unsigned char *mac) {
+    /* Arp Request Packet consists of Ethernet Header and Arp Header*/
+    uint8_t arp_packet[sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
+    size_t arp_packet_len = sizeof(arp_packet);
+
+    /* Fill in the Ethernet Header */
+    sr_ethernet_hdr_t *ethernet_hdr = (sr_ethernet_hdr_t *)arp_packet; 
+    if (mac)
+        memcpy(ethernet_hdr->ether_dhost, mac, ETHER_ADDR_LEN); // refresh, ask the neighbor directly
+    else
+        memset(ethernet_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN); // broadcast
+    memcpy(ethernet_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN); // source is the interface's mac address USE MEMCPY??
+    ethernet_hdr->ether_type = htons(ethertype_arp); 
+
+    /* Fill in the ARP Header */
+    sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)(arp_packet + sizeof(sr_ethernet_hdr_t));
+    arp_hdr->ar_hrd = htons(arp_hrd_ethernet);
+    arp_hdr->ar_pro = htons(ethertype_ip);
+    arp_hdr->ar_hln = ETHER_ADDR_LEN;
+    arp_hdr->ar_pln = 4;
+    arp_hdr->ar_op = htons(arp_op_request); // op code 1 is request, op code 2 is reply
+    memcpy(arp_hdr->ar_sha, iface->addr, ETHER_ADDR_LEN);
+    arp_hdr->ar_sip = iface->ip; // source ip is the interface's ip
+    memset(arp_hdr->ar_tha, 0xff, ETHER_ADDR_LEN); // broadcast
+    arp_hdr->ar_tip = ip; // destination ip is the one we want the mac address of
+
+    return sr_send_packet_if(sr, arp_packet, arp_packet_len, iface);
 }
 
-struct sr_rt *sr_lookup_route(struct sr_rt *cur_rt, uint32_t ip) {
-    // search through routing table to find the mac address of the destination ip
-    while (cur_rt) {
-        if (cur_rt->dest.s_addr == ip) {
-            return cur_rt;
+/* Gives up on a request: ICMP host unreachable for every packet waiting on
+   it, then the request is destroyed. Caller holds the cache lock. */
+static void sr_arpreq_fail(struct sr_instance *sr, struct sr_arpreq *request) {
+    // send icmp host unreachable
+    SR_DEBUG("handle_arpreq: Sending ICMP Host Unreachable for IP: %u\n", request->ip);
+    struct sr_packet *cur_pkt = request->packets;
+    while (cur_pkt) { 
+        sr_stats_drop(sr->stats, sr_drop_arp_timeout);
+        // get the original ip header of the packet, because we want to match its IP with its mac address using the routing table, and get other info from it
+        sr_ip_hdr_t *cur_ip_hdr = (sr_ip_hdr_t *)(cur_pkt->buf + sizeof(sr_ethernet_hdr_t));
+        
+        // search through routing table to find the correct interface
+        sr_epoch_enter();
+        struct sr_rt *rt = sr_lookup_route(sr, cur_ip_hdr->ip_src);
+        struct sr_if *return_iface = rt ? sr_get_interface(sr, rt->interface) : NULL; // match 192.168.1.10 with the interface 192.168.1.0/24, for example
+        sr_epoch_exit();
+        if (!return_iface) {
+            SR_WARN("handle_arpreq: No route back to sender, dropping\n");
+            cur_pkt = cur_pkt->next;
+            continue;
+        }
+
+        // 3 is destination unreachable, 1 is host unreachable
+        SR_DEBUG("handle_arpreq: Sending ICMP packet to %u from %u\n", cur_ip_hdr->ip_src, return_iface->ip);
+        if (sr_send_icmp_error(sr, cur_pkt->buf, 3, 1, return_iface, return_iface->ip) == 0) {
+            SR_DEBUG("handle_arpreq: Sent ICMP Host Unreachable\n");
         }
-        cur_rt = cur_rt->next;
+        cur_pkt = cur_pkt->next; // go take care of the next packet
     }
-    return NULL;
+    sr_arpreq_destroy(&sr->cache, request);
 }
 
 // LECTURE 9 talks about spanning tree
 void handle_arpreq(struct sr_instance *sr, struct sr_arpreq *request) {
     
-    if (difftime(time(NULL), request->sent) <= 1.0) {
+    if (sr_timer_pending(&(request->retry))) {
         // printf("ARP request sent recently, skipping...\n");
         return;
     }
 
-    if (request->times_sent >= 5) {
-        // send icmp host unreachable
-        printf("handle_arpreq: Sending ICMP Host Unreachable for IP: %u\n", request->ip);
-        // Figure out the length of your new icmp packet (hint: it will be the same length as the original packet if the original packet was an ICMP echo request. Otherwise, calculate it based on the size of the headers it will have).
-        // Create a new icmp packet (hint: use malloc)
-
-        struct sr_packet *cur_pkt = request->packets;
-        while (cur_pkt) { 
-            // allocate memory for the icmp packet which consists of icmp header, ip header, and ethernet header
-            size_t icmp_packet_len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t);
-            uint8_t *icmp_packet = (uint8_t *)malloc(icmp_packet_len);
-            
-            if (!icmp_packet)
-            {
-                fprintf(stderr, "Failed to allocate memory for ICMP packet\n");
-                return;
-            }
-            printf("handle_arpreq: Allocated memory for ICMP packet of length %zu\n", icmp_packet_len);
-
-            // get the original ip header of the packet, because we want to match its IP with its mac address using the routing table, and get other info from it
-            sr_ip_hdr_t *cur_ip_hdr = (sr_ip_hdr_t *)(cur_pkt->buf + sizeof(sr_ethernet_hdr_t));
-            
-            // search through routing table to find the correct interface
-            struct sr_rt *rt = sr_lookup_route(sr->routing_table, cur_ip_hdr->ip_src);
-            struct sr_if *return_iface = sr_get_interface(sr, rt->interface); // match 192.168.1.10 with the interface 192.168.1.0/24, for example
-          
-            // populate icmp header
-            sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)(icmp_packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-            icmp_hdr->icmp_type = 3; // 3 is destination unreachable
-            icmp_hdr->icmp_code = 1; // 1 is host unreachable
-            icmp_hdr->icmp_sum = 0; // checksum is 0`
-            memcpy(icmp_hdr->data, cur_ip_hdr, ICMP_DATA_SIZE);
-
-            sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(icmp_packet + sizeof(sr_ethernet_hdr_t));
-            ip_hdr->ip_hl = cur_ip_hdr->ip_hl;
-            ip_hdr->ip_v = cur_ip_hdr->ip_v;
-            // ip_hdr->ip_tos = 0;
-            ip_hdr->ip_len = htons(icmp_packet_len - sizeof(sr_ethernet_hdr_t));
-            ip_hdr->ip_off = htons(IP_DF);
-            ip_hdr->ip_id = cur_ip_hdr->ip_id;
-            ip_hdr->ip_ttl = INIT_TTL;
-            ip_hdr->ip_p = ip_protocol_icmp;
-            ip_hdr->ip_sum = 0;
-            ip_hdr->ip_src = return_iface->ip;
-            ip_hdr->ip_dst = cur_ip_hdr->ip_src;
-
-
-            // Populate Ethernet header        
-            sr_ethernet_hdr_t *ethernet_hdr = (sr_ethernet_hdr_t *)icmp_packet;
-            memcpy(ethernet_hdr->ether_shost, return_iface->addr, ETHER_ADDR_LEN); // source is the router's interface's mac address
-            memcpy(ethernet_hdr->ether_dhost, ((sr_ethernet_hdr_t *)(cur_pkt->buf))->ether_shost, ETHER_ADDR_LEN); // destination is back to the original source's mac address
-            ethernet_hdr->ether_type = htons(ethertype_ip);
-
-            // recompute checksum
-            icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_hdr_t));
-            ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
-
-            printf("handle_arpreq: Sending ICMP packet to %u from %u\n", ip_hdr->ip_dst, ip_hdr->ip_src);
-
-            if (sr_send_packet(sr, icmp_packet, icmp_packet_len, return_iface->name) == -1) {
-                fprintf(stderr, "Failed to send packet\n");
-            } else {
-                printf("handle_arpreq: Sent ICMP Host Unreachable\n");
-            }
-            free(icmp_packet);
-            cur_pkt = cur_pkt->next; // go take care of the next packet
-        }
-        sr_arpreq_destroy(&sr->cache, request);
+    if (request->times_sent >= SR_ARPREQ_MAX_SENT) {
+        sr_arpreq_fail(sr, request);
     } else {
         // send arp request
-        struct sr_if *iface = sr_get_interface(sr, request->packets->iface);
+        struct sr_if *iface = sr_get_interface_by_index(sr, request->iface);
         if (!iface) {
-            fprintf(stderr, "Interface not found\n");
+            // no retry timer would ever come back to it, give up now
+            SR_ERR("Interface not found\n");
+            sr_arpreq_fail(sr, request);
             return;
         }
         
-        /* Arp Request Packet consists of Ethernet Header and Arp Header*/
-        size_t arp_packet_len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
-        uint8_t *arp_packet = (uint8_t *)malloc(arp_packet_len);
-
-        /* Fill in the Ethernet Header */
-        sr_ethernet_hdr_t *ethernet_hdr = (sr_ethernet_hdr_t *)arp_packet; 
-        memset(ethernet_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN); // broadcast
-        memcpy(ethernet_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN); // source is the interface's mac address USE MEMCPY??
-        ethernet_hdr->ether_type = htons(ethertype_arp); 
-
-        /* Fill in the ARP Header */
-        sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)(arp_packet + sizeof(sr_ethernet_hdr_t));
-        arp_hdr->ar_hrd = htons(arp_hrd_ethernet);
-        arp_hdr->ar_pro = htons(ethertype_ip);
-        arp_hdr->ar_hln = ETHER_ADDR_LEN;
-        arp_hdr->ar_pln = 4;
-        arp_hdr->ar_op = htons(arp_op_request); // op code 1 is request, op code 2 is reply
-        memcpy(arp_hdr->ar_sha, iface->addr, ETHER_ADDR_LEN);
-        arp_hdr->ar_sip = iface->ip; // source ip is the interface's ip
-        memset(arp_hdr->ar_tha, 0xff, ETHER_ADDR_LEN); // broadcast
-        arp_hdr->ar_tip = request->ip; // destination ip is the arpreq's ip
-        
         /* Send the packet */
-        printf("handle_arpreq: Created ARP request for IP: %u\n", request->ip);
-        if (sr_send_packet(sr, arp_packet, arp_packet_len, request->packets->iface) == -1) {
-            fprintf(stderr, "Failed to send ARP request\n");
+        if (sr_arp_send_request(sr, iface, request->ip, NULL) == -1) {
+            SR_ERR("Failed to send ARP request\n");
         } else {
-            printf("handle_arpreq: Sent ARP request for IP: %u\n", request->ip);
+            SR_DEBUG("handle_arpreq: Sent ARP request for IP: %u\n", request->ip);
         }
-        printf("Sent this ARP packet: \n");
-        //print_hdrs(arp_packet, arp_packet_len); 
-        printf("\n");
-        free(arp_packet);
 
         request->sent = time(NULL);
         request->times_sent++;
+
+        sr_timer_init(&(request->retry), sr_arpreq_retry, sr);
+        sr_arpcache_arm(&(sr->cache), &(request->retry), sr_timer_now() + SR_ARPREQ_RETRY_MS);
         }
     }
 
 
 /* You should not need to touch the rest of this code. */
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
-    pthread_mutex_lock(&(cache->lock));
+/* Home slot of an IP in the hash table. */
+static unsigned int sr_arpcache_hash(const struct sr_arpcache *cache, uint32_t ip) {
+    uint32_t h = ip * 2654435761u;
+    return (h ^ (h >> 16)) & (cache->nslots - 1);
+}
+
+/* Returns the slot holding ip, or the empty slot that ends its probe run. */
+static unsigned int sr_arpcache_find_slot(const struct sr_arpcache *cache, uint32_t ip) {
+    unsigned int i = sr_arpcache_hash(cache, ip);
+
+    while (cache->entries[i].valid && cache->entries[i].ip != ip) {
+        i = (i + 1) & (cache->nslots - 1);
+    }
+    return i;
+}
+
+/* Removes the entry in slot i and shifts later members of the probe run
+   back so no tombstone is needed. Caller holds the lock. */
+static void sr_arpcache_remove_slot(struct sr_arpcache *cache, unsigned int i) {
+    unsigned int mask = cache->nslots - 1;
+    unsigned int j = i;
+
+    sr_timer_del(&(cache->wheel), &(cache->expiry[i]));
+
+    while (1) {
+        unsigned int home;
+
+        j = (j + 1) & mask;
+        if (!cache->entries[j].valid)
+            break;
+
+        /* Entry j may fill the hole at i only if its home slot is not in
+           the cyclic range (i, j]. */
+        home = sr_arpcache_hash(cache, cache->entries[j].ip);
+        if ((i <= j) ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+
+        cache->entries[i] = cache->entries[j];
+        sr_timer_move(&(cache->expiry[j]), &(cache->expiry[i]));
+        i = j;
+    }
 
-    struct sr_arpentry *entry = NULL, *copy = NULL;
+    memset(&(cache->entries[i]), 0, sizeof(struct sr_arpentry));
+    cache->count--;
+}
+
+/* Frees one slot with a CLOCK sweep: referenced entries get a second
+   chance, the first unreferenced one is evicted. Caller holds the lock. */
+static void sr_arpcache_evict(struct sr_arpcache *cache) {
+    unsigned int mask = cache->nslots - 1;
+
+    while (1) {
+        struct sr_arpentry *cur = &(cache->entries[cache->hand]);
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
-            entry = &(cache->entries[i]);
+        if (cur->valid) {
+            if (!cur->referenced) {
+                sr_arpcache_remove_slot(cache, cache->hand);
+                return;
+            }
+            cur->referenced = 0;
         }
+        cache->hand = (cache->hand + 1) & mask;
     }
+}
 
-    /* Must return a copy b/c another thread could jump in and modify
-       table after we return. */
-    if (entry) {
-        copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
-        memcpy(copy, entry, sizeof(struct sr_arpentry));
+/* Seqlock write side. Caller holds the lock. */
+static void sr_arpcache_write_begin(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void sr_arpcache_write_end(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Arms a timer on the cache wheel and wakes the timeout thread if it now
+   has to run sooner than it planned. Caller holds the lock. */
+static void sr_arpcache_arm(struct sr_arpcache *cache, struct sr_timer *t, uint64_t expires) {
+    sr_timer_add(&(cache->wheel), t, expires);
+    if (expires < cache->wake_at) {
+        cache->wake_at = expires;
+        pthread_cond_signal(&(cache->wake));
     }
+}
 
-    pthread_mutex_unlock(&(cache->lock));
+/* Timer of entries[t - cache->expiry]: refresh the entry if it is in use,
+   expire it once SR_ARPCACHE_TO is up. Runs on the timeout thread with the
+   lock held. */
+static void sr_arpentry_expire(struct sr_timer *t, void *cache_ptr) {
+    struct sr_arpcache *cache = cache_ptr;
+    struct sr_instance *sr = (struct sr_instance *)((char *)cache - offsetof(struct sr_instance, cache));
+    unsigned int i = (unsigned int)(t - cache->expiry);
+    struct sr_arpentry *entry = &(cache->entries[i]);
+    uint64_t now = sr_timer_now();
+
+    if (now >= entry->expires_ms) {
+        sr_arpcache_write_begin(cache);
+        sr_arpcache_remove_slot(cache, i);
+        sr_arpcache_write_end(cache);
+        cache->expired++;
+        return;
+    }
+
+    /* Ask again every SR_ARPREQ_RETRY_MS while there is time for an answer;
+       the reply goes through sr_arpcache_insert, which re-arms this timer */
+    if (__atomic_load_n(&(entry->used), __ATOMIC_RELAXED) &&
+        now + SR_ARPREQ_RETRY_MS <= entry->expires_ms) {
+        struct sr_if *iface = sr_get_interface_by_index(sr, entry->iface);
+        if (iface && sr_arp_send_request(sr, iface, entry->ip, entry->mac) == 0) {
+            SR_DEBUG("sr_arpentry_expire: Sent ARP refresh for IP: %u\n", entry->ip);
+            cache->refreshes++;
+        }
+        sr_arpcache_arm(cache, t, now + SR_ARPREQ_RETRY_MS);
+    } else {
+        sr_arpcache_arm(cache, t, entry->expires_ms);
+    }
+}
+
+/* Sets referenced and/or used on entry if it still holds ip. The lookup
+   that found it has already let go of seq, so a writer may have moved
+   another neighbour into the slot since; comparing ip in the same word
+   keeps the bits off that one. */
+static void sr_arpentry_mark(struct sr_arpentry *entry, uint32_t ip,
+                             uint16_t referenced, uint16_t used) {
+    struct sr_arpentry want;
+    uint64_t seen = __atomic_load_n(&(entry->ip_hints), __ATOMIC_RELAXED);
+
+    do {
+        want.ip_hints = seen;
+        if (want.ip != ip)
+            return;
+        want.referenced |= referenced;
+        want.used |= used;
+        if (want.ip_hints == seen)
+            return;
+    } while (!__atomic_compare_exchange_n(&(entry->ip_hints), &seen, want.ip_hints, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* Lock-free lookup, see sr_arpcache.h. */
+struct sr_arpentry sr_arpcache_find(struct sr_arpcache *cache, uint32_t ip) {
+    struct sr_arpentry copy;
+    unsigned int mask = cache->nslots - 1;
+    unsigned int seq, i, probes;
+    time_t now = time(NULL);
+
+    while (1) {
+        seq = __atomic_load_n(&(cache->seq), __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        /* Probe without the lock. A torn read can make the run look longer
+           than it is, so stop after one lap and let the seq check decide. */
+        memset(&copy, 0, sizeof(copy));
+        i = sr_arpcache_hash(cache, ip);
+        for (probes = 0; probes <= mask; probes++) {
+            if (!cache->entries[i].valid)
+                break;
+            if (cache->entries[i].ip == ip) {
+                copy = cache->entries[i];
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&(cache->seq), __ATOMIC_RELAXED) == seq)
+            break;
+    }
+
+    if (copy.valid && copy.expires > now) {
+        /* CLOCK bit and refresh hint, set only on the slot that still holds
+           ip: on a neighbour just moved there they would keep a cold entry
+           from eviction or refresh one nobody looks up. Skip the store when
+           both are set so hits keep the line shared. */
+        if (!copy.referenced || !copy.used)
+            sr_arpentry_mark(&(cache->entries[i]), ip, 1, 1);
+    } else {
+        copy.valid = 0;
+    }
 
     return copy;
 }
 
+/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
+   You must free the returned structure if it is not NULL. */
+struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
+    struct sr_arpentry entry = sr_arpcache_find(cache, ip);
+    struct sr_arpentry *copy = NULL;
+
+    if (entry.valid) {
+        copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
+        memcpy(copy, &entry, sizeof(struct sr_arpentry));
+    }
+
+    return copy;
+}
+
+/* Unlink the oldest packet of a request and return its block to the pool.
+   Caller holds the lock. */
+static void sr_arpreq_pop(struct sr_arpcache *cache, struct sr_arpreq *req) {
+    struct sr_packet *pkt = req->packets;
+
+    req->packets = pkt->next;
+    if (!req->packets)
+        req->packets_tail = NULL;
+    req->npackets--;
+    cache->npackets--;
+    sr_pool_put(&(cache->pkt_pool), pkt);
+}
+
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. You should free the passed *packet.
+   that corresponds to this ARP request. The packet is copied into a pool
+   block; once a queue cap is reached the drop policy decides which packet
+   is lost.
 
    A pointer to the ARP request is returned; it should not be freed. The caller
    can remove the ARP request from the queue by calling sr_arpreq_destroy. */
@@ -198,7 +351,7 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet,           /* borrowed */
                                        unsigned int packet_len,
-                                       char *iface)
+                                       unsigned int iface)
 {
     pthread_mutex_lock(&(cache->lock));
 
@@ -213,21 +366,48 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     if (!req) {
         req = (struct sr_arpreq *) calloc(1, sizeof(struct sr_arpreq));
         req->ip = ip;
+        req->iface = iface;
         req->next = cache->requests;
         cache->requests = req;
     }
 
-    /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
-        struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
-
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
-        memcpy(new_pkt->buf, packet, packet_len);
-        new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-        strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
-        new_pkt->next = req->packets;
-        req->packets = new_pkt;
+    /* Add the packet to the tail of the list of packets for this request */
+    if (packet && packet_len) {
+        struct sr_packet *new_pkt = NULL;
+        int room = 1;
+
+        if (req->npackets >= cache->pkt_cap_req ||
+            cache->npackets >= cache->pkt_cap_total) {
+            if (cache->drop_policy == SR_ARPQ_DROP_OLDEST && req->packets) {
+                sr_arpreq_pop(cache, req);
+                cache->drops_oldest++;
+            }
+            else {
+                room = 0;
+            }
+        }
+
+        if (room)
+            new_pkt = (struct sr_packet *)sr_pool_get(&(cache->pkt_pool),
+                                                      sizeof(struct sr_packet) + packet_len);
+
+        if (new_pkt) {
+            new_pkt->buf = (uint8_t *)(new_pkt + 1);
+            memcpy(new_pkt->buf, packet, packet_len);
+            new_pkt->len = packet_len;
+            new_pkt->iface = iface;
+            new_pkt->next = NULL;
+            if (req->packets_tail)
+                req->packets_tail->next = new_pkt;
+            else
+                req->packets = new_pkt;
+            req->packets_tail = new_pkt;
+            req->npackets++;
+            cache->npackets++;
+        }
+        else {
+            cache->drops_tail++;
+        }
     }
 
     pthread_mutex_unlock(&(cache->lock));
@@ -241,7 +421,8 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
    2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
-                                     uint32_t ip)
+                                     uint32_t ip,
+                                     unsigned int iface)
 {
     pthread_mutex_lock(&(cache->lock));
 
@@ -262,19 +443,36 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
         prev = req;
     }
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if (!(cache->entries[i].valid))
-            break;
-    }
+    uint64_t now = sr_timer_now();
+
+    sr_arpcache_write_begin(cache);
 
-    if (i != SR_ARPCACHE_SZ) {
-        memcpy(cache->entries[i].mac, mac, 6);
-        cache->entries[i].ip = ip;
-        cache->entries[i].added = time(NULL);
-        cache->entries[i].valid = 1;
+    unsigned int i = sr_arpcache_find_slot(cache, ip);
+
+    if (!(cache->entries[i].valid)) {
+        if (cache->count >= cache->capacity) {
+            sr_arpcache_evict(cache);
+            i = sr_arpcache_find_slot(cache, ip);
+        }
+        cache->count++;
     }
 
+    memcpy(cache->entries[i].mac, mac, 6);
+    cache->entries[i].ip = ip;
+    cache->entries[i].added = time(NULL);
+    cache->entries[i].expires = cache->entries[i].added + (time_t)SR_ARPCACHE_TO;
+    cache->entries[i].expires_ms = now + (uint64_t)(SR_ARPCACHE_TO * 1000);
+    cache->entries[i].referenced = 0;
+    cache->entries[i].used = 0;
+    cache->entries[i].iface = iface;
+    cache->entries[i].valid = 1;
+
+    sr_arpcache_write_end(cache);
+
+    /* A reply to a refresh lands here too and starts the entry over */
+    sr_arpcache_arm(cache, &(cache->expiry[i]),
+                    now + (uint64_t)((SR_ARPCACHE_TO - SR_ARPCACHE_REFRESH) * 1000));
+
     pthread_mutex_unlock(&(cache->lock));
 
     return req;
@@ -303,16 +501,9 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
             prev = req;
         }
 
-        struct sr_packet *pkt, *nxt;
-
-        for (pkt = entry->packets; pkt; pkt = nxt) {
-            nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
-            free(pkt);
-        }
+        while (entry->packets)
+            sr_arpreq_pop(cache, entry);
+        sr_timer_del(&(cache->wheel), &(entry->retry));
 
         free(entry);
     }
@@ -325,25 +516,83 @@ void sr_arpcache_dump(struct sr_arpcache *cache) {
     fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
     fprintf(stderr, "-----------------------------------------------------------\n");
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+    unsigned int i;
+    for (i = 0; i < cache->nslots; i++) {
         struct sr_arpentry *cur = &(cache->entries[i]);
         unsigned char *mac = cur->mac;
+        if (!cur->valid)
+            continue;
         fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
     }
 
     fprintf(stderr, "\n");
 }
 
-/* Initialize table + table lock. Returns 0 on success. */
+/* Initialize table + table lock with the default capacity. Returns 0 on
+   success. */
 int sr_arpcache_init(struct sr_arpcache *cache) {
-    /* Seed RNG to kick out a random entry if all entries full. */
-    srand(time(NULL));
+    return sr_arpcache_init_sz(cache, SR_ARPCACHE_SZ);
+}
+
+/* Initialize table + table lock for up to capacity entries. Returns 0 on
+   success. */
+int sr_arpcache_init_sz(struct sr_arpcache *cache, unsigned int capacity) {
+    if (capacity == 0)
+        capacity = SR_ARPCACHE_SZ;
+
+    /* Keep the load factor at or below 1/2 so probe runs stay short */
+    cache->nslots = 2;
+    while (cache->nslots < 2 * capacity)
+        cache->nslots <<= 1;
 
     /* Invalidate all entries */
-    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->entries = (struct sr_arpentry *) calloc(cache->nslots, sizeof(struct sr_arpentry));
+    if (!cache->entries)
+        return -1;
+    cache->capacity = capacity;
+    cache->count = 0;
+    cache->hand = 0;
+    cache->seq = 0;
     cache->requests = NULL;
 
+    /* One expiry timer per slot, all idle until an entry is inserted */
+    cache->expiry = (struct sr_timer *) calloc(cache->nslots, sizeof(struct sr_timer));
+    if (!cache->expiry) {
+        free(cache->entries);
+        cache->entries = NULL;
+        return -1;
+    }
+    unsigned int i;
+    for (i = 0; i < cache->nslots; i++)
+        sr_timer_init(&(cache->expiry[i]), sr_arpentry_expire, cache);
+    sr_timer_wheel_init(&(cache->wheel), sr_timer_now());
+    cache->wake_at = UINT64_MAX;
+
+    /* Parked packets live in pool blocks, at most pkt_cap_total at a time */
+    cache->pkt_cap_req = SR_ARPQ_PER_REQ;
+    cache->pkt_cap_total = SR_ARPQ_TOTAL;
+    cache->npackets = 0;
+    cache->drop_policy = SR_ARPQ_DROP_TAIL;
+    cache->drops_tail = 0;
+    cache->drops_oldest = 0;
+    cache->refreshes = 0;
+    cache->expired = 0;
+    if (sr_pool_init(&(cache->pkt_pool), sizeof(struct sr_packet) + SR_ARPQ_FRAME_SZ,
+                     SR_ARPQ_TOTAL) != 0) {
+        free(cache->expiry);
+        cache->expiry = NULL;
+        free(cache->entries);
+        cache->entries = NULL;
+        return -1;
+    }
+
+    /* The timeout thread sleeps against the wheel's monotonic clock */
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(cache->wake), &cattr);
+    pthread_condattr_destroy(&cattr);
+
     /* Acquire mutex lock */
     pthread_mutexattr_init(&(cache->attr));
     pthread_mutexattr_settype(&(cache->attr), PTHREAD_MUTEX_RECURSIVE);
@@ -354,33 +603,43 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
 
 /* Destroys table + table lock. Returns 0 on success. */
 int sr_arpcache_destroy(struct sr_arpcache *cache) {
+    free(cache->entries);
+    cache->entries = NULL;
+    free(cache->expiry);
+    cache->expiry = NULL;
+    pthread_cond_destroy(&(cache->wake));
+    sr_pool_destroy(&(cache->pkt_pool));
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
-/* Thread which sweeps through the cache and invalidates entries that were added
-   more than SR_ARPCACHE_TO seconds ago. */
+/* Thread which runs the cache's timer wheel: entry refresh and expiry and
+   ARP request retries. It sleeps until the earliest pending timer (or indefinitely while
+   there is none), so its idle cost does not depend on how many entries or
+   requests there are. */
 void *sr_arpcache_timeout(void *sr_ptr) {
     struct sr_instance *sr = sr_ptr;
     struct sr_arpcache *cache = &(sr->cache);
 
-    while (1) {
-        sleep(1.0);
-
-        pthread_mutex_lock(&(cache->lock));
-
-        time_t curtime = time(NULL);
+    pthread_mutex_lock(&(cache->lock));
 
-        int i;
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
-            }
+    while (1) {
+        /* Expiry removes one entry per write section, so readers are only
+           ever held off for a single backward shift. The request queue is
+           still under the lock, but the forwarding hit path
+           (sr_arpcache_find) never takes it. */
+        sr_timer_advance(&(cache->wheel), sr_timer_now());
+
+        cache->wake_at = sr_timer_next(&(cache->wheel));
+        if (cache->wake_at == UINT64_MAX) {
+            pthread_cond_wait(&(cache->wake), &(cache->lock));
+        } else {
+            struct timespec ts;
+            ts.tv_sec = cache->wake_at / 1000;
+            ts.tv_nsec = (cache->wake_at % 1000) * 1000000;
+            pthread_cond_timedwait(&(cache->wake), &(cache->lock), &ts);
         }
-
-        sr_arpcache_sweepreqs(sr);
-
-        pthread_mutex_unlock(&(cache->lock));
     }
 
+    pthread_mutex_unlock(&(cache->lock));
     return NULL;
 }
@@ -2,7 +2,10 @@
    request queue, and ARP cache entries. The ARP request queue holds data about
    an outgoing ARP cache request and the packets that are waiting on a reply
    to that ARP cache request. The ARP cache entries hold IP->MAC mappings and
-   are timed out every SR_ARPCACHE_TO seconds.
+   are timed out every SR_ARPCACHE_TO seconds. An entry that is still being
+   looked up is refreshed with a unicast ARP request shortly before then (see
+   SR_ARPCACHE_REFRESH), so a busy next hop does not go missing every
+   SR_ARPCACHE_TO seconds.
 
    Pseudocode for use of these structures follows.
 
@@ -18,6 +21,11 @@
        req = arpcache_queuereq(next_hop_ip, packet, len)
        handle_arpreq(req)
 
+   Misses for an IP that already has a request queue their packet on that
+   request, and handle_arpreq leaves a request alone while its retry timer is
+   pending, so there is one ARP request outstanding per IP however many
+   packets or threads miss on it.
+
    --
 
    The handle_arpreq() function is a function you should write, and it should
@@ -48,19 +56,10 @@
 
    --
 
-   To meet the guidelines in the assignment (ARP requests are sent every second
-   until we send 5 ARP requests, then we send ICMP host unreachable back to
-   all packets waiting on this ARP request), you must fill out the following
-   function that is called every second and is defined in sr_arpcache.c:
-
-   void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-       for each request on sr->cache.requests:
-           handle_arpreq(request)
-   }
-
-   Since handle_arpreq as defined in the comments above could destroy your
-   current request, make sure to save the next pointer before calling
-   handle_arpreq when traversing through the ARP requests linked list.
+   ARP requests are sent every second until 5 have gone out, then ICMP host
+   unreachable goes back for every packet waiting on the request. Instead of
+   a sweep over all requests once a second, each request has a retry timer
+   on the cache's timer wheel that calls handle_arpreq when it fires.
  */
 
 #ifndef SR_ARPCACHE_H
@@ -73,22 +72,50 @@
 #include "sr_rt.h"
 #include "sr_protocol.h"
 #include "sr_utils.h"
+#include "sr_pool.h"
+#include "sr_timer.h"
 
-#define SR_ARPCACHE_SZ    100
+#define SR_ARPCACHE_SZ    100       /* default capacity, see sr_arpcache_init_sz */
 #define SR_ARPCACHE_TO    15.0
+#define SR_ARPCACHE_REFRESH 5.0     /* refresh entries in use this long before they expire */
+#define SR_ARPREQ_RETRY_MS 1000     /* ARP request resend interval */
+#define SR_ARPREQ_MAX_SENT 5        /* requests sent before giving up */
+
+#define SR_ARPQ_PER_REQ   16        /* packets parked on one unresolved IP */
+#define SR_ARPQ_TOTAL     512       /* packets parked over all requests */
+#define SR_ARPQ_FRAME_SZ  2048      /* frame bytes in a pool block; bigger ones are malloc'd */
 
+#define SR_ARPQ_DROP_TAIL   0       /* queue full: drop the new packet */
+#define SR_ARPQ_DROP_OLDEST 1       /* queue full: drop the request's oldest packet */
+
+/* A parked packet. The node and its frame share one block from the cache's
+   packet pool; buf points just past the node. */
 struct sr_packet {
     uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
     unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
+    unsigned int iface;         /* Index of the outgoing interface */
     struct sr_packet *next;
 };
 
 struct sr_arpentry {
     unsigned char mac[6];
-    uint32_t ip;                /* IP addr in network byte order */
+    union {
+        struct {
+            uint32_t ip;        /* IP addr in network byte order */
+            uint16_t referenced;    /* CLOCK bit, set by lookups */
+            uint16_t used;      /* Set by lookups, cleared when the entry is
+                                   (re)inserted; only entries in use are
+                                   refreshed */
+        };
+        uint64_t ip_hints;      /* The three above as one word, so a lookup
+                                   can set a bit only if ip is still there */
+    };
     time_t added;
+    time_t expires;             /* Entry is stale at or after this time */
+    uint64_t expires_ms;        /* The same on the timer wheel's clock */
     int valid;
+    unsigned int iface;         /* Index of the interface the mapping was
+                                   learned on, refreshes go out of it */
 };
 
 struct sr_arpreq {
@@ -98,24 +125,78 @@ struct sr_arpreq {
                                    never sent, will be 0. */
     uint32_t times_sent;        /* Number of times this request was sent. You
                                    should update this. */
-    struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
+    struct sr_packet *packets;  /* List of pkts waiting on this req to finish,
+                                   oldest first */
+    struct sr_packet *packets_tail;
+    unsigned int npackets;
+    unsigned int iface;         /* Index of the interface to ARP on */
+    struct sr_timer retry;      /* Next resend (or give up), pending while
+                                   an ARP request is outstanding */
     struct sr_arpreq *next;
 };
 
+/* The cache is an open addressing hash table keyed on IP with linear
+   probing.  Deletes shift the rest of the probe run back instead of leaving
+   tombstones, so a lookup stops at the first empty slot.  The table has at
+   least twice as many slots as the capacity; once capacity entries are
+   valid, inserts evict with a CLOCK sweep over the slots.
+
+   Writers hold lock and bump seq to an odd value while they modify
+   entries, then to the next even value. sr_arpcache_find reads without
+   the lock and retries if seq was odd or changed under it.
+
+   Packets waiting on requests are bounded per request (pkt_cap_req) and
+   overall (pkt_cap_total); drop_policy (sr -q) picks which packet goes
+   when a cap is hit. Oldest-drop falls back to tail-drop if the request has nothing
+   queued to drop.
+
+   Entry expiry and request retries run off a millisecond timer wheel.
+   expiry[i] is the timer of entries[i] and moves with it on a backward
+   shift. The timeout thread sleeps on wake until the wheel's next event;
+   arming a timer that is due sooner signals it.
+
+   An entry's timer first fires SR_ARPCACHE_REFRESH seconds before it
+   expires. If a lookup has hit the entry since it was inserted, a unicast
+   ARP request goes to the cached MAC, out of the interface the mapping was
+   learned on, then and every SR_ARPREQ_RETRY_MS
+   until the reply re-inserts the entry (which starts it over) or it
+   expires. Otherwise the timer is just moved to the expiry. Every insert
+   bumps seq, which sends the adjacency and flow caches back to
+   sr_arpcache_find, so a next hop that is only reached through them still
+   counts as used. */
 struct sr_arpcache {
-    struct sr_arpentry entries[SR_ARPCACHE_SZ];
+    unsigned int seq;           /* Seqlock counter for entries */
+    struct sr_arpentry *entries;
+    unsigned int nslots;        /* Power of two */
+    unsigned int capacity;      /* Max valid entries */
+    unsigned int count;         /* Valid entries */
+    unsigned int hand;          /* CLOCK hand, a slot index */
     struct sr_arpreq *requests;
+    struct sr_timer_wheel wheel;
+    struct sr_timer *expiry;    /* nslots timers, parallel to entries */
+    pthread_cond_t wake;        /* Timeout thread sleeps here */
+    uint64_t wake_at;           /* When it is due to wake, ms */
+    struct sr_pool pkt_pool;    /* Blocks for parked packets */
+    unsigned int pkt_cap_req;
+    unsigned int pkt_cap_total;
+    unsigned int npackets;      /* Parked packets over all requests */
+    int drop_policy;            /* SR_ARPQ_DROP_TAIL or SR_ARPQ_DROP_OLDEST */
+    unsigned long drops_tail;   /* New packets refused */
+    unsigned long drops_oldest; /* Parked packets pushed out */
+    unsigned long refreshes;    /* Unicast refresh requests sent */
+    unsigned long expired;      /* Entries that reached SR_ARPCACHE_TO */
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
 };
 
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
+   You must free the returned structure if it is not NULL. See also
+   sr_arpcache_find below. */
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. The packet argument should not be
-   freed by the caller.
+   that corresponds to this ARP request. The packet is copied, subject to the
+   queue caps; iface is the index of the outgoing interface.
 
    A pointer to the ARP request is returned; it should be freed. The caller
    can remove the ARP request from the queue by calling sr_arpreq_destroy. */
@@ -123,15 +204,18 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
                          unsigned int packet_len,
-                         char *iface);
+                         unsigned int iface);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
-   2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
+   2) Inserts this IP to MAC mapping, learned on interface index iface, in
+      the cache, and marks it valid. If the cache is full the least recently
+      referenced entry is evicted. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
-                                     uint32_t ip);
+                                     uint32_t ip,
+                                     unsigned int iface);
 
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
@@ -142,16 +226,22 @@ void sr_arpcache_dump(struct sr_arpcache *cache);
 
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
-   a destructor, and a cleanup thread times out cache entries every 15
-   seconds. */
+   a destructor, and a cleanup thread runs the timer wheel that refreshes and
+   expires each cache entry and resends ARP requests. */
 
 int   sr_arpcache_init(struct sr_arpcache *cache);
+int   sr_arpcache_init_sz(struct sr_arpcache *cache, unsigned int capacity);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
 void *sr_arpcache_timeout(void *cache_ptr);
 void handle_arpreq(struct sr_instance *, struct sr_arpreq *);
 
 struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
 
+/* Lock-free lookup for the forwarding path. Returns a copy of the entry for
+   this IP (network byte order) by value; the copy's valid field is 0 if
+   there is no live entry. Never blocks on the cache lock or allocates. */
+struct sr_arpentry sr_arpcache_find(struct sr_arpcache *cache, uint32_t ip);
+
 /* IMPORTANT: To avoid circular dependencies, do a forward declaration of any
 methods from other files that you need to use. For example, if your sr_arpcache
 needs to use methods from sr_router, declare those methods here too.
@@ -170,7 +260,4 @@ struct sr_if *sr_get_interface(struct sr_instance *, const char *);
 struct sr_if *get_interface_from_ip(struct sr_instance *, uint32_t);
 struct sr_if *get_interface_from_eth(struct sr_instance *, uint8_t *);
 
-
-struct sr_rt *sr_lookup_route(struct sr_rt* , uint32_t ip);
-
 #endif
@@ -0,0 +1,412 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_caplog.c
+ *
+ * Description:
+ *
+ * Asynchronous pcap/pcapng capture, see sr_caplog.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "sr_caplog.h"
+#include "sr_dumper.h"
+
+/* one captured frame, snaplen bytes of data follow */
+struct sr_caplog_slot
+{
+    unsigned int seq;       /* == position + 1 once published */
+    unsigned int len;       /* length on the wire */
+    unsigned int caplen;
+    unsigned int pad;
+    uint64_t     ts_ns;     /* CLOCK_REALTIME */
+};
+
+/* pcapng block types and the one option we set */
+#define PCAPNG_SHB          0x0A0D0D0A
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+#define PCAPNG_OPT_END      0
+#define PCAPNG_OPT_TSRESOL  9
+
+#define SR_CAPLOG_PAD4(x)   (((x) + 3) & ~3u)
+
+#define SR_CAPLOG_SLOT(log, pos) \
+    ((struct sr_caplog_slot*)((log)->slots + (size_t)((pos) & (log)->mask) * (log)->slot_sz))
+
+static int sr_caplog_write_full(int fd, const uint8_t* buf, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t ret = write(fd, buf, len);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            perror("write(..):sr_caplog.c::sr_caplog_write_full");
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static void sr_caplog_flush(struct sr_caplog* log, unsigned long nrec)
+{
+    if(log->out_len == 0)
+    { return; }
+
+    log->writes++;
+    if(sr_caplog_write_full(log->fd, log->out, log->out_len) != 0)
+    { log->errors += nrec; }
+    else
+    { log->records += nrec; }
+    log->out_len = 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_caplog_header(..)
+ * Scope: Local
+ *
+ * File header: the pcap one sr_dump_open writes, or a pcapng section
+ * header plus one ethernet interface with nanosecond timestamps.
+ *
+ *---------------------------------------------------------------------*/
+
+static size_t sr_caplog_header(struct sr_caplog* log, uint8_t* out)
+{
+    if(log->format == SR_CAPLOG_PCAP)
+    {
+        struct pcap_file_header hdr;
+
+        hdr.magic = TCPDUMP_MAGIC;
+        hdr.version_major = PCAP_VERSION_MAJOR;
+        hdr.version_minor = PCAP_VERSION_MINOR;
+        hdr.thiszone = 0;
+        hdr.sigfigs = 0;
+        hdr.snaplen = log->snaplen;
+        hdr.linktype = LINKTYPE_ETHERNET;
+        memcpy(out, &hdr, sizeof(hdr));
+        return sizeof(hdr);
+    }
+    else
+    {
+        struct
+        {
+            uint32_t type, len, byte_order;
+            uint16_t major, minor;
+            int64_t  section_len;
+            uint32_t len2;
+        } __attribute__ ((packed)) shb;
+        struct
+        {
+            uint32_t type, len;
+            uint16_t linktype, reserved;
+            uint32_t snaplen;
+            uint16_t tsresol_code, tsresol_len;
+            uint8_t  tsresol, pad[3];
+            uint16_t end_code, end_len;
+            uint32_t len2;
+        } __attribute__ ((packed)) idb;
+
+        shb.type = PCAPNG_SHB;
+        shb.len = shb.len2 = sizeof(shb);
+        shb.byte_order = PCAPNG_BYTE_ORDER;
+        shb.major = 1;
+        shb.minor = 0;
+        shb.section_len = -1;       /* not known up front */
+
+        memset(&idb, 0, sizeof(idb));
+        idb.type = PCAPNG_IDB;
+        idb.len = idb.len2 = sizeof(idb);
+        idb.linktype = LINKTYPE_ETHERNET;
+        idb.snaplen = log->snaplen;
+        idb.tsresol_code = PCAPNG_OPT_TSRESOL;
+        idb.tsresol_len = 1;
+        idb.tsresol = 9;            /* timestamps in ns */
+        idb.end_code = PCAPNG_OPT_END;
+
+        memcpy(out, &shb, sizeof(shb));
+        memcpy(out + sizeof(shb), &idb, sizeof(idb));
+        return sizeof(shb) + sizeof(idb);
+    }
+}
+
+/* append one record to log->out, which has room for it */
+static void sr_caplog_record(struct sr_caplog* log, const struct sr_caplog_slot* slot)
+{
+    uint8_t* out = log->out + log->out_len;
+    const uint8_t* data = (const uint8_t*)(slot + 1);
+
+    if(log->format == SR_CAPLOG_PCAP)
+    {
+        struct pcap_sf_pkthdr h;
+
+        h.ts.tv_sec  = (int)(slot->ts_ns / 1000000000ULL);
+        h.ts.tv_usec = (int)(slot->ts_ns % 1000000000ULL / 1000);
+        h.caplen = slot->caplen;
+        h.len = slot->len;
+        memcpy(out, &h, sizeof(h));
+        memcpy(out + sizeof(h), data, slot->caplen);
+        log->out_len += sizeof(h) + slot->caplen;
+    }
+    else
+    {
+        uint32_t total = 32 + SR_CAPLOG_PAD4(slot->caplen);
+        uint32_t epb[7];
+
+        epb[0] = PCAPNG_EPB;
+        epb[1] = total;
+        epb[2] = 0;                 /* interface id */
+        epb[3] = (uint32_t)(slot->ts_ns >> 32);
+        epb[4] = (uint32_t)slot->ts_ns;
+        epb[5] = slot->caplen;
+        epb[6] = slot->len;
+        memcpy(out, epb, sizeof(epb));
+        memcpy(out + sizeof(epb), data, slot->caplen);
+        memset(out + sizeof(epb) + slot->caplen, 0, SR_CAPLOG_PAD4(slot->caplen) - slot->caplen);
+        memcpy(out + total - 4, &total, 4);
+        log->out_len += total;
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_caplog_drain(..)
+ * Scope: Local
+ *
+ * Move every published slot into the output buffer, writing it out
+ * whenever the next record might not fit.  Writer thread only.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_caplog_drain(struct sr_caplog* log)
+{
+    size_t rec_max = 32 + SR_CAPLOG_PAD4(log->snaplen);
+    unsigned long nrec = 0;
+
+    while(1)
+    {
+        unsigned int pos = log->tail;
+        struct sr_caplog_slot* slot = SR_CAPLOG_SLOT(log, pos);
+
+        if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        { break; }
+
+        if(log->out_len + rec_max > SR_CAPLOG_BUF_SZ)
+        {
+            sr_caplog_flush(log, nrec);
+            nrec = 0;
+        }
+        sr_caplog_record(log, slot);
+        nrec++;
+
+        /* -- hand the slot back to producers for the next lap -- */
+        __atomic_store_n(&slot->seq, pos + log->mask + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&log->tail, pos + 1, __ATOMIC_RELAXED);
+    }
+
+    sr_caplog_flush(log, nrec);
+} /* -- sr_caplog_drain -- */
+
+static int sr_caplog_ready(struct sr_caplog* log)
+{
+    struct sr_caplog_slot* slot = SR_CAPLOG_SLOT(log, log->tail);
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == log->tail + 1;
+}
+
+static void* sr_caplog_writer(void* arg)
+{
+    struct sr_caplog* log = (struct sr_caplog*)arg;
+
+    while(1)
+    {
+        /* -- anything published before stop was set is written below -- */
+        int stop = __atomic_load_n(&log->stop, __ATOMIC_ACQUIRE);
+
+        sr_caplog_drain(log);
+        if(stop)
+        { break; }
+
+        pthread_mutex_lock(&log->lock);
+        __atomic_store_n(&log->sleeping, 1, __ATOMIC_SEQ_CST);
+        if(!sr_caplog_ready(log) && !log->stop)
+        {
+            struct timespec ts;
+
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_nsec += SR_CAPLOG_FLUSH_MS * 1000000L;
+            ts.tv_sec  += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&log->cond, &log->lock, &ts);
+        }
+        __atomic_store_n(&log->sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&log->lock);
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_caplog_open(..)
+ * Scope: Global
+ *
+ * Create path ("-" for stdout), write the file header and start the
+ * writer thread.  Frames are cut to snaplen bytes.  Returns 0 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_caplog* sr_caplog_open(const char* path, int format, unsigned int snaplen)
+{
+    struct sr_caplog* log;
+    pthread_condattr_t cattr;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(path);
+    assert(format == SR_CAPLOG_PCAP || format == SR_CAPLOG_PCAPNG);
+
+    if((log = (struct sr_caplog*)calloc(1, sizeof(struct sr_caplog))) == 0)
+    { return 0; }
+
+    log->mask    = SR_CAPLOG_RING_SZ - 1;
+    log->snaplen = snaplen;
+    log->format  = format;
+    log->slot_sz = (sizeof(struct sr_caplog_slot) + snaplen + 63) & ~(size_t)63;
+    log->slots   = (uint8_t*)malloc(SR_CAPLOG_RING_SZ * log->slot_sz);
+    log->out     = (uint8_t*)malloc(SR_CAPLOG_BUF_SZ);
+
+    if(strcmp(path, "-") == 0)
+    { log->fd = dup(1); }
+    else
+    { log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644); }
+
+    if(!log->slots || !log->out || log->fd < 0)
+    {
+        if(log->fd < 0)
+        { fprintf(stderr, "sr_caplog_open: can't open %s\n", path); }
+        else
+        { close(log->fd); }
+        free(log->slots);
+        free(log->out);
+        free(log);
+        return 0;
+    }
+
+    for(i = 0; i < SR_CAPLOG_RING_SZ; i++)
+    { SR_CAPLOG_SLOT(log, i)->seq = i; }
+
+    log->out_len = sr_caplog_header(log, log->out);
+    sr_caplog_flush(log, 0);
+
+    pthread_mutex_init(&log->lock, 0);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&log->cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    if(pthread_create(&log->writer, 0, sr_caplog_writer, log) != 0)
+    {
+        close(log->fd);
+        free(log->slots);
+        free(log->out);
+        free(log);
+        return 0;
+    }
+
+    return log;
+} /* -- sr_caplog_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_caplog_packet(..)
+ * Scope: Global
+ *
+ * Queue a frame for the writer.  Safe from any thread; never blocks.
+ * If the ring is full the frame is counted in log->drops instead.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_caplog_packet(struct sr_caplog* log, const uint8_t* buf, unsigned int len)
+{
+    struct sr_caplog_slot* slot;
+    struct timespec ts;
+    unsigned int pos;
+
+    pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+    while(1)
+    {
+        int diff;
+
+        slot = SR_CAPLOG_SLOT(log, pos);
+        diff = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if(diff == 0)
+        {
+            if(__atomic_compare_exchange_n(&log->head, &pos, pos + 1, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            { break; }
+        }
+        else if(diff < 0)
+        {
+            /* -- the writer has not freed this slot from the last lap -- */
+            __atomic_fetch_add(&log->drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        { pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED); }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    slot->ts_ns  = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    slot->len    = len;
+    slot->caplen = (len < log->snaplen) ? len : log->snaplen;
+    memcpy(slot + 1, buf, slot->caplen);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /* -- only wake the writer early once the backlog is worth a write -- */
+    if(__atomic_load_n(&log->sleeping, __ATOMIC_SEQ_CST) &&
+       pos - __atomic_load_n(&log->tail, __ATOMIC_RELAXED) >= SR_CAPLOG_RING_SZ / 4)
+    {
+        pthread_mutex_lock(&log->lock);
+        pthread_cond_signal(&log->cond);
+        pthread_mutex_unlock(&log->lock);
+    }
+} /* -- sr_caplog_packet -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_caplog_close(..)
+ * Scope: Global
+ *
+ * Write out what is queued, stop the writer and close the file.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_caplog_close(struct sr_caplog* log)
+{
+    if(!log)
+    { return; }
+
+    pthread_mutex_lock(&log->lock);
+    __atomic_store_n(&log->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->lock);
+    pthread_join(log->writer, 0);
+
+    printf("caplog: %lu frames in %lu writes, %lu dropped, %lu lost to errors\n",
+           log->records, log->writes, log->drops, log->errors);
+
+    close(log->fd);
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->cond);
+    free(log->slots);
+    free(log->out);
+    free(log);
+} /* -- sr_caplog_close -- */
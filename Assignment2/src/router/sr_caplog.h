@@ -0,0 +1,71 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_caplog.h
+ *
+ * Description:
+ *
+ * Asynchronous packet capture for sr -l.
+ *
+ * Any thread (reader, pipeline workers, ARP timer thread) hands a frame to
+ * sr_caplog_packet, which copies up to snaplen bytes and a timestamp into a
+ * bounded lock-free ring: producers claim slots with a compare-and-swap on
+ * head and publish them through a per-slot sequence number, so nobody waits
+ * on a lock or a syscall.  A dedicated writer thread drains the ring into a
+ * large buffer and writes it out in one write(2) per batch.  When the ring
+ * is full the frame is dropped and counted instead of stalling forwarding.
+ *
+ * The writer sleeps for up to SR_CAPLOG_FLUSH_MS between batches and is
+ * only signalled once the ring is a quarter full, so a quiet router costs
+ * a wakeup every SR_CAPLOG_FLUSH_MS and a busy one a write per batch.
+ *
+ * Output is classic pcap (what sr_dumper writes) or pcapng.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPLOG_H
+#define SR_CAPLOG_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_CAPLOG_RING_SZ   4096        /* slots, power of 2 */
+#define SR_CAPLOG_BUF_SZ    (1 << 20)   /* writer's output buffer */
+#define SR_CAPLOG_FLUSH_MS  100
+
+#define SR_CAPLOG_PCAP      0
+#define SR_CAPLOG_PCAPNG    1
+
+struct sr_caplog
+{
+    unsigned int head __attribute__((aligned(64)));  /* next slot to claim */
+    unsigned int tail __attribute__((aligned(64)));  /* next slot to write */
+    unsigned long drops __attribute__((aligned(64)));/* ring was full */
+    unsigned int  mask;
+    size_t        slot_sz;
+    uint8_t*      slots;
+    unsigned int  snaplen;
+    int           format;
+    int           fd;
+    uint8_t*      out;              /* records waiting for write(2) */
+    size_t        out_len;
+    pthread_t       writer;
+    int             stop;
+    int             sleeping;       /* writer parked on cond */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    unsigned long   records;        /* written out */
+    unsigned long   writes;         /* write(2) calls */
+    unsigned long   errors;         /* records lost to write errors */
+};
+
+struct sr_caplog* sr_caplog_open(const char* path, int format, unsigned int snaplen);
+void sr_caplog_packet(struct sr_caplog* log, const uint8_t* buf, unsigned int len);
+void sr_caplog_close(struct sr_caplog* log);
+
+#endif /* -- SR_CAPLOG_H -- */
@@ -0,0 +1,391 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ecmp.c
+ *
+ * Description:
+ *
+ * Equal cost multipath groups and the flow hash, see sr_ecmp.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sr_ecmp.h"
+#include "sr_rt.h"
+#include "sr_flow.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SR_ECMP_X86
+#endif
+
+#define SR_CRC32C_POLY 0x82f63b78u     /* Castagnoli, bit reflected */
+#define SR_ECMP_PREFETCH 16             /* routes ahead when grouping */
+#define SR_ECMP_ALONE    0xffffffffu    /* lead[] of a route in no group */
+
+typedef uint32_t (*sr_crc32c_fn)(uint32_t crc, const uint8_t* p, size_t len);
+
+static uint32_t       sr_crc32c_table[256];
+static sr_crc32c_fn   sr_crc32c_impl;
+static pthread_once_t sr_crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t sr_crc32c_sw(uint32_t crc, const uint8_t* p, size_t len)
+{
+    while(len--)
+    { crc = sr_crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8); }
+    return crc;
+}
+
+#ifdef SR_ECMP_X86
+__attribute__((target("sse4.2")))
+static uint32_t sr_crc32c_hw(uint32_t crc, const uint8_t* p, size_t len)
+{
+    uint64_t c = crc;
+
+    while(len >= 8)
+    {
+        uint64_t w;
+
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+    while(len--)
+    { crc = _mm_crc32_u8(crc, *p++); }
+    return crc;
+}
+#endif /* SR_ECMP_X86 */
+
+static void sr_crc32c_init(void)
+{
+    uint32_t i, j, c;
+
+    for(i = 0; i < 256; i++)
+    {
+        c = i;
+        for(j = 0; j < 8; j++)
+        { c = (c >> 1) ^ (SR_CRC32C_POLY & (0u - (c & 1))); }
+        sr_crc32c_table[i] = c;
+    }
+
+    sr_crc32c_impl = sr_crc32c_sw;
+#ifdef SR_ECMP_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2"))
+    { sr_crc32c_impl = sr_crc32c_hw; }
+#endif
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_crc32c(..)
+ * Scope: Global
+ *
+ * CRC32C of len bytes at buf, continuing from crc (0 to start).  Uses
+ * the SSE4.2 instruction if the CPU has it, a table otherwise.
+ *
+ *---------------------------------------------------------------------*/
+
+uint32_t sr_crc32c(uint32_t crc, const void* buf, size_t len)
+{
+    pthread_once(&sr_crc32c_once, sr_crc32c_init);
+    return ~sr_crc32c_impl(~crc, (const uint8_t*)buf, len);
+} /* -- sr_crc32c -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ecmp_hash(..)
+ * Scope: Global
+ *
+ * Flow hash of the IP packet ip_pkt (ip_len bytes from the IP header
+ * on): CRC32C of its addresses, protocol and, for TCP and UDP that are
+ * not fragmented, ports.
+ * The ingress interface is left out, so a flow hashes the same however
+ * it arrives.
+ *
+ *---------------------------------------------------------------------*/
+
+uint32_t sr_ecmp_hash(const uint8_t* ip_pkt, unsigned int ip_len)
+{
+    struct sr_flow_key key;
+
+    sr_flow_key_of(ip_pkt, ip_len, 0, &key);
+    return sr_crc32c(0, &key, sizeof(key));
+} /* -- sr_ecmp_hash -- */
+
+/* 64 bit finalizer (splitmix64), rendezvous scores need every input bit
+   to reach every output bit, which a CRC does not do */
+static inline uint64_t sr_ecmp_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/* identity of a member for rendezvous hashing: where it sends packets */
+static uint64_t sr_ecmp_member_id(const struct sr_rt* rt)
+{
+    uint32_t h = sr_crc32c(0, &rt->gw.s_addr, sizeof(rt->gw.s_addr));
+
+    h = sr_crc32c(h, rt->interface, strnlen(rt->interface, sr_IFACE_NAMELEN));
+    return sr_ecmp_mix(((uint64_t)h << 32) | rt->gw.s_addr);
+}
+
+/* member of group that wins bucket b; ties (the same gateway twice) go to
+   the first */
+static uint32_t sr_ecmp_winner(const struct sr_ecmp* group, uint32_t b)
+{
+    uint64_t key  = b * 0x9e3779b97f4a7c15ULL;
+    uint64_t best = sr_ecmp_mix(group->ids[0] ^ key);
+    uint32_t win  = 0;
+    uint32_t m;
+
+    for(m = 1; m < group->nmembers; m++)
+    {
+        uint64_t score = sr_ecmp_mix(group->ids[m] ^ key);
+        if(score > best)
+        {
+            best = score;
+            win  = m;
+        }
+    }
+    return win;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ecmp_pick(..)
+ * Scope: Global
+ *
+ * Member of group for a packet whose sr_ecmp_hash is hash.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_ecmp_pick(const struct sr_ecmp* group, uint32_t hash)
+{
+    uint32_t b = hash & (SR_ECMP_BUCKETS - 1);
+
+    if(group->bucket)
+    { return group->members[group->bucket[b]]; }
+    return group->members[sr_ecmp_winner(group, b)];
+} /* -- sr_ecmp_pick -- */
+
+/* slot of the prefix table in sr_ecmp_build */
+struct sr_ecmp_slot
+{
+    uint32_t dest;              /* dest & mask */
+    uint32_t mask;
+    uint32_t first;             /* route index + 1, 0 if empty */
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_ecmp_set(..)
+ * Scope: Global
+ *
+ * Give fib ngroups equal cost groups.  members holds them end to end,
+ * sizes[g] routes for group g, each in routing table order (the first
+ * is the one the lookup index returns), at least 2 and at most
+ * SR_ECMP_MAX_MEMBERS.  Returns 0 on success, -1 if out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ecmp_set(struct sr_fib* fib, struct sr_rt** members,
+                const uint32_t* sizes, uint32_t ngroups)
+{
+    struct sr_ecmp* group;
+    struct sr_rt**  ptrs;
+    uint64_t* ids;
+    uint8_t*  tables;
+    size_t    nmembers = 0, ntables = 0;
+    uint32_t  g, m, b;
+
+    if(ngroups == 0)
+    { return 0; }
+    for(g = 0; g < ngroups; g++)
+    {
+        nmembers += sizes[g];
+        ntables  += sizes[g] > SR_ECMP_DIRECT;
+    }
+
+    /* -- groups, member lists, identities and bucket tables in one
+          allocation -- */
+    group = (struct sr_ecmp*)malloc(ngroups * sizeof(struct sr_ecmp) +
+                                    nmembers * (sizeof(uint64_t) + sizeof(struct sr_rt*)) +
+                                    ntables * SR_ECMP_BUCKETS);
+    if(!group)
+    {
+        fprintf(stderr, "Error grouping equal cost routes, out of memory\n");
+        return -1;
+    }
+    fib->ecmp  = group;
+    fib->necmp = ngroups;
+    ids    = (uint64_t*)(group + ngroups);
+    ptrs   = (struct sr_rt**)(ids + nmembers);
+    tables = (uint8_t*)(ptrs + nmembers);
+
+    for(g = 0; g < ngroups; g++, group++)
+    {
+        group->members  = ptrs;
+        group->ids      = ids;
+        group->bucket   = 0;
+        group->nmembers = sizes[g];
+        for(m = 0; m < sizes[g]; m++)
+        {
+            ptrs[m] = *members++;
+            ids[m]  = sr_ecmp_member_id(ptrs[m]);
+        }
+        ptrs[0]->ecmp = group;
+        ptrs += sizes[g];
+        ids  += sizes[g];
+
+        if(group->nmembers > SR_ECMP_DIRECT)
+        {
+            group->bucket = tables;
+            tables += SR_ECMP_BUCKETS;
+            for(b = 0; b < SR_ECMP_BUCKETS; b++)
+            { group->bucket[b] = (uint8_t)sr_ecmp_winner(group, b); }
+        }
+    }
+    return 0;
+} /* -- sr_ecmp_set -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ecmp_build(..)
+ * Scope: Global
+ *
+ * Find the routes of fib that share a destination and mask and make
+ * them groups (sr_ecmp_set).  Members past SR_ECMP_MAX_MEMBERS are left
+ * out.  Returns 0 on success, -1 if out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ecmp_build(struct sr_fib* fib)
+{
+    struct sr_ecmp_slot* slots = 0;
+    struct sr_rt** list = 0;
+    struct sr_rt** members = 0;
+    uint32_t* lead  = 0;    /* route -> first route with its prefix */
+    uint32_t* size  = 0;    /* first route -> routes with its prefix */
+    uint32_t* start = 0;    /* group -> its first member in members */
+    uint32_t* gsize = 0;    /* group -> members kept */
+    uint32_t* gfill = 0;    /* group -> members placed so far */
+    uint32_t  nslots, n, i, g;
+    uint32_t  ngroups = 0, nmembers = 0, dropped = 0;
+    struct sr_rt* rt;
+    int ret = -1;
+
+    n = fib->nroutes;
+    if(n < 2)
+    { return 0; }
+
+    for(nslots = 2; nslots < 2 * n; nslots <<= 1)
+    { }
+    slots = (struct sr_ecmp_slot*)calloc(nslots, sizeof(struct sr_ecmp_slot));
+    list  = (struct sr_rt**)malloc(n * sizeof(struct sr_rt*));
+    lead  = (uint32_t*)malloc(n * sizeof(uint32_t));
+    size  = (uint32_t*)calloc(n, sizeof(uint32_t));
+    if(!slots || !list || !lead || !size)
+    { goto done; }
+
+    /* -- group by (prefix, mask) in an open addressed table that holds
+          the keys, so a probe touches one line.  Home slots are worked
+          out first so the probes can be prefetched ahead -- */
+    for(i = 0, rt = fib->routes; rt; rt = rt->next, i++)
+    {
+        list[i] = rt;
+        lead[i] = (uint32_t)sr_ecmp_mix(((uint64_t)(rt->dest.s_addr & rt->mask.s_addr) << 32) |
+                                        rt->mask.s_addr) & (nslots - 1);
+    }
+    for(i = 0; i < n; i++)
+    {
+        uint32_t mask = list[i]->mask.s_addr;
+        uint32_t dest = list[i]->dest.s_addr & mask;
+        uint32_t s = lead[i];
+
+        if(i + SR_ECMP_PREFETCH < n)
+        { __builtin_prefetch(&slots[lead[i + SR_ECMP_PREFETCH]], 1); }
+
+        while(slots[s].first && (slots[s].dest != dest || slots[s].mask != mask))
+        { s = (s + 1) & (nslots - 1); }
+        if(!slots[s].first)
+        {
+            slots[s].dest  = dest;
+            slots[s].mask  = mask;
+            slots[s].first = i + 1;
+        }
+        lead[i] = slots[s].first - 1;
+        if(size[lead[i]]++ == 1)
+        { ngroups++; }
+    }
+    free(slots);
+    slots = 0;
+
+    if(ngroups == 0)
+    {
+        ret = 0;
+        goto done;
+    }
+    start = (uint32_t*)malloc(ngroups * sizeof(uint32_t));
+    gsize = (uint32_t*)malloc(ngroups * sizeof(uint32_t));
+    gfill = (uint32_t*)calloc(ngroups, sizeof(uint32_t));
+    if(!start || !gsize || !gfill)
+    { goto done; }
+
+    /* -- a group's first route comes before the rest of it, so one pass
+          in file order numbers the groups, swapping each first route's
+          size for its group number, and marks the routes alone.  A
+          second places the members -- */
+    for(g = 0, i = 0; i < n; i++)
+    {
+        if(lead[i] != i)
+        { continue; }
+        if(size[i] < 2)
+        {
+            lead[i] = SR_ECMP_ALONE;
+            continue;
+        }
+        gsize[g] = size[i];
+        if(gsize[g] > SR_ECMP_MAX_MEMBERS)
+        {
+            dropped += gsize[g] - SR_ECMP_MAX_MEMBERS;
+            gsize[g] = SR_ECMP_MAX_MEMBERS;
+        }
+        start[g] = nmembers;
+        nmembers += gsize[g];
+        size[i] = g++;
+    }
+    if(dropped)
+    {
+        fprintf(stderr, "Routing table has more than %d routes to one prefix, "
+                "ignoring %u of them\n", SR_ECMP_MAX_MEMBERS, dropped);
+    }
+    if((members = (struct sr_rt**)malloc(nmembers * sizeof(struct sr_rt*))) == 0)
+    { goto done; }
+
+    for(i = 0; i < n; i++)
+    {
+        if(lead[i] == SR_ECMP_ALONE)
+        { continue; }
+        g = size[lead[i]];
+        if(gfill[g] < gsize[g])
+        { members[start[g] + gfill[g]++] = list[i]; }
+    }
+    ret = sr_ecmp_set(fib, members, gsize, ngroups);
+
+done:
+    if(ret != 0 && !members)  /* sr_ecmp_set says so itself */
+    { fprintf(stderr, "Error grouping equal cost routes, out of memory\n"); }
+    free(slots);
+    free(list);
+    free(lead);
+    free(size);
+    free(start);
+    free(gsize);
+    free(gfill);
+    free(members);
+    return ret;
+} /* -- sr_ecmp_build -- */
@@ -0,0 +1,62 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ecmp.h
+ *
+ * Description:
+ *
+ * Equal cost multipath.  Routes with the same destination and mask form
+ * a group.  The lookup index (sr_lpm.h) still returns the first of them,
+ * and that route carries the group; the forwarding path hashes the
+ * packet's 5-tuple and takes the member the hash falls on, so every
+ * packet of a flow leaves the same way and flows spread over all of the
+ * members.  Each member keeps its own adjacency.
+ *
+ * The hash (CRC32C, with the SSE4.2 instruction where the CPU has it)
+ * picks one of SR_ECMP_BUCKETS buckets, and the bucket goes to a member
+ * by rendezvous hashing: the member, identified by gateway and
+ * interface, that scores highest for it.  The choice depends only on the
+ * set of members, so when a reload adds or drops one, only the buckets
+ * that member wins or held move and every other flow keeps its path.
+ *
+ * Groups of up to SR_ECMP_DIRECT members are scored per packet (the flow
+ * cache keeps that to once per flow).  Larger groups have the winner of
+ * each bucket worked out when the table is loaded, the same choice, so a
+ * group that grows past the limit does not move any flow either.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ECMP_H
+#define SR_ECMP_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+#define SR_ECMP_BUCKETS     4096    /* power of two */
+#define SR_ECMP_DIRECT      64      /* largest group scored per packet */
+#define SR_ECMP_MAX_MEMBERS 256     /* bucket entries are one byte */
+
+struct sr_rt;
+struct sr_fib;
+
+struct sr_ecmp
+{
+    struct sr_rt** members;     /* in routing table order, the first leads */
+    uint64_t*      ids;         /* rendezvous identity of each member */
+    uint8_t*       bucket;      /* hash bucket -> member, 0 if scored per packet */
+    uint32_t       nmembers;
+};
+
+int           sr_ecmp_build(struct sr_fib* fib);
+int           sr_ecmp_set(struct sr_fib* fib, struct sr_rt** members,
+                          const uint32_t* sizes, uint32_t ngroups);
+uint32_t      sr_ecmp_hash(const uint8_t* ip_pkt, unsigned int ip_len);
+struct sr_rt* sr_ecmp_pick(const struct sr_ecmp* group, uint32_t hash);
+uint32_t      sr_crc32c(uint32_t crc, const void* buf, size_t len);
+
+#endif /* -- SR_ECMP_H -- */
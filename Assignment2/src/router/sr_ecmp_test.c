@@ -0,0 +1,146 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ecmp_test.c
+ *
+ * Description:
+ *
+ * Checks for sr_ecmp_hash over a group of equal cost routes (make check).
+ * Every fragment of a UDP datagram, the first one included, has to leave
+ * by the same member, or the datagram arrives in pieces over several
+ * paths.  Whole datagrams still hash their ports, so flows that differ
+ * only in port spread over the members.
+ *
+ * Usage: ecmp_test
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_rt.h"
+#include "sr_ecmp.h"
+
+#define ECMP_TEST_MEMBERS   4
+#define ECMP_TEST_DATAGRAMS 1000
+#define ECMP_TEST_FRAGS     3
+#define ECMP_TEST_FRAG_LEN  64      /* payload bytes a fragment, multiple of 8 */
+
+/* 8.0.0.0/8 over ECMP_TEST_MEMBERS gateways */
+static struct sr_fib* ecmp_test_fib(void)
+{
+    struct sr_fib* fib = (struct sr_fib*)calloc(1, sizeof(struct sr_fib));
+    struct in_addr dest, gw, mask;
+    char name[32];
+    int i;
+
+    if(!fib)
+    { return 0; }
+    inet_aton("8.0.0.0", &dest);
+    inet_aton("255.0.0.0", &mask);
+    for(i = 0; i < ECMP_TEST_MEMBERS; i++)
+    {
+        sprintf(name, "192.168.2.%d", 10 + i);
+        inet_aton(name, &gw);
+        sprintf(name, "eth%d", 1 + i % 2);
+        sr_add_rt_entry(fib, dest, gw, mask, name);
+    }
+    if(sr_ecmp_build(fib) != 0 || fib->routes->ecmp == 0)
+    {
+        sr_fib_destroy(fib);
+        return 0;
+    }
+    return fib;
+}
+
+/* IP packet of fragment frag of datagram id, UDP from sport to 53 */
+static unsigned int ecmp_test_fragment(uint8_t* buf, uint16_t id, uint16_t sport, int frag,
+                                       int nfrags)
+{
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)buf;
+    unsigned int len = sizeof(sr_ip_hdr_t) + ECMP_TEST_FRAG_LEN;
+    uint16_t off = frag * (ECMP_TEST_FRAG_LEN / 8);
+
+    memset(buf, 0, len);
+    ip->ip_v   = 4;
+    ip->ip_hl  = 5;
+    ip->ip_len = htons(len);
+    ip->ip_id  = htons(id);
+    ip->ip_off = htons(off | (frag + 1 < nfrags ? IP_MF : 0));
+    ip->ip_ttl = 64;
+    ip->ip_p   = ip_protocol_udp;
+    ip->ip_src = htonl(0x0a000164);     /* 10.0.1.100 */
+    ip->ip_dst = htonl(0x08080808);     /* 8.8.8.8 */
+    if(frag == 0)
+    {
+        uint16_t ports[2] = { htons(sport), htons(53) };
+        memcpy(buf + sizeof(sr_ip_hdr_t), ports, sizeof(ports));
+    }
+    return len;
+}
+
+int main(void)
+{
+    struct sr_fib* fib = ecmp_test_fib();
+    uint8_t buf[sizeof(sr_ip_hdr_t) + ECMP_TEST_FRAG_LEN];
+    struct sr_rt* used[ECMP_TEST_MEMBERS];
+    unsigned int nused = 0, split = 0, i, k;
+    int frag;
+
+    if(!fib)
+    {
+        fprintf(stderr, "ecmp_test: cannot build the equal cost group\n");
+        return 1;
+    }
+
+    for(i = 0; i < ECMP_TEST_DATAGRAMS; i++)
+    {
+        uint16_t sport = 1024 + i;
+        struct sr_rt* first = 0;
+        struct sr_rt* rt;
+        unsigned int len;
+
+        for(frag = 0; frag < ECMP_TEST_FRAGS; frag++)
+        {
+            len = ecmp_test_fragment(buf, i, sport, frag, ECMP_TEST_FRAGS);
+            rt  = sr_ecmp_pick(fib->routes->ecmp, sr_ecmp_hash(buf, len));
+            if(frag == 0)
+            { first = rt; }
+            else if(rt != first)
+            {
+                fprintf(stderr, "datagram %u: fragment %d takes %s, the first %s\n",
+                        i, frag, rt->interface, first->interface);
+                split++;
+                break;
+            }
+        }
+
+        /* -- the same datagram unfragmented, its ports count -- */
+        len = ecmp_test_fragment(buf, i, sport, 0, 1);
+        rt  = sr_ecmp_pick(fib->routes->ecmp, sr_ecmp_hash(buf, len));
+        for(k = 0; k < nused && used[k] != rt; k++) { }
+        if(k == nused)
+        { used[nused++] = rt; }
+    }
+
+    sr_fib_destroy(fib);
+
+    if(split)
+    {
+        fprintf(stderr, "ecmp_test: %u of %d fragmented datagrams split over members\n",
+                split, ECMP_TEST_DATAGRAMS);
+        return 1;
+    }
+    if(nused != ECMP_TEST_MEMBERS)
+    {
+        fprintf(stderr, "ecmp_test: %d flows by port used %u of %d members\n",
+                ECMP_TEST_DATAGRAMS, nused, ECMP_TEST_MEMBERS);
+        return 1;
+    }
+    printf("ecmp_test: %d fragmented datagrams each kept to one member, "
+           "flows by port over all %d\n", ECMP_TEST_DATAGRAMS, ECMP_TEST_MEMBERS);
+    return 0;
+}
@@ -0,0 +1,216 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_epoch.c
+ *
+ * Description:
+ *
+ * Epoch based reclamation, see sr_epoch.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "sr_epoch.h"
+
+/* One per thread that ever entered a section, reused once it exits */
+struct sr_epoch_rec
+{
+    unsigned long        epoch;     /* epoch entered at, 0 outside a section */
+    unsigned int         depth;     /* nesting, only touched by the owner */
+    int                  used;      /* owned by a live thread */
+    struct sr_epoch_rec* next;
+} __attribute__((aligned(64)));
+
+struct sr_epoch_retired
+{
+    sr_epoch_free_fn         fn;
+    void*                    p;
+    unsigned long            epoch; /* epoch it was retired in */
+    struct sr_epoch_retired* next;
+};
+
+static unsigned long            sr_epoch_global = 1;   /* 0 means outside */
+static struct sr_epoch_rec*     sr_epoch_recs;         /* never freed */
+static struct sr_epoch_retired* sr_epoch_limbo;        /* retired, not yet freed */
+static pthread_mutex_t          sr_epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct sr_epoch_rec* sr_epoch_self;
+
+static pthread_key_t  sr_epoch_key;         /* gives a thread's record back on exit */
+static pthread_once_t sr_epoch_once = PTHREAD_ONCE_INIT;
+
+static void sr_epoch_release(void* p)
+{
+    struct sr_epoch_rec* rec = (struct sr_epoch_rec*)p;
+
+    rec->depth = 0;
+    __atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->used, 0, __ATOMIC_RELEASE);
+}
+
+static void sr_epoch_key_init(void)
+{
+    pthread_key_create(&sr_epoch_key, sr_epoch_release);
+}
+
+/* this thread's record, taken from a thread that exited or allocated */
+static struct sr_epoch_rec* sr_epoch_rec_get(void)
+{
+    struct sr_epoch_rec* rec;
+
+    if(sr_epoch_self)
+    { return sr_epoch_self; }
+
+    pthread_once(&sr_epoch_once, sr_epoch_key_init);
+    pthread_mutex_lock(&sr_epoch_lock);
+    for(rec = sr_epoch_recs; rec; rec = rec->next)
+    {
+        if(!__atomic_load_n(&rec->used, __ATOMIC_ACQUIRE))
+        { break; }
+    }
+    if(!rec)
+    {
+        /* -- a reader without a record could be freed under, give up -- */
+        if((rec = (struct sr_epoch_rec*)aligned_alloc(64, sizeof(struct sr_epoch_rec))) == 0)
+        {
+            fprintf(stderr, "Error registering thread for epoch reclamation, out of memory\n");
+            exit(1);
+        }
+        memset(rec, 0, sizeof(struct sr_epoch_rec));
+        rec->next = sr_epoch_recs;
+        sr_epoch_recs = rec;
+    }
+    rec->used = 1;
+    pthread_mutex_unlock(&sr_epoch_lock);
+
+    pthread_setspecific(sr_epoch_key, rec);
+    sr_epoch_self = rec;
+    return rec;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_epoch_enter(..)
+ * Scope: Global
+ *
+ * Start a read side section.  Nothing retired from here on is freed
+ * before the matching sr_epoch_exit.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_epoch_enter(void)
+{
+    struct sr_epoch_rec* rec = sr_epoch_rec_get();
+
+    if(rec->depth++ == 0)
+    {
+        __atomic_store_n(&rec->epoch,
+                         __atomic_load_n(&sr_epoch_global, __ATOMIC_ACQUIRE),
+                         __ATOMIC_RELAXED);
+        /* -- pairs with the fence in sr_epoch_reclaim: either reclaim sees
+              this thread inside, or this thread sees what was published -- */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+} /* -- sr_epoch_enter -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_epoch_exit(..)
+ * Scope: Global
+ *
+ * End a read side section.  No pointer loaded inside may be used after.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_epoch_exit(void)
+{
+    struct sr_epoch_rec* rec = sr_epoch_self;
+
+    if(--rec->depth == 0)
+    { __atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE); }
+} /* -- sr_epoch_exit -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_epoch_retire(..)
+ * Scope: Global
+ *
+ * Have fn(p) called once no reader can still hold p.  p must already be
+ * unreachable for new readers, i.e. replaced with an atomic store.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_epoch_retire(sr_epoch_free_fn fn, void* p)
+{
+    struct sr_epoch_retired* r;
+
+    if((r = (struct sr_epoch_retired*)malloc(sizeof(struct sr_epoch_retired))) == 0)
+    {
+        /* -- leaking it beats freeing it under a reader -- */
+        fprintf(stderr, "sr_epoch_retire: out of memory, leaking %p\n", p);
+        return;
+    }
+    r->fn = fn;
+    r->p  = p;
+
+    pthread_mutex_lock(&sr_epoch_lock);
+    r->epoch = __atomic_fetch_add(&sr_epoch_global, 1, __ATOMIC_SEQ_CST);
+    r->next = sr_epoch_limbo;
+    sr_epoch_limbo = r;
+    pthread_mutex_unlock(&sr_epoch_lock);
+} /* -- sr_epoch_retire -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_epoch_reclaim(..)
+ * Scope: Global
+ *
+ * Free everything retired before the oldest section still running
+ * began.  Returns how many retired objects are left waiting.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_epoch_reclaim(void)
+{
+    struct sr_epoch_retired** pp;
+    struct sr_epoch_retired*  done = 0;
+    struct sr_epoch_retired*  r;
+    struct sr_epoch_rec*      rec;
+    unsigned long oldest = ULONG_MAX;
+    unsigned int  pending = 0;
+
+    pthread_mutex_lock(&sr_epoch_lock);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for(rec = sr_epoch_recs; rec; rec = rec->next)
+    {
+        unsigned long e = __atomic_load_n(&rec->epoch, __ATOMIC_ACQUIRE);
+        if(e && e < oldest)
+        { oldest = e; }
+    }
+
+    /* -- a reader that entered in epoch e started after every retire
+          stamped below e, so it never saw those -- */
+    pp = &sr_epoch_limbo;
+    while((r = *pp) != 0)
+    {
+        if(r->epoch < oldest)
+        {
+            *pp = r->next;
+            r->next = done;
+            done = r;
+        }
+        else
+        {
+            pending++;
+            pp = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&sr_epoch_lock);
+
+    while((r = done) != 0)
+    {
+        done = r->next;
+        r->fn(r->p);
+        free(r);
+    }
+    return pending;
+} /* -- sr_epoch_reclaim -- */
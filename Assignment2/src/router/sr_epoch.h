@@ -0,0 +1,37 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_epoch.h
+ *
+ * Description:
+ *
+ * Epoch based reclamation, for structures that are read without locks
+ * and replaced as a whole (the routing table, see sr_rt.h).
+ *
+ * A reader brackets every use of such a structure, from loading the
+ * pointer to dropping the last reference into it, with sr_epoch_enter
+ * and sr_epoch_exit.  Entering records the global epoch in the thread's
+ * own cache line and exiting clears it; neither takes a lock or writes
+ * anything shared.  Sections nest, only the outermost one counts.
+ *
+ * A writer publishes the replacement first and then hands the old
+ * structure to sr_epoch_retire, which stamps it with the current epoch
+ * and moves the epoch on.  sr_epoch_reclaim frees whatever no thread can
+ * still be reading: every thread is either outside a section or entered
+ * after the retire.  Reclaiming never waits for readers, it just leaves
+ * the rest for a later call.
+ *
+ * Sections should be short (a burst of packets), readers in a long one
+ * hold back every retire after it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_EPOCH_H
+#define SR_EPOCH_H
+
+typedef void (*sr_epoch_free_fn)(void* p);
+
+void         sr_epoch_enter(void);
+void         sr_epoch_exit(void);
+void         sr_epoch_retire(sr_epoch_free_fn fn, void* p);
+unsigned int sr_epoch_reclaim(void);
+
+#endif /* -- SR_EPOCH_H -- */
@@ -0,0 +1,172 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow.c
+ *
+ * Description:
+ *
+ * Per thread flow cache, see sr_flow.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "sr_flow.h"
+#include "sr_protocol.h"
+
+static __thread struct sr_flow* sr_flow_table;
+
+static pthread_key_t  sr_flow_key;          /* frees a thread's table on exit */
+static pthread_once_t sr_flow_once = PTHREAD_ONCE_INIT;
+
+static void sr_flow_key_init(void)
+{
+    pthread_key_create(&sr_flow_key, free);
+}
+
+/* this thread's table, allocated on first use; 0 if out of memory */
+static struct sr_flow* sr_flow_table_get(void)
+{
+    if(sr_flow_table)
+    { return sr_flow_table; }
+
+    pthread_once(&sr_flow_once, sr_flow_key_init);
+    sr_flow_table = (struct sr_flow*)aligned_alloc(64, SR_FLOW_SZ * sizeof(struct sr_flow));
+    if(sr_flow_table)
+    {
+        memset(sr_flow_table, 0, SR_FLOW_SZ * sizeof(struct sr_flow));
+        pthread_setspecific(sr_flow_key, sr_flow_table);
+    }
+    return sr_flow_table;
+}
+
+/* keys are 16 bytes with no holes, compare them as two words */
+static inline int sr_flow_key_eq(const struct sr_flow_key* a, const struct sr_flow_key* b)
+{
+    uint64_t a0, a1, b0, b1;
+
+    memcpy(&a0, a, 8);
+    memcpy(&a1, (const uint8_t*)a + 8, 8);
+    memcpy(&b0, b, 8);
+    memcpy(&b1, (const uint8_t*)b + 8, 8);
+    return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+}
+
+/* first entry of key's set */
+static inline struct sr_flow* sr_flow_set(struct sr_flow* table, const struct sr_flow_key* key)
+{
+    uint64_t a, b;
+
+    memcpy(&a, key, 8);
+    memcpy(&b, (const uint8_t*)key + 8, 8);
+    a = (a ^ (b * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+    return &table[(a >> (64 - SR_FLOW_BITS)) & ~(SR_FLOW_WAYS - 1)];
+}
+
+static inline int sr_flow_live(const struct sr_flow* f, unsigned int rt_gen, unsigned int arp_seq)
+{
+    return f->iface && f->rt_gen == rt_gen && f->arp_seq == arp_seq;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_key_of(..)
+ * Scope: Global
+ *
+ * Fill key for the IP packet ip_pkt (ip_len bytes from the IP header on,
+ * header length already checked) received on interface ifidx.  Ports
+ * are left 0 for other protocols, for fragments (the first one too, so
+ * every fragment of a datagram has the same key) and if the packet is
+ * too short to hold them.  Returns -1 if ifidx does not
+ * fit the key, 0 otherwise.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_flow_key_of(const uint8_t* ip_pkt, unsigned int ip_len,
+                   unsigned int ifidx, struct sr_flow_key* key)
+{
+    const sr_ip_hdr_t* ip = (const sr_ip_hdr_t*)ip_pkt;
+    unsigned int hl = ip->ip_hl * 4;
+
+    if(ifidx > 0xff)
+    { return -1; }
+
+    key->src   = ip->ip_src;
+    key->dst   = ip->ip_dst;
+    key->sport = 0;
+    key->dport = 0;
+    key->proto = ip->ip_p;
+    key->ifidx = (uint8_t)ifidx;
+    key->pad   = 0;
+
+    if((ip->ip_p == ip_protocol_tcp || ip->ip_p == ip_protocol_udp) &&
+       (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)) == 0 && ip_len >= hl + 4)
+    {
+        memcpy(&key->sport, ip_pkt + hl, 2);
+        memcpy(&key->dport, ip_pkt + hl + 2, 2);
+    }
+    return 0;
+} /* -- sr_flow_key_of -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_find(..)
+ * Scope: Global
+ *
+ * This thread's entry for key if it was made at generations rt_gen and
+ * arp_seq, 0 otherwise.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_flow* sr_flow_find(const struct sr_flow_key* key,
+                             unsigned int rt_gen, unsigned int arp_seq)
+{
+    struct sr_flow* table = sr_flow_table_get();
+    struct sr_flow* set;
+    unsigned int i;
+
+    if(!table)
+    { return 0; }
+
+    set = sr_flow_set(table, key);
+    for(i = 0; i < SR_FLOW_WAYS; i++)
+    {
+        if(sr_flow_key_eq(&set[i].key, key) && sr_flow_live(&set[i], rt_gen, arp_seq))
+        { return &set[i]; }
+    }
+    return 0;
+} /* -- sr_flow_find -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_put(..)
+ * Scope: Global
+ *
+ * Remember that packets of flow key leave through iface with Ethernet
+ * header hdr, as decided at generations rt_gen and arp_seq.  Evicts the
+ * less recently added flow of its set if both ways are taken.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_flow_put(const struct sr_flow_key* key,
+                 unsigned int rt_gen, unsigned int arp_seq,
+                 struct sr_if* iface, const uint8_t* hdr)
+{
+    struct sr_flow* table = sr_flow_table_get();
+    struct sr_flow* set;
+    struct sr_flow* f;
+
+    if(!table || (arp_seq & 1))
+    { return; }
+
+    /* -- the first way holds the newer flow; a new one pushes it to the
+          second unless the first is dead or this flow's own -- */
+    set = sr_flow_set(table, key);
+    f = &set[0];
+    if(sr_flow_live(f, rt_gen, arp_seq) && !sr_flow_key_eq(&f->key, key))
+    { set[1] = set[0]; }
+
+    f->key     = *key;
+    f->rt_gen  = rt_gen;
+    f->arp_seq = arp_seq;
+    f->iface   = iface;
+    memcpy(f->hdr, hdr, SR_FLOW_HDR_LEN);
+} /* -- sr_flow_put -- */
@@ -0,0 +1,74 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow.h
+ *
+ * Description:
+ *
+ * Exact match flow cache.  A flow is the 5-tuple (addresses, protocol and,
+ * for TCP and UDP, ports) plus the ingress interface.  Once one packet of
+ * a flow has been forwarded, the cache remembers its egress interface and
+ * Ethernet header, and the next packets of the flow skip the routing
+ * table, the adjacency and the ARP cache, and the ICMP error frame the
+ * slow path prepares up front.  They are still checked (length, checksum,
+ * TTL) like any other packet.
+ *
+ * The cache is two way set associative, one cache line per flow, and
+ * private to each thread, so lookups and inserts take no locks and share
+ * no lines.  Each thread's table is allocated the first time it is used
+ * and freed when the thread exits.
+ *
+ * Entries are stamped with two generations taken before the slow path
+ * looked anything up: sr->rt_gen, bumped whenever a routing table is
+ * published, and the ARP cache's seqlock counter, which moves on every
+ * ARP insert, expiry or eviction.  An entry is used only while both
+ * still match, so it never outlives the route or ARP entry it was built
+ * from.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLOW_H
+#define SR_FLOW_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_FLOW_BITS    12
+#define SR_FLOW_SZ      (1 << SR_FLOW_BITS)    /* entries per thread */
+#define SR_FLOW_WAYS    2                       /* entries per set */
+#define SR_FLOW_HDR_LEN 14                      /* sizeof(sr_ethernet_hdr_t) */
+
+struct sr_if;
+
+struct sr_flow_key
+{
+    uint32_t src;           /* network byte order, as in the packet */
+    uint32_t dst;
+    uint16_t sport;         /* 0 unless TCP or UDP */
+    uint16_t dport;
+    uint8_t  proto;
+    uint8_t  ifidx;         /* ingress interface index */
+    uint16_t pad;           /* always 0, keys compare as 16 bytes */
+};
+
+struct sr_flow
+{
+    struct sr_flow_key key;
+    unsigned int  rt_gen;
+    unsigned int  arp_seq;
+    struct sr_if* iface;    /* egress interface, 0 if the slot is empty */
+    uint8_t       hdr[SR_FLOW_HDR_LEN];
+} __attribute__((aligned(64)));
+
+int sr_flow_key_of(const uint8_t* ip_pkt, unsigned int ip_len,
+                   unsigned int ifidx, struct sr_flow_key* key);
+struct sr_flow* sr_flow_find(const struct sr_flow_key* key,
+                             unsigned int rt_gen, unsigned int arp_seq);
+void sr_flow_put(const struct sr_flow_key* key,
+                 unsigned int rt_gen, unsigned int arp_seq,
+                 struct sr_if* iface, const uint8_t* hdr);
+
+#endif /* -- SR_FLOW_H -- */
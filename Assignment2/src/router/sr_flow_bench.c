@@ -0,0 +1,239 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow_bench.c
+ *
+ * Description:
+ *
+ * Microbenchmark of the flow cache against the lookups it saves, with
+ * packets drawn from a Zipf distribution over 1k to 1M flows.  The slow
+ * path is what sr_handle_ip_forwarding does for a route with a valid
+ * adjacency: sr_lpm_lookup over 100k prefixes, then sr_adj_get.  The
+ * cached path is sr_flow_key_of and sr_flow_find, falling back to the
+ * slow path and sr_flow_put on a miss.
+ *
+ * Usage: flow_bench [seed]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_lpm.h"
+#include "sr_adj.h"
+#include "sr_flow.h"
+
+#define FLOW_BENCH_PREFIXES 100000
+#define FLOW_BENCH_PACKETS  4000000
+#define FLOW_BENCH_PKT_LEN  (sizeof(sr_ip_hdr_t) + 4)
+
+static uint64_t bench_rng;
+
+static uint32_t bench_rand(void)
+{
+    /* xorshift64*, good enough and independent of libc rand() */
+    bench_rng ^= bench_rng >> 12;
+    bench_rng ^= bench_rng << 25;
+    bench_rng ^= bench_rng >> 27;
+    return (uint32_t)((bench_rng * 2685821657736338717ULL) >> 32);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* packet indices into nflows flows, flow k drawn with weight 1/k^s */
+static void bench_zipf(unsigned int* out, unsigned int n, unsigned int nflows, double s)
+{
+    double* cdf = (double*)malloc(nflows * sizeof(double));
+    double  sum = 0;
+    unsigned int i;
+
+    if(!cdf)
+    {
+        fprintf(stderr, "flow_bench: out of memory\n");
+        exit(1);
+    }
+    for(i = 0; i < nflows; i++)
+    {
+        sum += 1.0 / pow(i + 1, s);
+        cdf[i] = sum;
+    }
+    for(i = 0; i < n; i++)
+    {
+        double u = (bench_rand() / 4294967296.0) * sum;
+        unsigned int lo = 0, hi = nflows - 1;
+
+        while(lo < hi)
+        {
+            unsigned int mid = (lo + hi) / 2;
+            if(cdf[mid] < u) { lo = mid + 1; }
+            else { hi = mid; }
+        }
+        out[i] = lo;
+    }
+    free(cdf);
+}
+
+static struct sr_rt* bench_routes(struct sr_if* ifaces)
+{
+    struct sr_rt* table = (struct sr_rt*)calloc(FLOW_BENCH_PREFIXES, sizeof(struct sr_rt));
+    unsigned char mac[ETHER_ADDR_LEN];
+    unsigned int i;
+
+    if(!table)
+    {
+        fprintf(stderr, "flow_bench: out of memory\n");
+        exit(1);
+    }
+    for(i = 0; i < FLOW_BENCH_PREFIXES; i++)
+    {
+        /* -- entry 0 is the default route, so every lookup finds one -- */
+        int len = i ? 8 + bench_rand() % 25 : 0;
+        uint32_t mask = len ? 0xffffffffu << (32 - len) : 0;
+
+        table[i].dest.s_addr = htonl(bench_rand() & mask);
+        table[i].mask.s_addr = htonl(mask);
+        table[i].gw.s_addr   = htonl(0x0a000001 + (i & 0xff));
+        snprintf(table[i].interface, sr_IFACE_NAMELEN, "eth%u", i & 3);
+        table[i].next = (i + 1 < FLOW_BENCH_PREFIXES) ? &table[i + 1] : 0;
+
+        sr_adj_init(&table[i].adj);
+        memset(mac, 0, ETHER_ADDR_LEN);
+        mac[5] = (unsigned char)i;
+        sr_adj_set(&table[i].adj, 0, &ifaces[i & 3], mac);
+    }
+    return table;
+}
+
+static void bench_run(struct sr_lpm* lpm, unsigned int nflows, double s)
+{
+    static unsigned int gen;
+
+    uint8_t*      pkts  = (uint8_t*)calloc(nflows, FLOW_BENCH_PKT_LEN);
+    unsigned int* order = (unsigned int*)malloc(FLOW_BENCH_PACKETS * sizeof(unsigned int));
+    uint8_t       frame[SR_ADJ_HDR_LEN];
+    unsigned int  i, hits = 0;
+    double        t0, t_slow, t_flow;
+    volatile uintptr_t sink = 0;
+
+    if(!pkts || !order)
+    {
+        fprintf(stderr, "flow_bench: out of memory\n");
+        exit(1);
+    }
+
+    for(i = 0; i < nflows; i++)
+    {
+        uint8_t* p = pkts + i * FLOW_BENCH_PKT_LEN;
+        sr_ip_hdr_t* ip = (sr_ip_hdr_t*)p;
+        uint32_t ports = bench_rand();
+
+        ip->ip_v   = 4;
+        ip->ip_hl  = 5;
+        ip->ip_ttl = 64;
+        ip->ip_p   = (i & 1) ? ip_protocol_udp : ip_protocol_tcp;
+        ip->ip_src = bench_rand();
+        ip->ip_dst = bench_rand();
+        memcpy(p + sizeof(sr_ip_hdr_t), &ports, 4);
+    }
+    bench_zipf(order, FLOW_BENCH_PACKETS, nflows, s);
+
+    t0 = bench_now();
+    for(i = 0; i < FLOW_BENCH_PACKETS; i++)
+    {
+        const sr_ip_hdr_t* ip = (const sr_ip_hdr_t*)(pkts + order[i] * FLOW_BENCH_PKT_LEN);
+        struct sr_rt* rt = sr_lpm_lookup(lpm, ip->ip_dst);
+        struct sr_if* out;
+
+        sr_adj_get(&rt->adj, 0, frame, &out);
+        sink += (uintptr_t)out + frame[5];
+    }
+    t_slow = (bench_now() - t0) / FLOW_BENCH_PACKETS;
+
+    /* -- a fresh generation empties the cache left by the previous run -- */
+    gen++;
+    t0 = bench_now();
+    for(i = 0; i < FLOW_BENCH_PACKETS; i++)
+    {
+        const uint8_t* p = pkts + order[i] * FLOW_BENCH_PKT_LEN;
+        struct sr_flow_key key;
+        struct sr_flow* f;
+
+        sr_flow_key_of(p, FLOW_BENCH_PKT_LEN, 1, &key);
+        if((f = sr_flow_find(&key, gen, 0)) != 0)
+        {
+            memcpy(frame, f->hdr, SR_FLOW_HDR_LEN);
+            sink += (uintptr_t)f->iface + frame[5];
+            hits++;
+        }
+        else
+        {
+            struct sr_rt* rt = sr_lpm_lookup(lpm, ((const sr_ip_hdr_t*)p)->ip_dst);
+            struct sr_if* out;
+
+            sr_adj_get(&rt->adj, 0, frame, &out);
+            sr_flow_put(&key, gen, 0, out, frame);
+            sink += (uintptr_t)out + frame[5];
+        }
+    }
+    t_flow = (bench_now() - t0) / FLOW_BENCH_PACKETS;
+
+    printf("%9u %5.2f %8.1f %13.1f %13.1f\n", nflows, s,
+           100.0 * hits / FLOW_BENCH_PACKETS, t_slow * 1e9, t_flow * 1e9);
+
+    free(order);
+    free(pkts);
+}
+
+int main(int argc, char** argv)
+{
+    static const unsigned int flows[] = { 1000, 10000, 100000, 1000000 };
+    static const double       skews[] = { 0.9, 1.1 };
+    struct sr_if   ifaces[4];
+    struct sr_rt*  table;
+    struct sr_lpm* lpm;
+    unsigned int   i, j;
+
+    bench_rng = (argc > 1) ? strtoull(argv[1], 0, 0) : 0x5eed5eedULL;
+    if(bench_rng == 0)
+    { bench_rng = 1; }
+
+    memset(ifaces, 0, sizeof(ifaces));
+    for(i = 0; i < 4; i++)
+    {
+        snprintf(ifaces[i].name, sr_IFACE_NAMELEN, "eth%u", i);
+        ifaces[i].addr[5] = (unsigned char)(0x10 + i);
+        ifaces[i].index = i;
+    }
+    table = bench_routes(ifaces);
+    if((lpm = sr_lpm_build(table)) == 0)
+    {
+        fprintf(stderr, "flow_bench: sr_lpm_build failed\n");
+        exit(1);
+    }
+
+    printf("%d prefixes, %d packets per run, %d cache entries\n",
+           FLOW_BENCH_PREFIXES, FLOW_BENCH_PACKETS, SR_FLOW_SZ);
+    printf("%9s %5s %8s %13s %13s\n", "flows", "zipf", "hit(%)",
+           "slow(ns/pkt)", "flow(ns/pkt)");
+    for(i = 0; i < sizeof(flows) / sizeof(flows[0]); i++)
+    {
+        for(j = 0; j < sizeof(skews) / sizeof(skews[0]); j++)
+        { bench_run(lpm, flows[i], skews[j]); }
+    }
+
+    sr_lpm_destroy(lpm);
+    free(table);
+    return 0;
+}
@@ -23,6 +23,33 @@
 #include "sr_if.h"
 #include "sr_router.h"
 
+/* -- hashes for sr_if_table, all reduced to SR_IF_HASH_BITS -- */
+
+static unsigned int sr_if_hash_bytes(const uint8_t* p, unsigned int len)
+{
+    uint32_t h = 2166136261u;   /* FNV-1a */
+    unsigned int i;
+
+    for(i = 0; i < len && p[i]; i++)
+    { h = (h ^ p[i]) * 16777619u; }
+    return (h ^ (h >> 16)) & (SR_IF_HASH_SZ - 1);
+}
+
+static unsigned int sr_if_hash_ip(uint32_t ip)
+{
+    return (ip * 2654435761u) >> (32 - SR_IF_HASH_BITS);
+}
+
+static unsigned int sr_if_hash_mac(const uint8_t* mac)
+{
+    uint32_t h = 2166136261u;
+    unsigned int i;
+
+    for(i = 0; i < ETHER_ADDR_LEN; i++)
+    { h = (h ^ mac[i]) * 16777619u; }
+    return (h ^ (h >> 16)) & (SR_IF_HASH_SZ - 1);
+}
+
 /*---------------------------------------------------------------------
  * Method: sr_get_interface
  * Scope: Global
@@ -34,24 +61,42 @@
 
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
 {
-    struct sr_if* if_walker = 0;
+    struct sr_if_table* t = &(sr->if_table);
+    unsigned int h;
 
     /* -- REQUIRES -- */
     assert(name);
     assert(sr);
 
-    if_walker = sr->if_list;
-
-    while(if_walker)
+    h = sr_if_hash_bytes((const uint8_t*)name, sr_IFACE_NAMELEN);
+    for(; t->by_name[h]; h = (h + 1) & (SR_IF_HASH_SZ - 1))
     {
-       if(!strncmp(if_walker->name,name,sr_IFACE_NAMELEN))
-        { return if_walker; }
-        if_walker = if_walker->next;
+        struct sr_if* iface = t->by_index[t->by_name[h] - 1];
+
+        if(!strncmp(iface->name,name,sr_IFACE_NAMELEN))
+        { return iface; }
     }
 
     return 0;
 } /* -- sr_get_interface -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_get_interface_by_index
+ * Scope: Global
+ *
+ * Given an interface index return the interface record or 0 if it
+ * doesn't exist.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_get_interface_by_index(struct sr_instance* sr, unsigned int index)
+{
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    return (index < sr->if_table.count) ? sr->if_table.by_index[index] : 0;
+} /* -- sr_get_interface_by_index -- */
+
 /*---------------------------------------------------------------------
  * Method: sr_get_interface_from_ip
  * Scope: Global
@@ -63,18 +108,19 @@ struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
 
 struct sr_if *get_interface_from_ip(struct sr_instance *sr, uint32_t ip_address)
 {
-  struct sr_if *cur_iface = sr->if_list;
-  struct sr_if *dest_iface = NULL;
-  while (cur_iface)
+  struct sr_if_table *t = &(sr->if_table);
+  unsigned int h = sr_if_hash_ip(ip_address);
+
+  // most lookups are for addresses that are not ours and end on an empty slot
+  for (; t->by_ip[h]; h = (h + 1) & (SR_IF_HASH_SZ - 1))
   {
-    if (ip_address == cur_iface->ip)
+    struct sr_if *iface = t->by_index[t->by_ip[h] - 1];
+    if (iface->ip == ip_address)
     {
-      dest_iface = cur_iface;
-      break;
+      return iface;
     }
-    cur_iface = cur_iface->next;
   }
-  return dest_iface;
+  return NULL;
 } /* -- sr_get_interface_from_ip -- */
 
 /*---------------------------------------------------------------------
@@ -88,30 +134,78 @@ struct sr_if *get_interface_from_ip(struct sr_instance *sr, uint32_t ip_address)
 
 struct sr_if *get_interface_from_eth(struct sr_instance *sr, uint8_t *eth_address)
 {
-  struct sr_if *cur_iface = sr->if_list;
-  struct sr_if *dest_iface = NULL;
-  short match_found, i;
-  while (cur_iface)
+  struct sr_if_table *t = &(sr->if_table);
+  unsigned int h = sr_if_hash_mac(eth_address);
+
+  for (; t->by_mac[h]; h = (h + 1) & (SR_IF_HASH_SZ - 1))
   {
-    match_found = 1;
-    for (i = 0; i < ETHER_ADDR_LEN; i++)
-    {
-      if (cur_iface->addr[i] != eth_address[i])
-      {
-        match_found = 0;
-        break;
-      }
-    }
-    if (match_found)
+    struct sr_if *iface = t->by_index[t->by_mac[h] - 1];
+    if (memcmp(iface->addr, eth_address, ETHER_ADDR_LEN) == 0)
     {
-      dest_iface = cur_iface;
-      break;
+      return iface;
     }
-    cur_iface = cur_iface->next;
   }
-  return dest_iface;
+  return NULL;
 } /* -- sr_get_interface_from_eth -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_if_table_build(..)
+ * Scope: Global
+ *
+ * (Re)build sr->if_table from if_list.  Call once the interfaces have
+ * their names and addresses, i.e. after VNSHWINFO; until then every
+ * lookup fails.  Returns 0, or -1 with the table left empty if there
+ * are more than SR_IF_MAX interfaces.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_if_table_build(struct sr_instance* sr)
+{
+    struct sr_if_table* t = &(sr->if_table);
+    struct sr_if* iface;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    memset(t, 0, sizeof(struct sr_if_table));
+
+    for(iface = sr->if_list; iface; iface = iface->next)
+    {
+        unsigned int h;
+
+        if(t->count == SR_IF_MAX)
+        {
+            fprintf(stderr, "More than %d interfaces, cannot handle %s\n",
+                    SR_IF_MAX, iface->name);
+            memset(t, 0, sizeof(struct sr_if_table));
+            return -1;
+        }
+        assert(iface->index == t->count);
+        t->by_index[t->count++] = iface;
+
+        /* -- a key already present belongs to an earlier interface -- */
+        if(sr_get_interface(sr, iface->name) == 0)
+        {
+            h = sr_if_hash_bytes((const uint8_t*)iface->name, sr_IFACE_NAMELEN);
+            while(t->by_name[h]) { h = (h + 1) & (SR_IF_HASH_SZ - 1); }
+            t->by_name[h] = t->count;
+        }
+        if(get_interface_from_ip(sr, iface->ip) == 0)
+        {
+            h = sr_if_hash_ip(iface->ip);
+            while(t->by_ip[h]) { h = (h + 1) & (SR_IF_HASH_SZ - 1); }
+            t->by_ip[h] = t->count;
+        }
+        if(get_interface_from_eth(sr, iface->addr) == 0)
+        {
+            h = sr_if_hash_mac(iface->addr);
+            while(t->by_mac[h]) { h = (h + 1) & (SR_IF_HASH_SZ - 1); }
+            t->by_mac[h] = t->count;
+        }
+    }
+    return 0;
+} /* -- sr_if_table_build -- */
+
 /*---------------------------------------------------------------------
  * Method: sr_add_interface(..)
  * Scope: Global
@@ -134,6 +228,7 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
         sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
         assert(sr->if_list);
         sr->if_list->next = 0;
+        sr->if_list->index = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
         return;
     }
@@ -145,6 +240,7 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
 
     if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
     assert(if_walker->next);
+    if_walker->next->index = if_walker->index + 1;
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
     if_walker->next = 0;
@@ -26,6 +26,11 @@
 
 struct sr_instance;
 
+#define SR_IF_MAX       16      /* interfaces looked up through sr_if_table,
+                                   a router with more does not start */
+#define SR_IF_HASH_BITS 6
+#define SR_IF_HASH_SZ   (1 << SR_IF_HASH_BITS)  /* > 2 * SR_IF_MAX, short probes */
+
 /* ----------------------------------------------------------------------------
  * struct sr_if
  *
@@ -39,12 +44,35 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  unsigned int index;   /* position in if_list, fixed once added */
   struct sr_if* next;
 };
 
+/* ----------------------------------------------------------------------------
+ * struct sr_if_table
+ *
+ * Lookup tables over if_list, built by sr_if_table_build once VNSHWINFO
+ * has described every interface.  by_index is dense; the hash tables are
+ * open addressing with linear probing and hold index + 1, 0 for empty.
+ * Where two interfaces share a key the first one in if_list wins, as it
+ * did when the list was walked.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_if_table
+{
+  struct sr_if* by_index[SR_IF_MAX];
+  unsigned int count;
+  uint8_t by_name[SR_IF_HASH_SZ];
+  uint8_t by_ip[SR_IF_HASH_SZ];
+  uint8_t by_mac[SR_IF_HASH_SZ];
+};
+
 struct sr_if *sr_get_interface(struct sr_instance* sr, const char* name);
+struct sr_if *sr_get_interface_by_index(struct sr_instance* sr, unsigned int index);
 struct sr_if *get_interface_from_ip(struct sr_instance *, uint32_t);
 struct sr_if *get_interface_from_eth(struct sr_instance *, uint8_t *);
+int  sr_if_table_build(struct sr_instance*);
 void sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
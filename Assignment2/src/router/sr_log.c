@@ -0,0 +1,92 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.c
+ *
+ * Description:
+ *
+ * Run time side of sr_log.h: the per second limiter shared by all threads
+ * and the SIGUSR1 switch.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include "sr_log.h"
+
+volatile int sr_log_rate = 0;
+
+static int sr_log_rate_on = 0;      /* what SIGUSR1 restores, 0 for the default */
+
+static long sr_log_window;          /* second the counts below belong to */
+static unsigned int sr_log_count;
+static unsigned int sr_log_suppressed;
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_allow(..)
+ * Scope: Global
+ *
+ * Nonzero if one more limited line fits in the current second at rate
+ * lines a second.  When a new second starts, whoever moves the window on
+ * reports how many lines the previous one swallowed.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_log_allow(int rate)
+{
+    struct timespec ts;
+    long window;
+
+    if(rate < 0)
+    { return 1; }
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    window = __atomic_load_n(&sr_log_window, __ATOMIC_RELAXED);
+    if(ts.tv_sec != window &&
+       __atomic_compare_exchange_n(&sr_log_window, &window, ts.tv_sec, 0,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        unsigned int n = __atomic_exchange_n(&sr_log_suppressed, 0, __ATOMIC_RELAXED);
+
+        __atomic_store_n(&sr_log_count, 0, __ATOMIC_RELAXED);
+        if(n)
+        { fprintf(stderr, "[log: %u lines suppressed]\n", n); }
+    }
+
+    if(__atomic_fetch_add(&sr_log_count, 1, __ATOMIC_RELAXED) < (unsigned int)rate)
+    { return 1; }
+
+    __atomic_fetch_add(&sr_log_suppressed, 1, __ATOMIC_RELAXED);
+    return 0;
+} /* -- sr_log_allow -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_set_rate(..)
+ * Scope: Global
+ *
+ * SR_DEBUG lines per second, 0 for none, -1 for no limit.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_log_set_rate(int rate)
+{
+    if(rate != 0)
+    { sr_log_rate_on = rate; }
+    sr_log_rate = rate;
+} /* -- sr_log_set_rate -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_toggle(..)
+ * Scope: Global
+ *
+ * SIGUSR1 handler, switches debug output off, or back on at the rate
+ * sr -d last gave (SR_LOG_RATE_DEFAULT if it gave none).
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_log_toggle(int sig)
+{
+    if(sr_log_rate)
+    { sr_log_rate = 0; }
+    else
+    { sr_log_rate = sr_log_rate_on ? sr_log_rate_on : SR_LOG_RATE_DEFAULT; }
+} /* -- sr_log_toggle -- */
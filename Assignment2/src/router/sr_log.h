@@ -0,0 +1,85 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.h
+ *
+ * Description:
+ *
+ * Leveled logging for the router.
+ *
+ * SR_LOG_LEVEL picks, at build time, the most verbose level that is
+ * compiled in; anything above it expands to nothing, arguments included.
+ * The default build keeps everything, make bench keeps only SR_ERR.
+ *
+ *   SR_ERR    - something failed (allocation, socket write), to stderr
+ *   SR_WARN   - unexpected input that is dropped, to stderr
+ *   SR_INFO   - session events, not per packet, to stdout
+ *   SR_DEBUG  - per packet traces, to stdout
+ *
+ * SR_WARN and SR_DEBUG can fire on every frame, so at run time both pass
+ * through a limiter: at most so many lines per second, the rest are
+ * counted and reported once the next second starts.  SR_DEBUG is off
+ * until sr -d sets sr_log_rate (-1 lets every line through) or SIGUSR1
+ * switches it on, and while it is off costs one load of sr_log_rate.
+ * SR_WARN uses sr_log_rate when debug is on and SR_LOG_RATE_DEFAULT
+ * otherwise.
+ *
+ * Wrap multi-line output (print_hdrs) in if(SR_DEBUG_ON()) { .. } so it
+ * counts once and disappears from builds without debug.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LOG_H
+#define SR_LOG_H
+
+#include <stdio.h>
+
+#define SR_LOG_NONE     0
+#define SR_LOG_ERR      1
+#define SR_LOG_WARN     2
+#define SR_LOG_INFO     3
+#define SR_LOG_DEBUG    4
+
+#ifndef SR_LOG_LEVEL
+#define SR_LOG_LEVEL    SR_LOG_DEBUG
+#endif
+
+#define SR_LOG_RATE_DEFAULT 100     /* limited lines per second */
+
+extern volatile int sr_log_rate;    /* SR_DEBUG lines per second, 0 off */
+
+int  sr_log_allow(int rate);
+void sr_log_set_rate(int rate);
+void sr_log_toggle(int sig);
+
+/* -- the limiter is only consulted once the flag says debug is on -- */
+#define SR_LOG_DEBUG_ON() (sr_log_rate != 0 && sr_log_allow(sr_log_rate))
+#define SR_LOG_WARN_ON()  sr_log_allow(sr_log_rate ? sr_log_rate : SR_LOG_RATE_DEFAULT)
+
+#if SR_LOG_LEVEL >= SR_LOG_ERR
+#define SR_ERR(x, args...) fprintf(stderr, x, ## args)
+#else
+#define SR_ERR(x, args...) do{}while(0)
+#endif
+
+#if SR_LOG_LEVEL >= SR_LOG_WARN
+#define SR_WARN(x, args...) \
+    do { if(SR_LOG_WARN_ON()) { fprintf(stderr, x, ## args); } } while(0)
+#else
+#define SR_WARN(x, args...) do{}while(0)
+#endif
+
+#if SR_LOG_LEVEL >= SR_LOG_INFO
+#define SR_INFO(x, args...) printf(x, ## args)
+#else
+#define SR_INFO(x, args...) do{}while(0)
+#endif
+
+#if SR_LOG_LEVEL >= SR_LOG_DEBUG
+#define SR_DEBUG_ON() SR_LOG_DEBUG_ON()
+#define SR_DEBUG(x, args...) \
+    do { if(SR_LOG_DEBUG_ON()) { printf(x, ## args); } } while(0)
+#else
+#define SR_DEBUG_ON() 0
+#define SR_DEBUG(x, args...) do{}while(0)
+#endif
+
+#endif /* -- SR_LOG_H -- */
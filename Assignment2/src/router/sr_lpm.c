@@ -0,0 +1,326 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_lpm.c
+ *
+ * Description:
+ *
+ * 16-8-8 multibit trie for longest prefix match.  See sr_lpm.h for the
+ * entry encoding.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_lpm.h"
+#include "sr_rt.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_lpm_prefix_len(..)
+ * Scope: Global
+ *
+ * Number of leading one bits in a netmask given in network byte order.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_lpm_prefix_len(uint32_t mask)
+{
+    uint32_t m = ntohl(mask);
+    int len = 0;
+
+    while(m & 0x80000000u)
+    {
+        len++;
+        m <<= 1;
+    }
+    return len;
+} /* -- sr_lpm_prefix_len -- */
+
+struct sr_lpm* sr_lpm_create(void)
+{
+    struct sr_lpm* lpm = (struct sr_lpm*)calloc(1, sizeof(struct sr_lpm));
+    if(!lpm)
+    { return 0; }
+
+    lpm->l1       = (uint32_t*)calloc(SR_LPM_L1_SZ, sizeof(uint32_t));
+    lpm->l1_depth = (uint8_t*)calloc(SR_LPM_L1_SZ, sizeof(uint8_t));
+    if(!lpm->l1 || !lpm->l1_depth)
+    {
+        sr_lpm_destroy(lpm);
+        return 0;
+    }
+    return lpm;
+} /* -- sr_lpm_create -- */
+
+void sr_lpm_destroy(struct sr_lpm* lpm)
+{
+    if(!lpm)
+    { return; }
+
+    if(lpm->map)
+    { munmap(lpm->map, lpm->map_len); }
+    else
+    {
+        free(lpm->l1);
+        free(lpm->chunks);
+    }
+    free(lpm->l1_depth);
+    free(lpm->chunk_depth);
+    free(lpm->routes);
+    free(lpm);
+} /* -- sr_lpm_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lpm_expand(..)
+ * Scope: Local
+ *
+ * Make sure the given slot points at a chunk of the next level.  A
+ * slot that held a route is pushed down into every entry of the new
+ * chunk.  Returns the chunk number or -1 if out of memory.
+ *
+ * Note: growing the chunk array can move it, so callers must not hold
+ * pointers into lpm->chunks across this call.
+ *
+ *---------------------------------------------------------------------*/
+
+static long sr_lpm_expand(struct sr_lpm* lpm, int in_l1, uint32_t slot)
+{
+    uint32_t entry = in_l1 ? lpm->l1[slot] : lpm->chunks[slot];
+    uint8_t  depth = in_l1 ? lpm->l1_depth[slot] : lpm->chunk_depth[slot];
+    uint32_t n;
+
+    if(entry & SR_LPM_CHUNK)
+    { return entry & ~SR_LPM_CHUNK; }
+
+    if(lpm->nchunks == lpm->chunk_cap)
+    {
+        uint32_t cap = lpm->chunk_cap ? lpm->chunk_cap * 2 : 64;
+        uint32_t* chunks;
+        uint8_t*  depths;
+
+        if(cap >= (SR_LPM_CHUNK >> 8))
+        { return -1; }
+
+        chunks = (uint32_t*)realloc(lpm->chunks,
+                (size_t)cap * SR_LPM_CHUNK_SZ * sizeof(uint32_t));
+        if(!chunks)
+        { return -1; }
+        lpm->chunks = chunks;
+
+        depths = (uint8_t*)realloc(lpm->chunk_depth,
+                (size_t)cap * SR_LPM_CHUNK_SZ * sizeof(uint8_t));
+        if(!depths)
+        { return -1; }
+        lpm->chunk_depth = depths;
+
+        lpm->chunk_cap = cap;
+    }
+
+    n = lpm->nchunks++;
+    {
+        uint32_t* e = lpm->chunks + (size_t)n * SR_LPM_CHUNK_SZ;
+        uint8_t*  d = lpm->chunk_depth + (size_t)n * SR_LPM_CHUNK_SZ;
+        int i;
+
+        for(i = 0; i < SR_LPM_CHUNK_SZ; i++)
+        {
+            e[i] = entry;
+        }
+        memset(d, depth, SR_LPM_CHUNK_SZ);
+    }
+
+    if(in_l1)
+    { lpm->l1[slot] = SR_LPM_CHUNK | n; }
+    else
+    { lpm->chunks[slot] = SR_LPM_CHUNK | n; }
+
+    return n;
+} /* -- sr_lpm_expand -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lpm_fill(..)
+ * Scope: Local
+ *
+ * Set count consecutive slots to value unless a slot already carries a
+ * prefix at least as long.  Slots that were expanded get the value pushed
+ * down into their chunk.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_lpm_fill(struct sr_lpm* lpm, uint32_t* entries, uint8_t* depths,
+                        uint32_t start, uint32_t count,
+                        uint32_t value, uint8_t depth)
+{
+    uint32_t i;
+
+    for(i = start; i < start + count; i++)
+    {
+        if(entries[i] & SR_LPM_CHUNK)
+        {
+            size_t base = (size_t)(entries[i] & ~SR_LPM_CHUNK) * SR_LPM_CHUNK_SZ;
+            sr_lpm_fill(lpm, lpm->chunks + base, lpm->chunk_depth + base,
+                        0, SR_LPM_CHUNK_SZ, value, depth);
+        }
+        else if(depths[i] < depth)
+        {
+            entries[i] = value;
+            depths[i]  = depth;
+        }
+    }
+} /* -- sr_lpm_fill -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lpm_insert(..)
+ * Scope: Global
+ *
+ * Add a routing table entry.  The entry is borrowed and must outlive the
+ * lookup structure.  Returns 0 on success, -1 if out of memory or the
+ * table was mapped from an image.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_lpm_insert(struct sr_lpm* lpm, struct sr_rt* rt)
+{
+    int      len;
+    uint32_t prefix, value;
+    uint8_t  depth;
+    long     c2, c3;
+
+    /* -- REQUIRES -- */
+    assert(lpm);
+    assert(rt);
+
+    if(lpm->map)
+    { return -1; }
+
+    if(lpm->nroutes == lpm->route_cap)
+    {
+        uint32_t cap = lpm->route_cap ? lpm->route_cap * 2 : 64;
+        struct sr_rt** routes = (struct sr_rt**)realloc(lpm->routes,
+                cap * sizeof(struct sr_rt*));
+        if(!routes)
+        { return -1; }
+        lpm->routes = routes;
+        lpm->route_cap = cap;
+    }
+    lpm->routes[lpm->nroutes] = rt;
+    value = ++lpm->nroutes;
+
+    len    = sr_lpm_prefix_len(rt->mask.s_addr);
+    prefix = ntohl(rt->dest.s_addr & rt->mask.s_addr);
+    depth  = (uint8_t)(len + 1);
+
+    if(len <= SR_LPM_L1_BITS)
+    {
+        sr_lpm_fill(lpm, lpm->l1, lpm->l1_depth, prefix >> 16,
+                    1u << (SR_LPM_L1_BITS - len), value, depth);
+        return 0;
+    }
+
+    if((c2 = sr_lpm_expand(lpm, 1, prefix >> 16)) < 0)
+    { return -1; }
+
+    if(len <= 24)
+    {
+        size_t base = (size_t)c2 * SR_LPM_CHUNK_SZ;
+        sr_lpm_fill(lpm, lpm->chunks + base, lpm->chunk_depth + base,
+                    (prefix >> 8) & 0xff, 1u << (24 - len), value, depth);
+        return 0;
+    }
+
+    if((c3 = sr_lpm_expand(lpm, 0,
+                    (uint32_t)c2 * SR_LPM_CHUNK_SZ + ((prefix >> 8) & 0xff))) < 0)
+    { return -1; }
+
+    {
+        size_t base = (size_t)c3 * SR_LPM_CHUNK_SZ;
+        sr_lpm_fill(lpm, lpm->chunks + base, lpm->chunk_depth + base,
+                    prefix & 0xff, 1u << (32 - len), value, depth);
+    }
+    return 0;
+} /* -- sr_lpm_insert -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lpm_build(..)
+ * Scope: Global
+ *
+ * Build a lookup structure from a routing table list.  Routes are
+ * inserted shortest prefix first (stable, so ties keep list order) which
+ * means a fill never has to descend into chunks created by longer
+ * prefixes.  Returns NULL if out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_lpm* sr_lpm_build(struct sr_rt* list)
+{
+    struct sr_lpm* lpm = sr_lpm_create();
+    struct sr_rt** sorted = 0;
+    struct sr_rt*  rt;
+    size_t start[34];
+    size_t n = 0, i;
+    int len;
+
+    if(!lpm)
+    { return 0; }
+
+    memset(start, 0, sizeof(start));
+    for(rt = list; rt; rt = rt->next)
+    {
+        start[sr_lpm_prefix_len(rt->mask.s_addr) + 1]++;
+        n++;
+    }
+    for(len = 1; len < 34; len++)
+    { start[len] += start[len - 1]; }
+
+    if(n && (sorted = (struct sr_rt**)malloc(n * sizeof(struct sr_rt*))) == 0)
+    {
+        sr_lpm_destroy(lpm);
+        return 0;
+    }
+    for(rt = list; rt; rt = rt->next)
+    { sorted[start[sr_lpm_prefix_len(rt->mask.s_addr)]++] = rt; }
+
+    for(i = 0; i < n; i++)
+    {
+        if(sr_lpm_insert(lpm, sorted[i]) != 0)
+        {
+            free(sorted);
+            sr_lpm_destroy(lpm);
+            return 0;
+        }
+    }
+
+    free(sorted);
+    return lpm;
+} /* -- sr_lpm_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lpm_lookup(..)
+ * Scope: Global
+ *
+ * Return the routing table entry with the longest prefix covering ip, or
+ * NULL if there is none.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_lpm_lookup(const struct sr_lpm* lpm, uint32_t ip)
+{
+    uint32_t addr = ntohl(ip);
+    uint32_t e = lpm->l1[addr >> 16];
+
+    if(e & SR_LPM_CHUNK)
+    {
+        e = lpm->chunks[((size_t)(e & ~SR_LPM_CHUNK) << 8) | ((addr >> 8) & 0xff)];
+        if(e & SR_LPM_CHUNK)
+        {
+            e = lpm->chunks[((size_t)(e & ~SR_LPM_CHUNK) << 8) | (addr & 0xff)];
+        }
+    }
+
+    return e ? lpm->routes[e - 1] : 0;
+} /* -- sr_lpm_lookup -- */
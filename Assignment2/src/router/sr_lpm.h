@@ -0,0 +1,72 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_lpm.h
+ *
+ * Description:
+ *
+ * Longest-prefix-match lookup structure built over the routing table.
+ *
+ * The table is a 16-8-8 multibit trie with leaf pushing (the DIR-24-8 idea
+ * split one more level so memory stays proportional to the number of long
+ * prefixes).  A lookup is at most three dependent array reads no matter how
+ * many routes are loaded.
+ *
+ * Every slot holds a 32 bit entry:
+ *
+ *    0                 no route
+ *    SR_LPM_CHUNK|n    slot is expanded into chunk n of the next level
+ *    i + 1             route i in the routes[] array
+ *
+ * Slot depths (prefix length + 1) are only needed while inserting, so that a
+ * shorter prefix never overwrites a longer one that was inserted before it.
+ * For two routes with the same prefix and mask the first one inserted wins,
+ * matching the old "stop at the first match" list walk; it leads the equal
+ * cost group the others belong to (sr_ecmp.h).
+ *
+ * A table mapped from a routing table image (sr_rtbin.h) has no depths and
+ * cannot be inserted into; its l1 and chunks point into the mapping.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LPM_H
+#define SR_LPM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+struct sr_rt;
+
+#define SR_LPM_L1_BITS   16
+#define SR_LPM_L1_SZ     (1 << SR_LPM_L1_BITS)
+#define SR_LPM_CHUNK_SZ  256
+#define SR_LPM_CHUNK     0x80000000u
+
+struct sr_lpm
+{
+    uint32_t*      l1;          /* SR_LPM_L1_SZ entries, indexed by ip >> 16 */
+    uint8_t*       l1_depth;
+    uint32_t*      chunks;      /* nchunks * SR_LPM_CHUNK_SZ entries */
+    uint8_t*       chunk_depth;
+    uint32_t       nchunks;
+    uint32_t       chunk_cap;
+    struct sr_rt** routes;      /* route index -> routing table entry */
+    uint32_t       nroutes;
+    uint32_t       route_cap;
+    void*          map;         /* image l1 and chunks live in, 0 if none */
+    size_t         map_len;
+};
+
+struct sr_lpm* sr_lpm_create(void);
+void           sr_lpm_destroy(struct sr_lpm* lpm);
+int            sr_lpm_insert(struct sr_lpm* lpm, struct sr_rt* rt);
+struct sr_lpm* sr_lpm_build(struct sr_rt* list);
+struct sr_rt*  sr_lpm_lookup(const struct sr_lpm* lpm, uint32_t ip /* nbo */);
+int            sr_lpm_prefix_len(uint32_t mask /* nbo */);
+
+#endif /* -- SR_LPM_H -- */
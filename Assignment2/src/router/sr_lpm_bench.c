@@ -0,0 +1,166 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_lpm_bench.c
+ *
+ * Description:
+ *
+ * Microbenchmark comparing sr_lpm_lookup against a longest-prefix walk of
+ * the sr_rt linked list at 10, 1k, 100k and 1M random prefixes.
+ *
+ * Usage: lpm_bench [seed]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_rt.h"
+#include "sr_lpm.h"
+
+#define LPM_BENCH_LOOKUPS  2000000
+#define LIST_BENCH_VISITS  200000000.0
+
+static uint64_t bench_rng;
+
+static uint32_t bench_rand(void)
+{
+    /* xorshift64*, good enough and independent of libc rand() */
+    bench_rng ^= bench_rng >> 12;
+    bench_rng ^= bench_rng << 25;
+    bench_rng ^= bench_rng >> 27;
+    return (uint32_t)((bench_rng * 2685821657736338717ULL) >> 32);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* prefix length mix loosely shaped like a full BGP table */
+static int bench_prefix_len(void)
+{
+    uint32_t r = bench_rand() % 100;
+
+    if(r < 60) { return 24; }
+    if(r < 80) { return 16 + bench_rand() % 8; }
+    if(r < 90) { return 8 + bench_rand() % 8; }
+    return 25 + bench_rand() % 8;
+}
+
+/* the old forwarding path, fixed to honour the mask */
+static struct sr_rt* list_lookup(struct sr_rt* rt, uint32_t ip)
+{
+    struct sr_rt* best = 0;
+    uint32_t best_mask = 0;
+
+    for(; rt; rt = rt->next)
+    {
+        if((ip & rt->mask.s_addr) == (rt->dest.s_addr & rt->mask.s_addr) &&
+           (best == 0 || ntohl(rt->mask.s_addr) > best_mask))
+        {
+            best = rt;
+            best_mask = ntohl(rt->mask.s_addr);
+        }
+    }
+    return best;
+}
+
+static void bench_run(unsigned int nprefixes)
+{
+    struct sr_rt*  table = (struct sr_rt*)calloc(nprefixes, sizeof(struct sr_rt));
+    uint32_t*      addrs = (uint32_t*)malloc(LPM_BENCH_LOOKUPS * sizeof(uint32_t));
+    struct sr_lpm* lpm;
+    unsigned int   i, nlist, mismatches = 0;
+    double         t0, build, t_lpm, t_list;
+    volatile uintptr_t sink = 0;
+
+    if(!table || !addrs)
+    {
+        fprintf(stderr, "lpm_bench: out of memory\n");
+        exit(1);
+    }
+
+    for(i = 0; i < nprefixes; i++)
+    {
+        int len = bench_prefix_len();
+        uint32_t mask = len ? 0xffffffffu << (32 - len) : 0;
+
+        table[i].dest.s_addr = htonl(bench_rand() & mask);
+        table[i].mask.s_addr = htonl(mask);
+        table[i].gw.s_addr   = htonl(0x0a000001 + (i & 0xff));
+        snprintf(table[i].interface, sr_IFACE_NAMELEN, "eth%u", i & 3);
+        table[i].next = (i + 1 < nprefixes) ? &table[i + 1] : 0;
+    }
+
+    /* half the lookups land inside a loaded prefix, half are random */
+    for(i = 0; i < LPM_BENCH_LOOKUPS; i++)
+    {
+        if(i & 1)
+        {
+            struct sr_rt* rt = &table[bench_rand() % nprefixes];
+            addrs[i] = rt->dest.s_addr | (htonl(bench_rand()) & ~rt->mask.s_addr);
+        }
+        else
+        { addrs[i] = bench_rand(); }
+    }
+
+    t0 = bench_now();
+    lpm = sr_lpm_build(table);
+    build = bench_now() - t0;
+    if(!lpm)
+    {
+        fprintf(stderr, "lpm_bench: sr_lpm_build failed\n");
+        exit(1);
+    }
+
+    t0 = bench_now();
+    for(i = 0; i < LPM_BENCH_LOOKUPS; i++)
+    { sink += (uintptr_t)sr_lpm_lookup(lpm, addrs[i]); }
+    t_lpm = (bench_now() - t0) / LPM_BENCH_LOOKUPS;
+
+    nlist = (unsigned int)(LIST_BENCH_VISITS / nprefixes);
+    if(nlist > LPM_BENCH_LOOKUPS) { nlist = LPM_BENCH_LOOKUPS; }
+    if(nlist < 100) { nlist = 100; }
+
+    t0 = bench_now();
+    for(i = 0; i < nlist; i++)
+    { sink += (uintptr_t)list_lookup(table, addrs[i]); }
+    t_list = (bench_now() - t0) / nlist;
+
+    for(i = 0; i < nlist; i++)
+    {
+        if(list_lookup(table, addrs[i]) != sr_lpm_lookup(lpm, addrs[i]))
+        { mismatches++; }
+    }
+
+    printf("%9u %10.1f %12.1f %14.1f %9u %9u\n",
+           nprefixes, build * 1e3, t_lpm * 1e9, t_list * 1e9,
+           lpm->nchunks, mismatches);
+
+    sr_lpm_destroy(lpm);
+    free(addrs);
+    free(table);
+}
+
+int main(int argc, char** argv)
+{
+    static const unsigned int sizes[] = { 10, 1000, 100000, 1000000 };
+    unsigned int i;
+
+    bench_rng = (argc > 1) ? strtoull(argv[1], 0, 0) : 0x5eed5eedULL;
+    if(bench_rng == 0)
+    { bench_rng = 1; }
+
+    printf("%9s %10s %12s %14s %9s %9s\n", "prefixes", "build(ms)",
+           "lpm(ns/op)", "list(ns/op)", "chunks", "mismatch");
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    { bench_run(sizes[i]); }
+
+    return 0;
+}
@@ -20,6 +20,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <signal.h>
 #include <sys/types.h>
 
 #ifdef _LINUX_
@@ -27,8 +28,13 @@
 #endif /* _LINUX_ */
 
 #include "sr_dumper.h"
+#include "sr_caplog.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_acl.h"
+#include "sr_pipeline.h"
+#include "sr_log.h"
+#include "sr_stats.h"
 
 extern char* optarg;
 
@@ -58,15 +64,21 @@ int main(int argc, char **argv)
     char *user = 0;
     char *server = DEFAULT_SERVER;
     char *rtable = DEFAULT_RTABLE;
+    char *acl = 0;
     char *template = NULL;
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
+    unsigned int arpcache_sz = 0;
+    int arpq_policy = SR_ARPQ_DROP_TAIL;
+    unsigned int nworkers = 0;
     char *logfile = 0;
+    int logfmt = SR_CAPLOG_PCAP;
+    char *statspath = 0;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:a:l:L:T:c:q:w:d:S:")) != EOF)
     {
         switch (c)
         {
@@ -92,12 +104,55 @@ int main(int argc, char **argv)
             case 'l':
                 logfile = optarg;
                 break;
+            case 'L':
+                if(strcmp(optarg, "pcap") == 0)
+                { logfmt = SR_CAPLOG_PCAP; }
+                else if(strcmp(optarg, "pcapng") == 0)
+                { logfmt = SR_CAPLOG_PCAPNG; }
+                else
+                {
+                    fprintf(stderr, "Log format must be pcap or pcapng\n");
+                    exit(1);
+                }
+                break;
             case 'r':
                 rtable = optarg;
                 break;
+            case 'a':
+                acl = optarg;
+                break;
             case 'T':
                 template = optarg;
                 break;
+            case 'c':
+                arpcache_sz = atoi((char *) optarg);
+                break;
+            case 'q':
+                if(strcmp(optarg, "tail") == 0)
+                { arpq_policy = SR_ARPQ_DROP_TAIL; }
+                else if(strcmp(optarg, "oldest") == 0)
+                { arpq_policy = SR_ARPQ_DROP_OLDEST; }
+                else
+                {
+                    fprintf(stderr, "ARP queue policy must be tail or oldest\n");
+                    exit(1);
+                }
+                break;
+            case 'w':
+                nworkers = atoi((char *) optarg);
+                if(nworkers > SR_PIPE_MAX_WORKERS)
+                {
+                    fprintf(stderr, "At most %d worker threads\n",
+                            SR_PIPE_MAX_WORKERS);
+                    exit(1);
+                }
+                break;
+            case 'd':
+                sr_log_set_rate(atoi((char *) optarg));
+                break;
+            case 'S':
+                statspath = optarg;
+                break;
         } /* switch */
     } /* -- while -- */
 
@@ -112,7 +167,17 @@ int main(int argc, char **argv)
     else
         strncpy(sr.template, template, 30);
 
+    /* -- access lists, bound to interfaces once the server names them -- */
+    if(acl != 0 && (sr.acl = sr_acl_load(acl)) == 0)
+    {
+        fprintf(stderr, "Error setting up access lists from file %s\n", acl);
+        exit(1);
+    }
+
     sr.topo_id = topo;
+    sr.arpcache_sz = arpcache_sz;
+    sr.arpq_policy = arpq_policy;
+    sr.nworkers = nworkers;
     strncpy(sr.host,host,32);
 
     if(! user )
@@ -123,8 +188,8 @@ int main(int argc, char **argv)
     /* -- set up file pointer for logging of raw packets -- */
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        sr.caplog = sr_caplog_open(logfile,logfmt,PACKET_DUMP_SIZE);
+        if(!sr.caplog)
         {
             fprintf(stderr,"Error opening up dump file %s\n",
                     logfile);
@@ -132,6 +197,9 @@ int main(int argc, char **argv)
         }
     }
 
+    /* -- kill -USR1 switches per packet debug output off and on -- */
+    signal(SIGUSR1, sr_log_toggle);
+
     Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
     if(template)
         Debug("Requesting topology template %s\n", template);
@@ -153,12 +221,37 @@ int main(int argc, char **argv)
       sr_load_rt_wrap(&sr, rtable);
     }
 
+    /* -- kill -HUP rereads the routing table without stopping forwarding -- */
+    if(sr_rt_watch(&sr, rtable) != 0)
+    {
+        fprintf(stderr, "Error starting routing table reloader\n");
+        return 1;
+    }
+
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
+    if(statspath && sr_stats_serve(&sr, statspath) != 0)
+    {
+        fprintf(stderr, "Error opening stats socket %s\n", statspath);
+        return 1;
+    }
+
+    /* -- hand packets to worker threads, this thread only reads -- */
+    if(sr.nworkers > 0 &&
+       (sr.pipe = sr_pipeline_start(&sr, sr.nworkers)) == 0)
+    {
+        fprintf(stderr, "Error starting forwarding pipeline\n");
+        return 1;
+    }
+
     /* -- whizbang main loop ;-) */
     while( sr_read_from_server(&sr) == 1);
 
+    sr_pipeline_stop(sr.pipe);
+    sr.pipe = 0;
+    sr_rt_unwatch();
+
     sr_destroy_instance(&sr);
 
     return 0;
@@ -174,8 +267,11 @@ static void usage(char* argv0)
     printf("Simple Router Client\n");
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
-    printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-t topo id] [-r routing table] [-a access lists] \n");
+    printf("           [-l log file] [-L pcap|pcapng] \n");
+    printf("           [-c arp cache entries] [-q arp queue full: tail|oldest] \n");
+    printf("           [-w worker threads] [-d debug lines/s, 0 off, -1 all] \n");
+    printf("           [-S stats socket] \n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -217,9 +313,20 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    if(sr->caplog)
     {
-        sr_dump_close(sr->logfile);
+        sr_caplog_close(sr->caplog);
+        sr->caplog = 0;
+    }
+
+    sr_acl_destroy(sr->acl);
+    sr->acl = 0;
+
+    if(sr->stats)
+    {
+        sr_stats_print(sr, stdout);
+        sr_stats_destroy(sr->stats);
+        sr->stats = 0;
     }
 
     /*
@@ -244,61 +351,24 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
-    sr->routing_table = 0;
-    sr->logfile = 0;
+    memset(&(sr->if_table), 0, sizeof(sr->if_table));
+    sr->fib = 0;
+    sr->rt_gen = 0;
+    sr->acl = 0;
+    sr->arpcache_sz = 0;
+    sr->arpq_policy = SR_ARPQ_DROP_TAIL;
+    sr->rx_buf = 0;
+    sr->rx_head = 0;
+    sr->rx_tail = 0;
+    pthread_mutex_init(&(sr->send_lock), 0);
+    sr->nworkers = 0;
+    sr->pipe = 0;
+    sr->send_hook = 0;
+    sr->send_hook_arg = 0;
+    sr->caplog = 0;
+    sr->stats = 0;
 } /* -- sr_init_instance -- */
 
-/*-----------------------------------------------------------------------------
- * Method: sr_verify_routing_table()
- * Scope: Global
- *
- * make sure the routing table is consistent with the interface list by
- * verifying that all interfaces used in the routing table actually exist
- * in the hardware.
- *
- * RETURN VALUES:
- *
- *  0 on success
- *  something other than zero on error
- *
- *---------------------------------------------------------------------------*/
-
-int sr_verify_routing_table(struct sr_instance* sr)
-{
-    struct sr_rt* rt_walker = 0;
-    struct sr_if* if_walker = 0;
-    int ret = 0;
-
-    /* -- REQUIRES --*/
-    assert(sr);
-
-    if( (sr->if_list == 0) || (sr->routing_table == 0))
-    {
-        return 999; /* doh! */
-    }
-
-    rt_walker = sr->routing_table;
-
-    while(rt_walker)
-    {
-        /* -- check to see if interface exists -- */
-        if_walker = sr->if_list;
-        while(if_walker)
-        {
-            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
-                    == 0)
-            { break; }
-            if_walker = if_walker->next;
-        }
-        if(if_walker == 0)
-        { ret++; } /* -- interface not found! -- */
-
-        rt_walker = rt_walker->next;
-    } /* -- while -- */
-
-    return ret;
-} /* -- sr_verify_routing_table -- */
-
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     if(sr_load_rt(sr, rtable) != 0) {
         fprintf(stderr,"Error setting up routing table from file %s\n",
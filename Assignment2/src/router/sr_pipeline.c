@@ -0,0 +1,529 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pipeline.c
+ *
+ * Description:
+ *
+ * Reader -> workers -> writer forwarding pipeline, see sr_pipeline.h.
+ *
+ * Idle threads spin briefly and then park on a condition variable.  A
+ * producer only takes the consumer's mutex when the consumer has said it
+ * is parked; both sides put a full fence between publishing their own
+ * flag (tail or sleeping) and reading the other's, so a wakeup is never
+ * lost.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_pipeline.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "vnscommand.h"
+
+#define SR_PIPE_SPIN 64     /* sched_yield rounds before parking */
+
+/* one frame in a ring; on tx the VNS header is filled in so that header
+   and frame go out as one contiguous iovec */
+struct sr_pipe_slot
+{
+    unsigned int    len;
+    struct sr_if*   iface;          /* rx: interface the frame came in on */
+    c_packet_header hdr;
+    uint8_t         frame[SR_FRAME_BLOCK];
+};
+
+static __thread struct sr_pipe_worker* sr_pipe_self = 0;
+
+/*---------------------------------------------------------------------
+ * SPSC ring.  head is only written by the consumer and tail only by
+ * the producer; each side reads the other's index with acquire and
+ * publishes its own with release.
+ *---------------------------------------------------------------------*/
+
+static int sr_ring_init(struct sr_ring* r, unsigned int nslots, size_t slot_sz)
+{
+    assert((nslots & (nslots - 1)) == 0);
+
+    memset(r, 0, sizeof(struct sr_ring));
+    r->slot_sz = (slot_sz + 63) & ~(size_t)63;
+    r->mask    = nslots - 1;
+    r->slots   = (uint8_t*)malloc(r->slot_sz * nslots);
+    return r->slots ? 0 : -1;
+}
+
+static void sr_ring_free(struct sr_ring* r)
+{
+    free(r->slots);
+    r->slots = 0;
+}
+
+static void* sr_ring_reserve(struct sr_ring* r)
+{
+    unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+    if(r->tail - head > r->mask)
+    { return 0; }
+    return r->slots + (size_t)(r->tail & r->mask) * r->slot_sz;
+}
+
+static void sr_ring_commit(struct sr_ring* r)
+{
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+static unsigned int sr_ring_count(struct sr_ring* r)
+{
+    return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) - r->head;
+}
+
+static void* sr_ring_peek(struct sr_ring* r, unsigned int i)
+{
+    return r->slots + (size_t)((r->head + i) & r->mask) * r->slot_sz;
+}
+
+static void sr_ring_release(struct sr_ring* r, unsigned int n)
+{
+    __atomic_store_n(&r->head, r->head + n, __ATOMIC_RELEASE);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipe_wake(..)
+ * Scope: Local
+ *
+ * Called by a producer after it committed to a ring.  Signals the
+ * consumer only if it is parked.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_pipe_wake(int* sleeping, pthread_mutex_t* lock, pthread_cond_t* cond)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(sleeping, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_lock(lock);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(lock);
+    }
+} /* -- sr_pipe_wake -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipe_flow_hash(..)
+ * Scope: Local
+ *
+ * Hash the flow a frame belongs to.  Ports are only used when the
+ * datagram is not a fragment, since later fragments carry none and must
+ * land on the same worker as the first.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint32_t sr_pipe_flow_hash(const uint8_t* frame, unsigned int len)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)frame;
+    uint32_t h = 0;
+
+    if(len < sizeof(sr_ethernet_hdr_t))
+    { return 0; }
+
+    if(eth->ether_type == htons(ethertype_ip) &&
+       len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+    {
+        const sr_ip_hdr_t* ip = (const sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        unsigned int hl = ip->ip_hl * 4;
+
+        h = ip->ip_src ^ (ip->ip_dst * 0x85ebca6bu) ^ ip->ip_p;
+        if((ip->ip_p == 6 || ip->ip_p == 17) &&
+           (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)) == 0 &&
+           len >= sizeof(sr_ethernet_hdr_t) + hl + 4)
+        {
+            uint32_t ports;
+            memcpy(&ports, frame + sizeof(sr_ethernet_hdr_t) + hl, sizeof(ports));
+            h ^= ports * 0xc2b2ae35u;
+        }
+    }
+    else if(eth->ether_type == htons(ethertype_arp) &&
+            len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+    {
+        const sr_arp_hdr_t* arp = (const sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        h = arp->ar_sip ^ arp->ar_tip;
+    }
+
+    h *= 0x9e3779b1u;
+    return h ^ (h >> 16);
+} /* -- sr_pipe_flow_hash -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipe_worker_main(..)
+ * Scope: Local
+ *
+ * Worker thread: run sr_handlepacket_burst on the frames of the rx ring,
+ * in place.  Exits once stop is set and the ring is drained.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_pipe_worker_main(void* arg)
+{
+    struct sr_pipe_worker* w = (struct sr_pipe_worker*)arg;
+    struct sr_pipeline* pipe = w->pipe;
+    unsigned int idle = 0;
+
+    sr_pipe_self = w;
+
+    for(;;)
+    {
+        unsigned int n = sr_ring_count(&w->rx);
+
+        if(n == 0)
+        {
+            if(__atomic_load_n(&pipe->stop, __ATOMIC_ACQUIRE))
+            { break; }
+            if(++idle < SR_PIPE_SPIN)
+            {
+                sched_yield();
+                continue;
+            }
+
+            pthread_mutex_lock(&w->lock);
+            __atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            while(sr_ring_count(&w->rx) == 0 &&
+                  !__atomic_load_n(&pipe->stop, __ATOMIC_ACQUIRE))
+            { pthread_cond_wait(&w->cond, &w->lock); }
+            __atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&w->lock);
+
+            idle = 0;
+            continue;
+        }
+
+        idle = 0;
+        while(n > 0)
+        {
+            struct sr_frame burst[SR_BURST_MAX];
+            unsigned int k = (n < SR_BURST_MAX) ? n : SR_BURST_MAX;
+            unsigned int i;
+
+            /* -- slots stay put until released, so they are lent in place -- */
+            for(i = 0; i < k; i++)
+            {
+                struct sr_pipe_slot* slot = (struct sr_pipe_slot*)sr_ring_peek(&w->rx, i);
+
+                burst[i].buf   = slot->frame;
+                burst[i].len   = slot->len;
+                burst[i].iface = slot->iface;
+            }
+            sr_handlepacket_burst(pipe->sr, burst, k);
+            sr_ring_release(&w->rx, k);
+            w->rx_packets += k;
+            n -= k;
+        }
+    }
+
+    return 0;
+} /* -- sr_pipe_worker_main -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipe_writer_main(..)
+ * Scope: Local
+ *
+ * Writer thread: gather up to SR_PIPE_TX_BATCH frames from every tx ring
+ * into one writev.  Exits once writer_stop is set and all rings are empty;
+ * the workers have been joined by then.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pipe_tx_pending(struct sr_pipeline* pipe)
+{
+    unsigned int i;
+
+    for(i = 0; i < pipe->nworkers; i++)
+    {
+        if(sr_ring_count(&pipe->workers[i].tx))
+        { return 1; }
+    }
+    return 0;
+}
+
+static void* sr_pipe_writer_main(void* arg)
+{
+    struct sr_pipeline* pipe = (struct sr_pipeline*)arg;
+    struct iovec  iov[SR_PIPE_MAX_WORKERS * SR_PIPE_TX_BATCH];
+    unsigned int  taken[SR_PIPE_MAX_WORKERS];
+    unsigned int  idle = 0;
+
+    for(;;)
+    {
+        unsigned int i, j, n = 0;
+
+        for(i = 0; i < pipe->nworkers; i++)
+        {
+            struct sr_ring* tx = &pipe->workers[i].tx;
+            unsigned int c = sr_ring_count(tx);
+
+            if(c > SR_PIPE_TX_BATCH)
+            { c = SR_PIPE_TX_BATCH; }
+            for(j = 0; j < c; j++)
+            {
+                struct sr_pipe_slot* slot = (struct sr_pipe_slot*)sr_ring_peek(tx, j);
+                iov[n].iov_base = &slot->hdr;
+                iov[n].iov_len  = sizeof(c_packet_header) + slot->len;
+                n++;
+            }
+            taken[i] = c;
+        }
+
+        if(n)
+        {
+            if(sr_send_frames(pipe->sr, iov, n) != 0)
+            { fprintf(stderr, "Error writing packet batch\n"); }
+            pipe->tx_writes++;
+            for(i = 0; i < pipe->nworkers; i++)
+            {
+                if(taken[i])
+                { sr_ring_release(&pipe->workers[i].tx, taken[i]); }
+            }
+            idle = 0;
+            continue;
+        }
+
+        if(__atomic_load_n(&pipe->writer_stop, __ATOMIC_ACQUIRE))
+        { break; }
+        if(++idle < SR_PIPE_SPIN)
+        {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&pipe->writer_lock);
+        __atomic_store_n(&pipe->writer_sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while(!sr_pipe_tx_pending(pipe) &&
+              !__atomic_load_n(&pipe->writer_stop, __ATOMIC_ACQUIRE))
+        { pthread_cond_wait(&pipe->writer_cond, &pipe->writer_lock); }
+        __atomic_store_n(&pipe->writer_sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&pipe->writer_lock);
+
+        idle = 0;
+    }
+
+    return 0;
+} /* -- sr_pipe_writer_main -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_start(..)
+ * Scope: Global
+ *
+ * Start nworkers workers and the writer.  Must be called before any
+ * packet arrives; interface and routing state is read by the workers
+ * without locks.  Returns NULL on failure.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_pipeline* sr_pipeline_start(struct sr_instance* sr, unsigned int nworkers)
+{
+    struct sr_pipeline* pipe;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(nworkers > 0 && nworkers <= SR_PIPE_MAX_WORKERS);
+
+    if((pipe = (struct sr_pipeline*)calloc(1, sizeof(struct sr_pipeline))) == 0)
+    { return 0; }
+    pipe->sr = sr;
+    pipe->workers = (struct sr_pipe_worker*)calloc(nworkers, sizeof(struct sr_pipe_worker));
+    if(!pipe->workers)
+    {
+        free(pipe);
+        return 0;
+    }
+
+    for(i = 0; i < nworkers; i++)
+    {
+        struct sr_pipe_worker* w = &pipe->workers[i];
+
+        w->pipe = pipe;
+        w->id   = i;
+        pthread_mutex_init(&w->lock, 0);
+        pthread_cond_init(&w->cond, 0);
+        if(sr_ring_init(&w->rx, SR_PIPE_RING_SZ, sizeof(struct sr_pipe_slot)) != 0 ||
+           sr_ring_init(&w->tx, SR_PIPE_RING_SZ, sizeof(struct sr_pipe_slot)) != 0)
+        {
+            fprintf(stderr, "Failed to allocate pipeline rings\n");
+            pipe->nworkers = i + 1;
+            sr_ring_free(&w->rx);
+            sr_pipeline_stop(pipe);
+            return 0;
+        }
+        pipe->nworkers = i + 1;
+        if(pthread_create(&w->thread, 0, sr_pipe_worker_main, w) != 0)
+        {
+            perror("pthread_create(..):sr_pipeline_start");
+            w->thread = 0;
+            sr_pipeline_stop(pipe);
+            return 0;
+        }
+    }
+
+    pthread_mutex_init(&pipe->writer_lock, 0);
+    pthread_cond_init(&pipe->writer_cond, 0);
+    if(pthread_create(&pipe->writer, 0, sr_pipe_writer_main, pipe) != 0)
+    {
+        perror("pthread_create(..):sr_pipeline_start");
+        pipe->writer = 0;
+        sr_pipeline_stop(pipe);
+        return 0;
+    }
+
+    return pipe;
+} /* -- sr_pipeline_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_stop(..)
+ * Scope: Global
+ *
+ * Drain every ring, join all threads, print counters and free the
+ * pipeline.  The reader must not call sr_pipeline_rx any more.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pipeline_stop(struct sr_pipeline* pipe)
+{
+    unsigned int i;
+
+    if(!pipe)
+    { return; }
+
+    __atomic_store_n(&pipe->stop, 1, __ATOMIC_SEQ_CST);
+    for(i = 0; i < pipe->nworkers; i++)
+    {
+        struct sr_pipe_worker* w = &pipe->workers[i];
+
+        if(!w->thread)
+        { continue; }
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, 0);
+    }
+
+    if(pipe->writer)
+    {
+        __atomic_store_n(&pipe->writer_stop, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&pipe->writer_lock);
+        pthread_cond_signal(&pipe->writer_cond);
+        pthread_mutex_unlock(&pipe->writer_lock);
+        pthread_join(pipe->writer, 0);
+    }
+
+    for(i = 0; i < pipe->nworkers; i++)
+    {
+        struct sr_pipe_worker* w = &pipe->workers[i];
+
+        printf("worker %u: rx %lu stalls %lu tx %lu direct %lu\n", w->id,
+               w->rx_packets, w->rx_stalls, w->tx_packets, w->tx_direct);
+        sr_ring_free(&w->rx);
+        sr_ring_free(&w->tx);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+    }
+    printf("pipeline: oversize %lu writev %lu\n", pipe->rx_oversize, pipe->tx_writes);
+
+    free(pipe->workers);
+    free(pipe);
+} /* -- sr_pipeline_stop -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_rx(..)
+ * Scope: Global
+ *
+ * Reader side: copy a received frame into its flow's worker ring,
+ * waiting for room if the worker is behind.  Returns 0 if queued, -1 if
+ * the frame was dropped for being larger than a slot.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pipeline_rx(struct sr_pipeline* pipe, const uint8_t* frame,
+                   unsigned int len, struct sr_if* iface)
+{
+    struct sr_pipe_worker* w;
+    struct sr_pipe_slot* slot;
+
+    if(len > SR_FRAME_BLOCK)
+    {
+        pipe->rx_oversize++;
+        return -1;
+    }
+
+    /* a full ring stalls the reader, which leaves the bytes in the socket
+       and lets TCP push back on the server, just as the serial loop did */
+    w = &pipe->workers[((uint64_t)sr_pipe_flow_hash(frame, len) * pipe->nworkers) >> 32];
+    if((slot = (struct sr_pipe_slot*)sr_ring_reserve(&w->rx)) == 0)
+    {
+        w->rx_stalls++;
+        do
+        {
+            sr_pipe_wake(&w->sleeping, &w->lock, &w->cond);
+            sched_yield();
+        } while((slot = (struct sr_pipe_slot*)sr_ring_reserve(&w->rx)) == 0);
+    }
+
+    memcpy(slot->frame, frame, len);
+    slot->len = len;
+    slot->iface = iface;
+    sr_ring_commit(&w->rx);
+
+    sr_pipe_wake(&w->sleeping, &w->lock, &w->cond);
+    return 0;
+} /* -- sr_pipeline_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_tx(..)
+ * Scope: Global
+ *
+ * Worker side of sr_send_packet: queue a frame for the writer, waiting
+ * for room if the writer is behind.  Returns -1 if the caller is not a
+ * worker or the frame does not fit a slot; the caller then sends the
+ * frame itself.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pipeline_tx(struct sr_pipeline* pipe, const uint8_t* frame,
+                   unsigned int len, const struct sr_if* iface)
+{
+    struct sr_pipe_worker* w = sr_pipe_self;
+    struct sr_pipe_slot* slot;
+
+    if(!w || w->pipe != pipe)
+    { return -1; }
+    if(len > SR_FRAME_BLOCK)
+    {
+        w->tx_direct++;
+        return -1;
+    }
+
+    while((slot = (struct sr_pipe_slot*)sr_ring_reserve(&w->tx)) == 0)
+    {
+        sr_pipe_wake(&pipe->writer_sleeping, &pipe->writer_lock, &pipe->writer_cond);
+        sched_yield();
+    }
+
+    slot->hdr.mLen  = htonl(len + sizeof(c_packet_header));
+    slot->hdr.mType = htonl(VNSPACKET);
+    copy_ifname(slot->hdr.mInterfaceName, sizeof(slot->hdr.mInterfaceName), iface->name);
+    memcpy(slot->frame, frame, len);
+    slot->len = len;
+    sr_ring_commit(&w->tx);
+    w->tx_packets++;
+
+    sr_pipe_wake(&pipe->writer_sleeping, &pipe->writer_lock, &pipe->writer_cond);
+    return 0;
+} /* -- sr_pipeline_tx -- */
@@ -0,0 +1,94 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pipeline.h
+ *
+ * Description:
+ *
+ * Multi-threaded forwarding pipeline (sr -w N).
+ *
+ * The main thread stays the reader: it decodes VNS commands as before but
+ * hands each frame to one of N worker threads instead of calling
+ * sr_handlepacket itself.  The worker is picked by a hash of the flow
+ * (addresses, plus ports for unfragmented TCP/UDP) so packets of one flow
+ * are always handled by the same worker, in arrival order.
+ *
+ * Every worker owns two single-producer/single-consumer rings: rx from the
+ * reader and tx to the writer thread.  Ring slots hold a whole frame, so a
+ * frame is copied once into the rx slot, handled in place, and a frame the
+ * worker sends is copied once into a tx slot right behind its VNS header.
+ * The writer gathers the tx slots of all workers into a single writev.
+ *
+ * Threads that are not workers (sr_arpcache_timeout, which runs the ARP
+ * cache's timer wheel) keep sending directly; sr_instance.send_lock keeps
+ * their writes whole.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PIPELINE_H
+#define SR_PIPELINE_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_PIPE_RING_SZ     1024    /* slots per ring, power of 2 */
+#define SR_PIPE_MAX_WORKERS 16
+#define SR_PIPE_TX_BATCH    64      /* frames taken from one tx ring per writev */
+
+struct sr_instance;
+struct sr_if;
+
+/* single-producer/single-consumer ring of fixed size slots */
+struct sr_ring
+{
+    unsigned int head __attribute__((aligned(64)));  /* consumer side */
+    unsigned int tail __attribute__((aligned(64)));  /* producer side */
+    unsigned int mask __attribute__((aligned(64)));
+    size_t       slot_sz;
+    uint8_t*     slots;
+};
+
+struct sr_pipe_worker
+{
+    struct sr_pipeline* pipe;
+    unsigned int    id;
+    pthread_t       thread;
+    struct sr_ring  rx;             /* reader -> worker */
+    struct sr_ring  tx;             /* worker -> writer */
+    int             sleeping;       /* parked on cond, reader must signal */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    unsigned long   rx_packets;
+    unsigned long   rx_stalls;      /* reader found the rx ring full */
+    unsigned long   tx_packets;
+    unsigned long   tx_direct;      /* too big for a slot, sent directly */
+};
+
+struct sr_pipeline
+{
+    struct sr_instance*    sr;
+    unsigned int           nworkers;
+    struct sr_pipe_worker* workers;
+    int                    stop;            /* workers: drain and exit */
+    pthread_t              writer;
+    int                    writer_stop;     /* writer: drain and exit */
+    int                    writer_sleeping;
+    pthread_mutex_t        writer_lock;
+    pthread_cond_t         writer_cond;
+    unsigned long          rx_oversize;     /* frames too big for a slot */
+    unsigned long          tx_writes;       /* writev calls by the writer */
+};
+
+struct sr_pipeline* sr_pipeline_start(struct sr_instance* sr, unsigned int nworkers);
+void sr_pipeline_stop(struct sr_pipeline* pipe);
+int  sr_pipeline_rx(struct sr_pipeline* pipe, const uint8_t* frame,
+                    unsigned int len, struct sr_if* iface);
+int  sr_pipeline_tx(struct sr_pipeline* pipe, const uint8_t* frame,
+                    unsigned int len, const struct sr_if* iface);
+
+#endif /* -- SR_PIPELINE_H -- */
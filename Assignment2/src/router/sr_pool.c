@@ -0,0 +1,113 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pool.c
+ *
+ * Description:
+ *
+ * Fixed size block pool, see sr_pool.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sr_pool.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_pool_init(..)
+ * Scope: Global
+ *
+ * Allocate nblocks blocks of block_sz bytes.  Returns 0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pool_init(struct sr_pool* pool, size_t block_sz, unsigned int nblocks)
+{
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(pool);
+
+    memset(pool, 0, sizeof(struct sr_pool));
+
+    /* keep every block suitably aligned for any header we overlay on it */
+    block_sz = (block_sz + 15) & ~(size_t)15;
+
+    pool->slab       = (uint8_t*)malloc(block_sz * nblocks);
+    pool->free_stack = (void**)malloc(nblocks * sizeof(void*));
+    if((nblocks && !pool->slab) || (nblocks && !pool->free_stack))
+    {
+        free(pool->slab);
+        free(pool->free_stack);
+        return -1;
+    }
+
+    pool->block_sz = block_sz;
+    pool->nblocks  = nblocks;
+    for(i = 0; i < nblocks; i++)
+    {
+        pool->free_stack[i] = pool->slab + (size_t)(nblocks - 1 - i) * block_sz;
+    }
+    pool->nfree = nblocks;
+
+    return pthread_mutex_init(&(pool->lock), 0);
+} /* -- sr_pool_init -- */
+
+void sr_pool_destroy(struct sr_pool* pool)
+{
+    /* -- REQUIRES -- */
+    assert(pool);
+
+    free(pool->slab);
+    free(pool->free_stack);
+    pthread_mutex_destroy(&(pool->lock));
+    memset(pool, 0, sizeof(struct sr_pool));
+} /* -- sr_pool_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pool_get(..)
+ * Scope: Global
+ *
+ * Return a block of at least len bytes, or NULL if even the malloc
+ * fallback fails.  Release it with sr_pool_put.
+ *
+ *---------------------------------------------------------------------*/
+
+void* sr_pool_get(struct sr_pool* pool, size_t len)
+{
+    void* block = 0;
+
+    if(len <= pool->block_sz)
+    {
+        pthread_mutex_lock(&(pool->lock));
+        if(pool->nfree)
+        { block = pool->free_stack[--pool->nfree]; }
+        else
+        { pool->fallbacks++; }
+        pthread_mutex_unlock(&(pool->lock));
+    }
+
+    if(!block)
+    { block = malloc(len); }
+
+    return block;
+} /* -- sr_pool_get -- */
+
+void sr_pool_put(struct sr_pool* pool, void* block)
+{
+    uint8_t* p = (uint8_t*)block;
+
+    if(!p)
+    { return; }
+
+    if(p < pool->slab || p >= pool->slab + pool->block_sz * pool->nblocks)
+    {
+        free(p);
+        return;
+    }
+
+    pthread_mutex_lock(&(pool->lock));
+    assert(pool->nfree < pool->nblocks);
+    pool->free_stack[pool->nfree++] = p;
+    pthread_mutex_unlock(&(pool->lock));
+} /* -- sr_pool_put -- */
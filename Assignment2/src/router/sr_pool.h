@@ -0,0 +1,44 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pool.h
+ *
+ * Description:
+ *
+ * Fixed size block pool.  All blocks are carved out of one slab at init
+ * time and handed out from a free stack, so steady state get/put never
+ * touches malloc.  A request larger than the block size, or one made while
+ * the pool is empty, falls back to malloc; sr_pool_put tells the two apart
+ * by address and frees the fallback blocks.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_POOL_H
+#define SR_POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_pool
+{
+    uint8_t*        slab;
+    size_t          block_sz;
+    unsigned int    nblocks;
+    void**          free_stack;
+    unsigned int    nfree;
+    unsigned long   fallbacks;  /* gets served by malloc */
+    pthread_mutex_t lock;
+};
+
+int   sr_pool_init(struct sr_pool* pool, size_t block_sz, unsigned int nblocks);
+void  sr_pool_destroy(struct sr_pool* pool);
+void* sr_pool_get(struct sr_pool* pool, size_t len);
+void  sr_pool_put(struct sr_pool* pool, void* block);
+
+#endif /* -- SR_POOL_H -- */
@@ -0,0 +1,608 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_replay.c
+ *
+ * Description:
+ *
+ * Offline driver for the router: no VNS server, no POX, no Mininet.
+ * Interfaces come from a small config file, routes from an rtable via
+ * sr_load_rt, and frames from a pcap file (for instance one written by
+ * sr -l) are fed straight into sr_handlepacket.  Everything the router
+ * sends goes through sr_instance.send_hook into an output pcap instead
+ * of the server socket.  At the end it reports packets/s and the
+ * distribution of sr_handlepacket latency.
+ *
+ * Usage: sr_replay -i topo [-r rtable] [-a acl] [-o out.pcap] [-n loops]
+ *                  [-c arp cache entries] [-q tail|oldest] [-v] in.pcap
+ *
+ * topo holds one directive per line, '#' starts a comment (see
+ * topo.conf):
+ *
+ *   iface eth1 02:00:00:00:00:01 192.168.2.1
+ *   arp   192.168.2.2 0b:0b:0b:0b:0b:01
+ *
+ * iface lines add interfaces in order, arp lines preload the ARP cache
+ * (the entries still expire SR_ARPCACHE_TO seconds later).  host lines
+ * are for vns_emu and are skipped.
+ *
+ * pcap does not record the interface a frame arrived on, so it is
+ * inferred: the interface owning the destination MAC, else the one
+ * owning the target of an ARP packet, else the one the route back to
+ * the IP source leaves through, else the first interface.
+ *
+ * The frame is copied into a scratch buffer before each call, outside
+ * the timed region, since the router rewrites frames in place.  With -o
+ * the pcap writes are part of the measured time.  Router chatter is
+ * discarded unless -v is given: stdout throughout, stderr while frames
+ * are replayed (errors before that still show).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_dumper.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_acl.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_arpcache.h"
+#include "sr_epoch.h"
+
+#define DEFAULT_RTABLE "rtable"
+#define REPLAY_SNAPLEN 65535
+
+#define PCAP_MAGIC_NSEC 0xa1b23c4d  /* nanosecond timestamps, same layout */
+
+struct replay_frame
+{
+    const uint8_t* data;
+    unsigned int   len;
+    struct sr_if*  iface;
+};
+
+struct replay_out
+{
+    FILE*         fp;       /* captured output, 0 to only count */
+    unsigned long frames;
+    unsigned long bytes;
+};
+
+static void usage(char* argv0)
+{
+    printf("Offline replay for sr\n");
+    printf("Format: %s -i topo [-r rtable] [-a acl] [-o out.pcap] [-n loops]\n", argv0);
+    printf("           [-c arp cache entries] [-q tail|oldest] [-v] in.pcap\n");
+    printf("   defaults rtable=%s loops=1\n", DEFAULT_RTABLE);
+} /* -- usage -- */
+
+static int replay_parse_mac(const char* s, unsigned char* mac)
+{
+    unsigned int b[ETHER_ADDR_LEN];
+    int i;
+
+    if(sscanf(s, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+    { return -1; }
+    for(i = 0; i < ETHER_ADDR_LEN; i++)
+    {
+        if(b[i] > 0xff)
+        { return -1; }
+        mac[i] = (unsigned char)b[i];
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: replay_load_topo(..)
+ * Scope: Local
+ *
+ * Add the interfaces of a topology file to sr.  arp directives are
+ * returned through arp_ips/arp_macs (up to max) since the ARP cache only
+ * exists after sr_init.  Returns the number of arp directives, -1 on
+ * error.
+ *
+ *---------------------------------------------------------------------*/
+
+static int replay_load_topo(struct sr_instance* sr, const char* filename,
+                                uint32_t* arp_ips, unsigned char (*arp_macs)[ETHER_ADDR_LEN],
+                                int max)
+{
+    FILE* fp;
+    char  line[BUFSIZ];
+    char  kw[32], a[64], b[64], c[64];
+    unsigned int lineno = 0;
+    int narp = 0;
+
+    if((fp = fopen(filename, "r")) == 0)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    while(fgets(line, BUFSIZ, fp) != 0)
+    {
+        char* hash = strchr(line, '#');
+        struct in_addr ip;
+        unsigned char mac[ETHER_ADDR_LEN];
+        int n;
+
+        lineno++;
+        if(hash)
+        { *hash = '\0'; }
+
+        n = sscanf(line, "%31s %63s %63s %63s", kw, a, b, c);
+        if(n <= 0)
+        { continue; }
+
+        if(strcmp(kw, "iface") == 0 && n == 4 &&
+           replay_parse_mac(b, mac) == 0 && inet_aton(c, &ip) != 0)
+        {
+            sr_add_interface(sr, a);
+            sr_set_ether_addr(sr, mac);
+            sr_set_ether_ip(sr, ip.s_addr);
+        }
+        else if(strcmp(kw, "arp") == 0 && n == 3 &&
+                inet_aton(a, &ip) != 0 && replay_parse_mac(b, mac) == 0)
+        {
+            if(narp == max)
+            {
+                fprintf(stderr, "%s:%u: more than %d arp entries\n", filename, lineno, max);
+                fclose(fp);
+                return -1;
+            }
+            arp_ips[narp] = ip.s_addr;
+            memcpy(arp_macs[narp], mac, ETHER_ADDR_LEN);
+            narp++;
+        }
+        else if(strcmp(kw, "host") != 0)
+        {
+            fprintf(stderr, "%s:%u: cannot parse: %s", filename, lineno, line);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+
+    if(sr->if_list == 0)
+    {
+        fprintf(stderr, "%s: no interfaces\n", filename);
+        return -1;
+    }
+    if(sr_if_table_build(sr) != 0)
+    { return -1; }
+    return narp;
+} /* -- replay_load_topo -- */
+
+/*---------------------------------------------------------------------
+ * Method: replay_in_iface(..)
+ * Scope: Local
+ *
+ * Best guess at the interface a captured frame arrived on.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_if* replay_in_iface(struct sr_instance* sr, const uint8_t* frame,
+                                     unsigned int len)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)frame;
+    struct sr_if* iface;
+
+    if(len < sizeof(sr_ethernet_hdr_t))
+    { return sr->if_list; }
+
+    for(iface = sr->if_list; iface; iface = iface->next)
+    {
+        if(memcmp(iface->addr, eth->ether_dhost, ETHER_ADDR_LEN) == 0)
+        { return iface; }
+    }
+
+    if(ntohs(eth->ether_type) == ethertype_arp &&
+       len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+    {
+        const sr_arp_hdr_t* arp = (const sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        if((iface = get_interface_from_ip(sr, arp->ar_tip)) != 0)
+        { return iface; }
+    }
+    else if(ntohs(eth->ether_type) == ethertype_ip &&
+            len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+    {
+        const sr_ip_hdr_t* ip = (const sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        struct sr_rt* rt;
+
+        sr_epoch_enter();
+        rt = sr_lookup_route(sr, ip->ip_src);
+        iface = rt ? sr_get_interface(sr, rt->interface) : 0;
+        sr_epoch_exit();
+        if(iface)
+        { return iface; }
+    }
+
+    return sr->if_list;
+} /* -- replay_in_iface -- */
+
+/*---------------------------------------------------------------------
+ * Method: replay_load_pcap(..)
+ * Scope: Local
+ *
+ * Read a whole pcap file into memory and index its frames, so no file
+ * I/O happens while the router is being timed.  Either byte order is
+ * accepted.  Returns the number of frames, -1 on error; *image must be
+ * freed by the caller.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint32_t replay_swap32(uint32_t x, int swap)
+{
+    if(!swap)
+    { return x; }
+    return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+static int replay_load_pcap(struct sr_instance* sr, const char* filename,
+                            uint8_t** image, struct replay_frame** frames)
+{
+    FILE* fp;
+    long  size;
+    size_t off;
+    struct pcap_file_header fh;
+    int swap, n = 0, cap = 1024;
+
+    *image  = 0;
+    *frames = 0;
+
+    if((fp = fopen(filename, "rb")) == 0)
+    {
+        perror(filename);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if(size < (long)sizeof(fh) ||
+       (*image = (uint8_t*)malloc(size)) == 0 ||
+       fread(*image, 1, size, fp) != (size_t)size)
+    {
+        fprintf(stderr, "%s: cannot read pcap file\n", filename);
+        fclose(fp);
+        free(*image);
+        *image = 0;
+        return -1;
+    }
+    fclose(fp);
+
+    memcpy(&fh, *image, sizeof(fh));
+    if(fh.magic == TCPDUMP_MAGIC || fh.magic == PCAP_MAGIC_NSEC)
+    { swap = 0; }
+    else if(replay_swap32(fh.magic, 1) == TCPDUMP_MAGIC ||
+            replay_swap32(fh.magic, 1) == PCAP_MAGIC_NSEC)
+    { swap = 1; }
+    else
+    {
+        fprintf(stderr, "%s: not a pcap file\n", filename);
+        return -1;
+    }
+    if(replay_swap32(fh.linktype, swap) != LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "%s: link type %u is not ethernet\n", filename,
+                replay_swap32(fh.linktype, swap));
+        return -1;
+    }
+
+    *frames = (struct replay_frame*)malloc(cap * sizeof(struct replay_frame));
+    assert(*frames);
+
+    off = sizeof(fh);
+    while(off + sizeof(struct pcap_sf_pkthdr) <= (size_t)size)
+    {
+        struct pcap_sf_pkthdr ph;
+        unsigned int caplen;
+
+        memcpy(&ph, *image + off, sizeof(ph));
+        off += sizeof(ph);
+        caplen = replay_swap32(ph.caplen, swap);
+        if(off + caplen > (size_t)size)
+        {
+            fprintf(stderr, "%s: truncated after %d frames\n", filename, n);
+            break;
+        }
+        if(caplen > REPLAY_SNAPLEN)
+        {
+            off += caplen;
+            continue;
+        }
+
+        if(n == cap)
+        {
+            cap *= 2;
+            *frames = (struct replay_frame*)realloc(*frames, cap * sizeof(struct replay_frame));
+            assert(*frames);
+        }
+        (*frames)[n].data  = *image + off;
+        (*frames)[n].len   = caplen;
+        (*frames)[n].iface = replay_in_iface(sr, *image + off, caplen);
+        n++;
+        off += caplen;
+    }
+
+    return n;
+} /* -- replay_load_pcap -- */
+
+/*---------------------------------------------------------------------
+ * Method: replay_send_hook(..)
+ * Scope: Local
+ *
+ * sr_send_packet lands here instead of on the server socket.
+ *
+ *---------------------------------------------------------------------*/
+
+static int replay_send_hook(struct sr_instance* sr, const uint8_t* buf,
+                            unsigned int len, const char* iface, void* arg)
+{
+    struct replay_out* out = (struct replay_out*)arg;
+
+    out->frames++;
+    out->bytes += len;
+
+    if(out->fp)
+    {
+        struct pcap_pkthdr h;
+
+        gettimeofday(&h.ts, 0);
+        h.caplen = len;
+        h.len    = len;
+        sr_dump(out->fp, &h, buf);
+    }
+    return 0;
+} /* -- replay_send_hook -- */
+
+/* Point fd at /dev/null, returning a dup of the old fd to restore it. */
+static int replay_mute(int fd)
+{
+    int devnull = open("/dev/null", O_WRONLY);
+    int saved = dup(fd);
+
+    if(devnull >= 0)
+    {
+        dup2(devnull, fd);
+        close(devnull);
+    }
+    return saved;
+}
+
+static void replay_unmute(int fd, int saved)
+{
+    if(saved >= 0)
+    {
+        dup2(saved, fd);
+        close(saved);
+    }
+}
+
+static uint64_t replay_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int replay_cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t replay_pct(const uint32_t* sorted, unsigned long n, double p)
+{
+    unsigned long i = (unsigned long)(p / 100.0 * n);
+    return sorted[i < n ? i : n - 1];
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    char* topo = 0;
+    char* rtable = DEFAULT_RTABLE;
+    char* acl = 0;
+    char* outfile = 0;
+    unsigned int loops = 1;
+    unsigned int arpcache_sz = 0;
+    int arpq_policy = SR_ARPQ_DROP_TAIL;
+    int verbose = 0;
+    int stdout_fd = -1, stderr_fd = -1;
+    struct sr_instance sr;
+    struct replay_out out;
+    uint32_t arp_ips[SR_ARPCACHE_SZ];
+    unsigned char arp_macs[SR_ARPCACHE_SZ][ETHER_ADDR_LEN];
+    int narp, nframes, i;
+    uint8_t* image;
+    struct replay_frame* frames;
+    uint8_t* scratch;
+    uint32_t* lat;
+    unsigned long n, k;
+    unsigned int loop;
+    uint64_t busy = 0, wall;
+
+    while((c = getopt(argc, argv, "hi:r:a:o:n:c:q:v")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'i':
+                topo = optarg;
+                break;
+            case 'r':
+                rtable = optarg;
+                break;
+            case 'a':
+                acl = optarg;
+                break;
+            case 'o':
+                outfile = optarg;
+                break;
+            case 'n':
+                loops = atoi((char *) optarg);
+                break;
+            case 'c':
+                arpcache_sz = atoi((char *) optarg);
+                break;
+            case 'q':
+                if(strcmp(optarg, "tail") == 0)
+                { arpq_policy = SR_ARPQ_DROP_TAIL; }
+                else if(strcmp(optarg, "oldest") == 0)
+                { arpq_policy = SR_ARPQ_DROP_OLDEST; }
+                else
+                {
+                    fprintf(stderr, "ARP queue policy must be tail or oldest\n");
+                    exit(1);
+                }
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        } /* switch */
+    } /* -- while -- */
+
+    if(topo == 0 || optind != argc - 1 || loops == 0)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    /* -- same defaults as sr_init_instance, minus the server -- */
+    memset(&sr, 0, sizeof(sr));
+    sr.sockfd = -1;
+    strncpy(sr.host, "replay", 32);
+    strncpy(sr.user, "replay", 32);
+    pthread_mutex_init(&(sr.send_lock), 0);
+    sr.arpcache_sz = arpcache_sz;
+    sr.arpq_policy = arpq_policy;
+
+    memset(&out, 0, sizeof(out));
+    sr.send_hook = replay_send_hook;
+    sr.send_hook_arg = &out;
+
+    if(outfile && (out.fp = sr_dump_open(outfile, 0, REPLAY_SNAPLEN)) == 0)
+    {
+        fprintf(stderr, "Error opening up dump file %s\n", outfile);
+        exit(1);
+    }
+
+    if(!verbose)
+    {
+        fflush(stdout);
+        stdout_fd = replay_mute(1);
+    }
+
+    if((narp = replay_load_topo(&sr, topo, arp_ips, arp_macs, SR_ARPCACHE_SZ)) < 0)
+    { exit(1); }
+    if(sr_load_rt(&sr, rtable) != 0)
+    {
+        fprintf(stderr, "Error setting up routing table from file %s\n", rtable);
+        exit(1);
+    }
+    if(sr_verify_routing_table(&sr) != 0)
+    {
+        fprintf(stderr, "Routing table not consistent with interfaces in %s\n", topo);
+        exit(1);
+    }
+    if(acl && ((sr.acl = sr_acl_load(acl)) == 0 || sr_acl_bind(sr.acl, sr.if_list) != 0))
+    {
+        fprintf(stderr, "Error setting up access lists from file %s\n", acl);
+        exit(1);
+    }
+
+    sr_init(&sr);
+    for(i = 0; i < narp; i++)
+    {
+        /* -- not learned on any interface, refreshes go out of the route's -- */
+        struct sr_rt* rt = sr_lookup_route(&sr, arp_ips[i]);
+        struct sr_if* iface = rt ? sr_get_interface(&sr, rt->interface) : 0;
+        struct sr_arpreq* req = sr_arpcache_insert(&(sr.cache), arp_macs[i], arp_ips[i],
+                                                   iface ? iface->index : SR_IF_MAX);
+        assert(req == 0);
+    }
+
+    if((nframes = replay_load_pcap(&sr, argv[optind], &image, &frames)) <= 0)
+    {
+        fprintf(stderr, "%s: no frames to replay\n", argv[optind]);
+        exit(1);
+    }
+
+    n = (unsigned long)nframes * loops;
+    scratch = (uint8_t*)malloc(REPLAY_SNAPLEN);
+    lat = (uint32_t*)malloc(n * sizeof(uint32_t));
+    if(!scratch || !lat)
+    {
+        fprintf(stderr, "sr_replay: out of memory\n");
+        exit(1);
+    }
+
+    if(!verbose)
+    { stderr_fd = replay_mute(2); }
+
+    k = 0;
+    wall = replay_now_ns();
+    for(loop = 0; loop < loops; loop++)
+    {
+        for(i = 0; i < nframes; i++)
+        {
+            uint64_t t0, t1;
+
+            memcpy(scratch, frames[i].data, frames[i].len);
+
+            t0 = replay_now_ns();
+            sr_handlepacket_if(&sr, scratch, frames[i].len, frames[i].iface);
+            t1 = replay_now_ns();
+
+            lat[k++] = (uint32_t)(t1 - t0 > UINT32_MAX ? UINT32_MAX : t1 - t0);
+            busy += t1 - t0;
+        }
+    }
+    wall = replay_now_ns() - wall;
+
+    fflush(stdout);
+    replay_unmute(1, stdout_fd);
+    replay_unmute(2, stderr_fd);
+
+    qsort(lat, n, sizeof(uint32_t), replay_cmp_u32);
+
+    printf("replayed %lu frames (%d x %u) from %s\n", n, nframes, loops, argv[optind]);
+    printf("sent     %lu frames, %lu bytes%s%s\n", out.frames, out.bytes,
+           outfile ? " to " : "", outfile ? outfile : "");
+    printf("rate     %.0f pps in sr_handlepacket, %.0f pps wall\n",
+           busy ? n * 1e9 / busy : 0.0, wall ? n * 1e9 / wall : 0.0);
+    printf("latency  ns  min %u  p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+           lat[0], replay_pct(lat, n, 50), replay_pct(lat, n, 90),
+           replay_pct(lat, n, 99), replay_pct(lat, n, 99.9), lat[n - 1]);
+
+    if(out.fp)
+    { sr_dump_close(out.fp); }
+
+    free(lat);
+    free(scratch);
+    free(frames);
+    free(image);
+
+    return 0;
+} /* -- main -- */
@@ -21,6 +21,12 @@
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
 #include "sr_utils.h"
+#include "sr_log.h"
+#include "sr_stats.h"
+#include "sr_flow.h"
+#include "sr_epoch.h"
+#include "sr_ecmp.h"
+#include "sr_acl.h"
 
 /*---------------------------------------------------------------------
  * Method: sr_init(void)
@@ -36,7 +42,15 @@ void sr_init(struct sr_instance *sr)
   assert(sr);
 
   /* Initialize cache and cache cleanup thread */
-  sr_arpcache_init(&(sr->cache));
+  sr_arpcache_init_sz(&(sr->cache), sr->arpcache_sz);
+  sr->cache.drop_policy = sr->arpq_policy;
+
+  /* Counters are shared by every thread that handles or sends frames */
+  if ((sr->stats = sr_stats_create()) == 0)
+  {
+    fprintf(stderr, "Failed to allocate forwarding counters\n");
+    exit(1);
+  }
 
   pthread_attr_init(&(sr->attr));
   pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
@@ -50,110 +64,232 @@ void sr_init(struct sr_instance *sr)
 
 } /* -- sr_init -- */
 
-/*---------------------------------------------------------------------
- * Method: sr_handlepacket(uint8_t* p,char* interface)
- * Scope:  Global
- *
- * This method is called each time the router receives a packet on the
- * interface.  The packet buffer, the packet length and the receiving
- * interface are passed in as parameters. The packet is complete with
- * ethernet headers.
- *
- * Note: Both the packet buffer and the character's memory are handled
- * by sr_vns_comm.c that means do NOT delete either.  Make a copy of the
- * packet instead if you intend to keep it around beyond the scope of
- * the method call.
- *
- *---------------------------------------------------------------------*/
+/* Send a received frame that was rewritten in place, forwarded or turned
+   into an echo reply. Inside sr_handlepacket_burst the frame is lent for
+   the whole burst, so it joins the burst's batch and goes out with it */
+static __thread struct sr_frame *sr_tx_batch;
+static __thread unsigned int sr_tx_count;
 
-void sr_handlepacket(struct sr_instance *sr,
-                     uint8_t *packet /* lent */,
-                     unsigned int len,
-                     char *interface /* lent */)
+static void sr_forward_send(struct sr_instance *sr, uint8_t *forward_pkt, unsigned int len, struct sr_if *outgoing_if)
+{
+  if (sr_tx_batch)
+  {
+    sr_tx_batch[sr_tx_count].buf = forward_pkt;
+    sr_tx_batch[sr_tx_count].len = len;
+    sr_tx_batch[sr_tx_count].iface = outgoing_if;
+    sr_tx_count++;
+    return;
+  }
+  if (sr_send_packet_if(sr, forward_pkt, len, outgoing_if) == -1)
+  {
+    SR_ERR("Failed to forward packet\n");
+  }
+}
+
+/* Forward packet the way the last packet of its flow went, if the flow
+   cache still has that (see sr_flow.h). -1 leaves it to the slow path */
+static int sr_forward_flow(struct sr_instance *sr, uint8_t *packet, unsigned int len,
+                           struct sr_if *in_if)
+{
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+  struct sr_flow_key key;
+  struct sr_flow *flow;
+
+  // expiring packets need an ICMP answer, the slow path builds that
+  if (ip_hdr->ip_ttl <= 1 ||
+      sr_flow_key_of((uint8_t *)ip_hdr, len - sizeof(sr_ethernet_hdr_t), in_if->index, &key) != 0)
+  {
+    return -1;
+  }
+
+  flow = sr_flow_find(&key, __atomic_load_n(&sr->rt_gen, __ATOMIC_ACQUIRE),
+                      __atomic_load_n(&sr->cache.seq, __ATOMIC_ACQUIRE));
+  sr_stats_flow(sr->stats, flow != NULL);
+  if (flow == NULL)
+  {
+    return -1;
+  }
+
+  ip_decrement_ttl(ip_hdr);
+  memcpy(packet, flow->hdr, SR_FLOW_HDR_LEN);
+  sr_forward_send(sr, packet, len, flow->iface);
+  return 0;
+}
+
+/* Remember how forward_pkt is about to leave, for the rest of its flow */
+static void sr_learn_flow(uint8_t *forward_pkt, unsigned int len, struct sr_if *incoming_if,
+                          unsigned int rt_gen, unsigned int arp_seq,
+                          struct sr_if *outgoing_if, const unsigned char *mac)
+{
+  struct sr_flow_key key;
+  sr_ethernet_hdr_t hdr;
+
+  if (sr_flow_key_of(forward_pkt + sizeof(sr_ethernet_hdr_t), len - sizeof(sr_ethernet_hdr_t),
+                     incoming_if->index, &key) != 0)
+  {
+    return;
+  }
+  memcpy(hdr.ether_dhost, mac, ETHER_ADDR_LEN);
+  memcpy(hdr.ether_shost, outgoing_if->addr, ETHER_ADDR_LEN);
+  hdr.ether_type = htons(ethertype_ip);
+  sr_flow_put(&key, rt_gen, arp_seq, outgoing_if, (const uint8_t *)&hdr);
+}
+
+/* Length and checksum of a received IP packet, -1 (and counted as a drop)
+   if it fails either */
+static int sr_ip_check(struct sr_instance *sr, uint8_t *packet, unsigned int len)
+{
+  sr_ip_hdr_t *req_ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+
+  // Check if IP packet meets min length, header options included
+  if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+      req_ip_hdr->ip_hl < 5 ||
+      len - sizeof(sr_ethernet_hdr_t) < req_ip_hdr->ip_hl * 4)
+  {
+    SR_WARN("Received an IP packet that's too small!!!\n");
+    sr_stats_drop(sr->stats, sr_drop_short);
+    return -1;
+  }
+
+  // verify checksum, read only so the header is summed just once here
+  if (!cksum_valid(req_ip_hdr, req_ip_hdr->ip_hl * 4))
+  {
+    SR_WARN("Received an IP packet with invalid checksum\n");
+    sr_stats_drop(sr->stats, sr_drop_bad_cksum);
+    return -1;
+  }
+  return 0;
+}
+
+/* 1 (and counted as a drop) if the access list of iface for direction
+   dir denies the checked IP packet in packet, 0 otherwise */
+static int sr_acl_denied(struct sr_instance *sr, uint8_t *packet, unsigned int len,
+                         struct sr_if *iface, int dir)
+{
+  if (sr->acl == NULL ||
+      sr_acl_filter(sr->acl, iface->index, dir, packet + sizeof(sr_ethernet_hdr_t),
+                    len - sizeof(sr_ethernet_hdr_t)) == SR_ACL_PERMIT)
+  {
+    return 0;
+  }
+  SR_DEBUG("Packet denied by access list\n");
+  sr_stats_drop(sr->stats, sr_drop_acl);
+  return 1;
+}
+
+/* A checked IP packet addressed to router_if's IP */
+static void sr_handle_ip_for_router(struct sr_instance *sr, uint8_t *packet, unsigned int len,
+                                    struct sr_if *in_if, struct sr_if *router_if)
+{
+  sr_ip_hdr_t *req_ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+  unsigned int icmp_off = sizeof(sr_ethernet_hdr_t) + req_ip_hdr->ip_hl * 4;
+  struct sr_if *outgoing_iface = router_if;
+
+  SR_DEBUG("Received IP packet destined for router!!!\n");
+  if (req_ip_hdr->ip_p != ip_protocol_icmp)
+  {
+    SR_DEBUG("Received IP packet not ICMP, Type 3 Code 3\n");
+    sr_destined_for_router(sr, packet, len, in_if, outgoing_iface, 0);
+  }
+  else if (len < icmp_off + 8) // type, code, checksum, id and sequence
+  {
+    SR_WARN("Received an ICMP packet that's too small!!!\n");
+    sr_stats_drop(sr->stats, sr_drop_short);
+  }
+  else if (((sr_icmp_hdr_t *)(packet + icmp_off))->icmp_type == 8)
+  {
+    SR_DEBUG("Received ICMP echo request, preparing to echo!!!\n");
+    sr_destined_for_router(sr, packet, len, in_if, outgoing_iface, 1);
+  }
+}
+
+/* The work of sr_handlepacket(..) below for ARP and other frames that
+   are not IPv4, which sr_handleburst takes through its passes itself;
+   anything neither ARP nor IPv4 is ignored */
+static void sr_handleframe(struct sr_instance *sr,
+                           uint8_t *packet /* lent */,
+                           unsigned int len,
+                           struct sr_if *in_if /* lent */)
 {
   /* REQUIRES */
   assert(sr);
   assert(packet);
-  assert(interface);
-
-  printf("*** -> Received packet of length %d \n", len);
+  assert(in_if);
 
   /* fill in code here */
   uint16_t packet_type = ethertype(packet);
-  print_hdrs(packet, len);
+  if (SR_DEBUG_ON())
+  {
+    printf("*** -> Received packet of length %d \n", len);
+    print_hdrs(packet, len);
+  }
   if (packet_type == ethertype_arp)
   {
     sr_arp_hdr_t *arp_pkt = (sr_arp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
     uint16_t opcode = ntohs(arp_pkt->ar_op);
     if (opcode == arp_op_request)
     { // it's a request
-      printf("Received ARP request\n");
-      sr_handle_arprequest(sr, arp_pkt, len, interface, packet);
+      SR_DEBUG("Received ARP request\n");
+      sr_handle_arprequest(sr, arp_pkt, len, in_if, packet);
     }
     else if (opcode == arp_op_reply)
     {
-      printf("Received ARP reply\n");
-      sr_handle_arpreply(sr, arp_pkt, len, interface);
+      SR_DEBUG("Received ARP reply\n");
+      sr_handle_arpreply(sr, arp_pkt, len, in_if);
     }
     else
     {
-      fprintf(stderr, "Received invalid ARP packet opcode\n");
+      SR_WARN("Received invalid ARP packet opcode\n");
+      sr_stats_drop(sr->stats, sr_drop_bad_arp);
     }
   }
-  else if (packet_type == ethertype_ip)
-  {
-    // grab it's IP header
-    sr_ip_hdr_t *req_ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
-    //printf("IP Packet of length %d was received.\n", len);
-    //print_hdr_ip((uint8_t *)req_ip_hdr);
 
-    // verify checksum
-    uint16_t ip_checksum = req_ip_hdr->ip_sum;
-    req_ip_hdr->ip_sum = 0;
-    req_ip_hdr->ip_sum = cksum(req_ip_hdr, sizeof(sr_ip_hdr_t));
+} /* end sr_handleframe */
 
-    if (req_ip_hdr->ip_sum != ip_checksum)
-    {
-      fprintf(stderr, "Received an IP packet with invalid checksum\n");
-      return;
-    }
+/*---------------------------------------------------------------------
+ * Method: sr_handlepacket(uint8_t* p,char* interface)
+ * Scope:  Global
+ *
+ * This method is called each time the router receives a packet on the
+ * interface.  The packet buffer, the packet length and the receiving
+ * interface are passed in as parameters. The packet is complete with
+ * ethernet headers.
+ *
+ * Note: Both the packet buffer and the character's memory are handled
+ * by sr_vns_comm.c that means do NOT delete either.  Make a copy of the
+ * packet instead if you intend to keep it around beyond the scope of
+ * the method call.
+ *
+ *---------------------------------------------------------------------*/
 
-    // Check if IP packet meets min length
-    if (len - sizeof(sr_ethernet_hdr_t) < sizeof(sr_ip_hdr_t))
-    {
-      fprintf(stderr, "Received an IP packet that's too small!!!\n");
-      return;
-    }
+void sr_handlepacket(struct sr_instance *sr,
+                     uint8_t *packet /* lent */,
+                     unsigned int len,
+                     char *interface /* lent */)
+{
+  struct sr_if *in_if = sr_get_interface(sr, interface);
 
-    // check if ip packet meets minimum length
-    // determine if ip packet is destined for router
-    struct sr_if *router_if = get_interface_from_ip(sr, req_ip_hdr->ip_dst);
-    if (router_if)
-    {
-      printf("Received IP packet destined for router!!!\n");
-      // sr_ip_hdr_t *req_ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t)); comment out since it was already done earlier above
-      sr_icmp_hdr_t *req_icmp_hdr = (sr_icmp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-      struct sr_if *outgoing_iface = router_if; 
-      if (req_ip_hdr->ip_p != ip_protocol_icmp)
-      {
-        printf( "Received IP packet not ICMP, Type 3 Code 3\n");
-        sr_destined_for_router(sr, packet, len, interface, outgoing_iface, 0);
-      }
-      if (req_icmp_hdr->icmp_type == 8)
-      { 
-        printf("Received ICMP echo request, preparing to echo!!!\n");
-        sr_destined_for_router(sr, packet, len, interface, outgoing_iface, 1);
-      }     
-    }
-    else
-    {
-      fprintf(stdout, "Forwarding!!!\n");
-      sr_handle_ip_forwarding(sr, packet, len, interface);
-    }
+  if (in_if)
+  {
+    sr_handlepacket_if(sr, packet, len, in_if);
   }
-
 } /* end sr_handlepacket */
 
+/* sr_handlepacket once the interface name is resolved, the receive path
+   looks it up once and passes the sr_if along from there on */
+void sr_handlepacket_if(struct sr_instance *sr,
+                        uint8_t *packet /* lent */,
+                        unsigned int len,
+                        struct sr_if *in_if /* lent */)
+{
+  struct sr_frame frame;
+
+  frame.buf = packet;
+  frame.len = len;
+  frame.iface = in_if;
+  sr_handlepacket_burst(sr, &frame, 1);
+} /* end sr_handlepacket_if */
+
 /* Add any additional helper methods here & don't forget to also declare
 them in sr_router.h.
 
@@ -161,99 +297,52 @@ If you use any of these methods in sr_arpcache.c, you must also forward declare
 them in sr_arpcache.h to avoid circular dependencies. Since sr_router
 already imports sr_arpcache.h, sr_arpcache cannot import sr_router.h -KM */
 
-void sr_destined_for_router(struct sr_instance *sr, uint8_t *packet, unsigned int len, char *interface, struct sr_if *outgoing_iface, int echo)
+void sr_destined_for_router(struct sr_instance *sr, uint8_t *packet, unsigned int len, struct sr_if *incoming_iface, struct sr_if *outgoing_iface, int echo)
 {
-  struct sr_if *incoming_iface = sr_get_interface(sr, interface);
+  sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)packet;
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+  sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)((uint8_t *)ip_hdr + ip_hdr->ip_hl * 4);
+  uint16_t old_word, new_word;
 
-  // Create ICMP packet
-  size_t icmp_packet_len;
-  if (echo == 1) { // if it's an echo request
-    printf("Creating ICMP echo reply\n");
-    icmp_packet_len = len; // same length as original packet, because it's an echo
-  } else { // if it's not an echo request
-    printf("Creating ICMP destination unreachable\n");
-    icmp_packet_len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t); // ICMP packet length
-  }
-  uint8_t *icmp_packet = (uint8_t *)malloc(icmp_packet_len);
-  if (!icmp_packet)
+  if (echo == 0)
   {
-    fprintf(stderr, "Failed to allocate memory for ICMP packet\n");
+    SR_DEBUG("Creating ICMP destination unreachable\n");
+    sr_send_icmp_error(sr, packet, 3, 3, incoming_iface, outgoing_iface->ip); // Port Unreachable
     return;
   }
 
-  // Get the original IP header and ICMP header
-  sr_ip_hdr_t *req_ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
-  sr_icmp_hdr_t *req_icmp_hdr = (sr_icmp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-  
-  // start making the packet, starting from ethernet header
-  sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)icmp_packet;
-  memcpy(eth_hdr->ether_dhost, ((sr_ethernet_hdr_t *)packet)->ether_shost, ETHER_ADDR_LEN); // destination is the original source's mac address
-  memcpy(eth_hdr->ether_shost, incoming_iface->addr, ETHER_ADDR_LEN); // source is the router's interface's mac address
-  eth_hdr->ether_type = htons(ethertype_ip);
-  
+  // The echo reply is the request itself with the addresses swapped, so
+  // the payload never moves. Swapping src and dst leaves the IP checksum
+  // as it is; only the TTL and the ICMP type need patching
+  SR_DEBUG("Creating ICMP echo reply\n");
 
-  // Populate ICMP header
-  sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)(icmp_packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-  if (echo == 0) 
-  {
-    printf("Creating ICMP destination unreachable since ECHO==0\n");
-    icmp_hdr->icmp_type = 3; // Destination Unreachable
-    icmp_hdr->icmp_code = 3; // Port Unreachable
-    memcpy(icmp_hdr->data, (uint8_t *) req_ip_hdr, ICMP_DATA_SIZE); // Copy original data
-  }
-  else
-  {
-    printf("Creating ICMP echo reply since ECHO==1\n");
-    size_t icmp_hdr_len = icmp_packet_len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t);
-    memcpy(icmp_hdr, req_icmp_hdr, icmp_hdr_len); // Copy original ICMP header
-    icmp_hdr->icmp_type = 0; // Echo Reply
-    icmp_hdr->icmp_code = 0; // No code
-  }
+  memcpy(eth_hdr->ether_dhost, eth_hdr->ether_shost, ETHER_ADDR_LEN); // destination is the original source's mac address
+  memcpy(eth_hdr->ether_shost, incoming_iface->addr, ETHER_ADDR_LEN); // source is the router's interface's mac address
 
-  icmp_hdr->icmp_sum = 0; // Checksum is 0
+  ip_hdr->ip_dst = ip_hdr->ip_src; // Destination is the original source's IP
+  ip_hdr->ip_src = outgoing_iface->ip; // Source is the router's IP, the one the request was sent to
 
-  // Populate IP header
-  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(icmp_packet + sizeof(sr_ethernet_hdr_t));
-  ip_hdr->ip_hl = req_ip_hdr->ip_hl;
-  ip_hdr->ip_v = req_ip_hdr->ip_v;
-  ip_hdr->ip_len = htons(icmp_packet_len - sizeof(sr_ethernet_hdr_t));
-  if (echo == 0)
-  {
-    ip_hdr->ip_off = htons(IP_DF);
-  }
-  ip_hdr->ip_id = req_ip_hdr->ip_id;
+  memcpy(&old_word, &ip_hdr->ip_ttl, sizeof(old_word)); // ttl and protocol share a word
   ip_hdr->ip_ttl = INIT_TTL;
-  ip_hdr->ip_p = ip_protocol_icmp;
-  ip_hdr->ip_sum = 0; // Checksum is 0
-  ip_hdr->ip_src = outgoing_iface->ip; // Source is the router's IP
-  ip_hdr->ip_dst = req_ip_hdr->ip_src; // Destination is the original source's IP
-  
-
-  // recompute checksums
-  ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
-  if (echo == 1) {
-    size_t icmp_hdr_len = icmp_packet_len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t);
-    icmp_hdr->icmp_sum = cksum(icmp_hdr, icmp_hdr_len);
-  } else {
-    icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_hdr_t));
-  }
+  memcpy(&new_word, &ip_hdr->ip_ttl, sizeof(new_word));
+  ip_hdr->ip_sum = cksum_update16(ip_hdr->ip_sum, old_word, new_word);
+
+  memcpy(&old_word, icmp_hdr, sizeof(old_word)); // type and code share a word
+  icmp_hdr->icmp_type = 0; // Echo Reply
+  memcpy(&new_word, icmp_hdr, sizeof(new_word));
+  icmp_hdr->icmp_sum = cksum_update16(icmp_hdr->icmp_sum, old_word, new_word);
 
   // Send
-  print_hdrs(icmp_packet, icmp_packet_len);
-  if (sr_send_packet(sr, icmp_packet, icmp_packet_len, interface) == -1)
+  if (SR_DEBUG_ON())
   {
-    fprintf(stderr, "Failed to send ICMP packet\n");
+    print_hdrs(packet, len);
   }
-  else
-  {
-    //printf("sr_destined_for_router: Sent ICMP packet\n");
-  }
-  //free(icmp_packet);
+  sr_forward_send(sr, packet, len, incoming_iface);
 
 } /* end sr_destined_for_router */
 
 void sr_handle_arprequest(struct sr_instance *sr, sr_arp_hdr_t *arp_pkt, unsigned int len,
-                          char *interface, uint8_t *packet) //arp_pkt = arp_packet
+                          struct sr_if *in_if, uint8_t *packet) //arp_pkt = arp_packet
 {
 
   // answers the question "Who has IP of router, send me your mac address" with "I'm the router, I have that IP, here is my mac address"
@@ -263,13 +352,14 @@ void sr_handle_arprequest(struct sr_instance *sr, sr_arp_hdr_t *arp_pkt, unsigne
 
   if (matching_iface == NULL)
   { // router can have multiple interfaces for different networks, so search through them
-    printf("sr_handle_arprequest: ARP request not for us\n");
+    SR_DEBUG("sr_handle_arprequest: ARP request not for us\n");
     return;
   }
 
   // printf("sr_handle_arprequest: creating arp reply to target: %u\n", arp_pkt->ar_tip);
 
-  uint8_t *arp_reply = (uint8_t *)malloc(len); // same length as original arp packet
+  uint8_t arp_reply[sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)]; // ethernet + arp, no padding
+  len = sizeof(arp_reply);
 
   // Ethernet Headers
   struct sr_ethernet_hdr *ethernet_hdr = (struct sr_ethernet_hdr *)arp_reply;
@@ -288,13 +378,12 @@ void sr_handle_arprequest(struct sr_instance *sr, sr_arp_hdr_t *arp_pkt, unsigne
   memcpy(arp_hdr->ar_tha, ((sr_ethernet_hdr_t *)packet)->ether_shost, ETHER_ADDR_LEN); // whys hould this be ((sr_ethernet_hdr_t *) packet)->ether_shost, instead
   arp_hdr->ar_tip = arp_pkt->ar_sip;
 
-  if (sr_send_packet(sr, arp_reply, len, interface) == -1)
+  if (sr_send_packet_if(sr, arp_reply, len, in_if) == -1)
   {
-    fprintf(stderr, "Failed to send ARP reply\n");
+    SR_ERR("Failed to send ARP reply\n");
   } else {
     // printf("sr_handle_arprequest: Sent ARP reply for IP: %u\n", arp_pkt->ar_sip);
   }
-  free(arp_reply);
 }
 
 /*
@@ -302,7 +391,7 @@ void sr_handle_arprequest(struct sr_instance *sr, sr_arp_hdr_t *arp_pkt, unsigne
   It then updates the ARP cache with the new IP-to-MAC mapping, marking it as valid.
 */
 void sr_handle_arpreply(struct sr_instance *sr, sr_arp_hdr_t *arp_pkt, unsigned int len,
-                        char *interface)
+                        struct sr_if *in_if)
 {
   // responds to answer of "Hey router, I have that IP, and this is my MAC address" with "Okay, here are all the packets that were meant for you"
   // In arpcache.c, I actually implement the part where the router asks, "Hey I'm the router, and I'm looking for mac address that corresponds to <ARP request's IP>"
@@ -311,16 +400,19 @@ void sr_handle_arpreply(struct sr_instance *sr, sr_arp_hdr_t *arp_pkt, unsigned
   struct sr_if *matching_iface = get_interface_from_ip(sr, arp_pkt->ar_tip);
   if (matching_iface == NULL)
   { // the ARP reply is not for us
-    printf("sr_handle_arpreply: ARP reply not for us\n");
+    SR_DEBUG("sr_handle_arpreply: ARP reply not for us\n");
     return;
   }
 
-  // Check if IP address is already in the request queue
-  struct sr_arpreq *request = sr_arpcache_insert(&sr->cache, arp_pkt->ar_sha, arp_pkt->ar_sip);
+  // Check if IP address is already in the request queue. Hold the cache lock
+  // until the request is gone so no other thread queues onto it or its retry
+  // timer fires while its packets go out.
+  pthread_mutex_lock(&(sr->cache.lock));
+  struct sr_arpreq *request = sr_arpcache_insert(&sr->cache, arp_pkt->ar_sha, arp_pkt->ar_sip, in_if->index);
   if (request)
   {
     // If found, send off all packets on the request's pending packets list, then remove the request from the queue
-    printf("sr_handle_arpreply: Found matching request for IP: %u\n", arp_pkt->ar_sip);
+    SR_DEBUG("sr_handle_arpreply: Found matching request for IP: %u\n", arp_pkt->ar_sip);
     struct sr_packet *cur_pkt = request->packets;
     while (cur_pkt)
     {
@@ -331,183 +423,372 @@ void sr_handle_arpreply(struct sr_instance *sr, sr_arp_hdr_t *arp_pkt, unsigned
       memcpy(ethernet_hdr->ether_dhost, arp_pkt->ar_sha, ETHER_ADDR_LEN);      // destination is the mac address from the arp reply
       memcpy(ethernet_hdr->ether_shost, matching_iface->addr, ETHER_ADDR_LEN); // source is the router's interface's mac address
 
-      if (sr_send_packet(sr, cur_pkt->buf, cur_pkt->len, matching_iface->name) == -1)
+      if (sr_send_packet_if(sr, cur_pkt->buf, cur_pkt->len, matching_iface) == -1)
       {
-        fprintf(stderr, "ARP Reply: Failed to send queued packet\n");
+        SR_ERR("ARP Reply: Failed to send queued packet\n");
       } else {
-        printf("Sent queued packet to %u\n", arp_pkt->ar_sip);
+        SR_DEBUG("Sent queued packet to %u\n", arp_pkt->ar_sip);
       }
       cur_pkt = cur_pkt->next;
     }
     sr_arpreq_destroy(&sr->cache, request);
   }
+  pthread_mutex_unlock(&(sr->cache.lock));
 
   // Insert the MAC address & corresponing IP into the ARP cache
 }
 
 
 
-void sr_handle_ip_forwarding(struct sr_instance *sr, uint8_t *forward_pkt, unsigned int len, char *interface)
+// The part of sr_handle_ip_forwarding after the route lookup, rt is the
+// route for forward_pkt or NULL. rt_gen and arp_seq were read before it
+static void sr_forward_routed(struct sr_instance *sr, uint8_t *forward_pkt, unsigned int len, struct sr_if *incoming_if,
+                              struct sr_rt *rt, unsigned int rt_gen, unsigned int arp_seq)
 {
-  // handle IP forwarding logic here
-  // decrement TTL by 1
-
-  // prepare error messages ICMP type 11 and 3, all error messages will be sent directly back to sender, so send them out the same incoming interface
-  struct sr_if *incoming_if = sr_get_interface(sr, interface);
-
-  size_t error_pkt_len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t);
-  uint8_t *error_pkt = (uint8_t *)malloc(error_pkt_len);
-
-  // grab headers of error packet
-  sr_icmp_hdr_t *error_icmp_hdr = (sr_icmp_hdr_t *)(error_pkt + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-
-  // create packet
-  create_ip_forwarding_error_packet(error_pkt, forward_pkt, incoming_if, error_pkt_len); // fill in ip_hdr and eth_hdr of error_pkt
-  
   sr_ip_hdr_t *forward_ip_hdr = (sr_ip_hdr_t *)(forward_pkt + sizeof(sr_ethernet_hdr_t));
-  (forward_ip_hdr->ip_ttl)--;
-  forward_ip_hdr->ip_sum = 0;
-  forward_ip_hdr->ip_sum = cksum(forward_ip_hdr, sizeof(sr_ip_hdr_t)); // supposed to do this at the END
-
-  // fill in some ICMP fields
-  error_icmp_hdr->icmp_sum = 0;
-  memcpy(error_icmp_hdr->data, forward_ip_hdr, ICMP_DATA_SIZE); // copy the data from the updated forward packet
-  // error functions will handle the rest, including checksums and icmp types and codes
 
-  // check TTL  expiration
-  if (forward_ip_hdr->ip_ttl < 1)
+  if (rt == NULL)
   {
-    printf("TTL expired. Sending ICMP Time Exceeded.\n");
-    // SEND ICMP TIME EXCEEDED PACKET
-    icmp_11_error(sr, error_pkt, error_pkt_len, interface);
+    // send ICMP destination net unreachable
+    SR_DEBUG("No route found. Sending ICMP Destination Unreachable.\n");
+    sr_stats_drop(sr->stats, sr_drop_no_route);
+    sr_send_icmp_error(sr, forward_pkt, 3, 0, incoming_if, incoming_if->ip); // net unreachable
+    return;
   }
-  else
+
+  // equal cost routes: the flow's hash picks one, so the whole flow takes it
+  if (rt->ecmp)
   {
-    printf("TTL is %d. Packet can be forwarded.\n", forward_ip_hdr->ip_ttl);
+    rt = sr_ecmp_pick(rt->ecmp, sr_ecmp_hash((uint8_t *)forward_ip_hdr, len - sizeof(sr_ethernet_hdr_t)));
   }
 
-  // Find match for destination IP in routing table...
-  // next_hop_mac_address = (matching function result)
+  // egress access list of the interface the route leaves by
+  if (sr->acl && sr->acl->egress)
+  {
+    struct sr_if *out_if = sr_get_interface(sr, rt->interface);
 
-  struct sr_rt *rt = sr->routing_table; // get routing table
-  while( rt != NULL ) {
-    if (rt->dest.s_addr == forward_ip_hdr->ip_dst) {
-      break;
+    if (out_if && sr_acl_denied(sr, forward_pkt, len, out_if, SR_ACL_OUT))
+    {
+      return;
     }
-    rt = rt->next;
   }
 
-  if (rt == NULL)
+  // decrement TTL, patching the checksum instead of summing the header again
+  ip_decrement_ttl(forward_ip_hdr);
+  SR_DEBUG("TTL is %d. Packet can be forwarded.\n", forward_ip_hdr->ip_ttl);
+
+  // Fast path: the route's adjacency already holds the egress interface and
+  // the Ethernet header, valid as long as the ARP cache has not changed
+  struct sr_if *outgoing_if;
+
+  if (rt->gw.s_addr != 0 && sr_adj_get(&rt->adj, arp_seq, forward_pkt, &outgoing_if) == 0)
   {
-    // send ICMP destination net unreachable
-    printf("No route found. Sending ICMP Destination Unreachable.\n");
-    icmp_3_error(sr, error_pkt, error_pkt_len, interface);
+    sr_stats_arp(sr->stats, 1);
+    sr_learn_flow(forward_pkt, len, incoming_if, rt_gen, arp_seq, outgoing_if,
+                  ((sr_ethernet_hdr_t *)forward_pkt)->ether_dhost);
+    sr_forward_send(sr, forward_pkt, len, outgoing_if);
+    return;
   }
-  free(error_pkt);
-  struct sr_if *outgoing_if = sr_get_interface(sr, rt->interface); // rt tells you you need to send 192.168.1.10 to interface eth0, where it's 192.168.1.0
 
-  struct sr_arpentry *entry = sr_arpcache_lookup(&sr->cache, forward_ip_hdr->ip_dst); // cache tells you 192.168.1.1 has mac address AAA...
-  if (entry)
+  outgoing_if = sr_get_interface(sr, rt->interface); // rt tells you you need to send 192.168.1.10 to interface eth0, where it's 192.168.1.0
+
+  // ARP for the gateway, or for the destination itself on a directly connected route
+  uint32_t next_hop = rt->gw.s_addr ? rt->gw.s_addr : forward_ip_hdr->ip_dst;
+
+  struct sr_arpentry entry = sr_arpcache_find(&sr->cache, next_hop); // cache tells you 192.168.1.1 has mac address AAA...
+  sr_stats_arp(sr->stats, entry.valid);
+  if (entry.valid)
   {
+    // remember it for the next packet on this route; arp_seq was read before
+    // the lookup, so a change since then leaves the adjacency stale, not wrong
+    if (rt->gw.s_addr != 0)
+    {
+      sr_adj_set(&rt->adj, arp_seq, outgoing_if, entry.mac);
+    }
+    sr_learn_flow(forward_pkt, len, incoming_if, rt_gen, arp_seq, outgoing_if, entry.mac);
     // send to next hop, just redo the layer 2 header of forward_ip_pkt, keep all else
-    printf("MAC address found. Forwarding packet to next hop.\n");
-    forward_packet(sr, len, outgoing_if, forward_pkt, entry);
+    SR_DEBUG("MAC address found. Forwarding packet to next hop.\n");
+    forward_packet(sr, len, outgoing_if, forward_pkt, &entry);
   }
   else
   {
     // No ARP entry was found, prepare packet to be placed into queue
     memset(((sr_ethernet_hdr_t *)forward_pkt)->ether_dhost, 0, ETHER_ADDR_LEN);
 
-    // Place packet into the cache's queue, send ARP request
-    struct sr_arpreq *arp_req = sr_arpcache_queuereq(&sr->cache, forward_ip_hdr->ip_dst, forward_pkt, len, outgoing_if->name);
-    printf("No ARP entry found. Sending ARP request.\n");
-    handle_arpreq(sr, arp_req);
-
+    // Place packet into the cache's queue, send ARP request. Under the cache
+    // lock, look again: another thread may have taken the reply meanwhile,
+    // and nobody may flush or retry the request until handle_arpreq is done.
+    pthread_mutex_lock(&(sr->cache.lock));
+    entry = sr_arpcache_find(&sr->cache, next_hop);
+    if (entry.valid)
+    {
+      forward_packet(sr, len, outgoing_if, forward_pkt, &entry);
+    }
+    else
+    {
+      struct sr_arpreq *arp_req = sr_arpcache_queuereq(&sr->cache, next_hop, forward_pkt, len, outgoing_if->index);
+      SR_DEBUG("No ARP entry found. Sending ARP request.\n");
+      handle_arpreq(sr, arp_req);
+    }
+    pthread_mutex_unlock(&(sr->cache.lock));
   }
 }
 
-void icmp_11_error(struct sr_instance *sr, uint8_t *error_pkt, size_t error_len, char *interface)
+void sr_handle_ip_forwarding(struct sr_instance *sr, uint8_t *forward_pkt, unsigned int len, struct sr_if *incoming_if)
 {
-  sr_icmp_hdr_t *error_icmp_hdr = (sr_icmp_hdr_t *)(error_pkt + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-  sr_ip_hdr_t *error_ip_hdr = (sr_ip_hdr_t *)(error_pkt + sizeof(sr_ethernet_hdr_t));
-
-  // send ICMP time exceeded packet
-  error_icmp_hdr->icmp_type = 11;
-  error_icmp_hdr->icmp_code = 0;
+  // handle IP forwarding logic here
+  sr_ip_hdr_t *forward_ip_hdr = (sr_ip_hdr_t *)(forward_pkt + sizeof(sr_ethernet_hdr_t));
 
-  // recompute checksums
-  error_ip_hdr->ip_sum = cksum(error_ip_hdr, sizeof(sr_ip_hdr_t));
-  error_icmp_hdr->icmp_sum = cksum(error_icmp_hdr, sizeof(sr_icmp_hdr_t));
+  // generations for the flow cache, read before anything is looked up
+  unsigned int rt_gen = __atomic_load_n(&sr->rt_gen, __ATOMIC_ACQUIRE);
+  unsigned int arp_seq = __atomic_load_n(&sr->cache.seq, __ATOMIC_ACQUIRE);
 
-  if (sr_send_packet(sr, error_pkt, error_len, interface) == -1)
+  // check TTL expiration, a packet arriving with TTL 1 would leave with 0
+  if (forward_ip_hdr->ip_ttl <= 1)
   {
-    fprintf(stderr, "Failed to send ICMP Time Exceeded\n");
+    SR_DEBUG("TTL expired. Sending ICMP Time Exceeded.\n");
+    sr_stats_drop(sr->stats, sr_drop_ttl);
+    // SEND ICMP TIME EXCEEDED PACKET
+    sr_send_icmp_error(sr, forward_pkt, 11, 0, incoming_if, incoming_if->ip);
+    return;
   }
-  // free(error_pkt);
-  return;
+
+  // Find match for destination IP in routing table, the TTL is decremented
+  // once there is one, so an unreachable error quotes the header as received
+  struct sr_rt *rt = sr_lookup_route(sr, forward_ip_hdr->ip_dst); // longest prefix match
+
+  sr_forward_routed(sr, forward_pkt, len, incoming_if, rt, rt_gen, arp_seq);
 }
 
-void icmp_3_error(struct sr_instance *sr, uint8_t *error_pkt, size_t error_len, char *interface)
+/* Frame of a burst that has just been dealt with: done at the burst's
+   write (0) if it went into the batch, now otherwise */
+static inline void sr_burst_done(struct sr_instance *sr, uint64_t *done, unsigned int tx_before)
 {
-  sr_icmp_hdr_t *error_icmp_hdr = (sr_icmp_hdr_t *)(error_pkt + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-  sr_ip_hdr_t *error_ip_hdr = (sr_ip_hdr_t *)(error_pkt + sizeof(sr_ethernet_hdr_t));
+  *done = (sr->stats && sr_tx_count == tx_before) ? sr_stats_clock() : 0;
+}
 
-  // send ICMP destination unreachable packet
-  error_icmp_hdr->icmp_type = 3;
-  error_icmp_hdr->icmp_code = 0;
+/* sr_handlepacket_burst(..) for at most SR_BURST_MAX frames */
+static void sr_handleburst(struct sr_instance *sr, struct sr_frame *frames, unsigned int n)
+{
+  struct sr_frame tx[SR_BURST_MAX];
+  struct sr_rt *rt[SR_BURST_MAX];
+  unsigned char ip[SR_BURST_MAX];   // checked IPv4 frames, then those left to route
+  uint64_t done[SR_BURST_MAX];      // when each frame was dealt with, 0 for the write
+  unsigned int nip = 0, nroute = 0, i, tx_before;
+  uint64_t start = sr_stats_clock();
+
+  sr_tx_batch = tx;
+  sr_tx_count = 0;
+
+  // pass 1: classify by ethertype and check IP headers; whatever is not a
+  // plain IPv4 packet goes through sr_handleframe one at a time
+  for (i = 0; i < n; i++)
+  {
+    struct sr_frame *f = &frames[i];
 
-  // recompute checksums
-  error_ip_hdr->ip_sum = cksum(error_ip_hdr, sizeof(sr_ip_hdr_t));
-  error_icmp_hdr->icmp_sum = cksum(error_icmp_hdr, sizeof(sr_icmp_hdr_t));
+    if (i + SR_BURST_PREFETCH < n)
+    {
+      __builtin_prefetch(frames[i + SR_BURST_PREFETCH].buf);
+      __builtin_prefetch(frames[i + SR_BURST_PREFETCH].buf + sizeof(sr_ethernet_hdr_t) + 4);
+    }
+    sr_stats_rx(sr->stats, f->iface->index, f->len);
+
+    tx_before = sr_tx_count;
+    if (f->len >= sizeof(sr_ethernet_hdr_t) && ethertype(f->buf) == ethertype_ip)
+    {
+      if (SR_DEBUG_ON())
+      {
+        printf("*** -> Received packet of length %d \n", f->len);
+        print_hdrs(f->buf, f->len);
+      }
+      if (sr_ip_check(sr, f->buf, f->len) == 0)
+      {
+        ip[nip++] = i;
+        continue;
+      }
+    }
+    else
+    {
+      sr_handleframe(sr, f->buf, f->len, f->iface);
+    }
+    sr_burst_done(sr, &done[i], tx_before);
+  }
+
+  // pass 2: known flows go straight to the batch, the rest pass the ingress
+  // access list and are either for the router, expiring, or need a route
+  unsigned int rt_gen = __atomic_load_n(&sr->rt_gen, __ATOMIC_ACQUIRE);
+  unsigned int arp_seq = __atomic_load_n(&sr->cache.seq, __ATOMIC_ACQUIRE);
 
-  if (sr_send_packet(sr, error_pkt, error_len, interface) == -1)
+  for (i = 0; i < nip; i++)
   {
-    fprintf(stderr, "Failed to send ICMP Destination Unreachable\n");
+    struct sr_frame *f = &frames[ip[i]];
+    sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(f->buf + sizeof(sr_ethernet_hdr_t));
+    struct sr_if *router_if;
+
+    tx_before = sr_tx_count;
+    if (sr_forward_flow(sr, f->buf, f->len, f->iface) == 0 ||
+        sr_acl_denied(sr, f->buf, f->len, f->iface, SR_ACL_IN))
+    {
+      // sent on from the flow cache, or denied
+    }
+    else if ((router_if = get_interface_from_ip(sr, ip_hdr->ip_dst)) != NULL)
+    {
+      sr_handle_ip_for_router(sr, f->buf, f->len, f->iface, router_if);
+    }
+    else if (ip_hdr->ip_ttl <= 1)
+    {
+      sr_handle_ip_forwarding(sr, f->buf, f->len, f->iface);
+    }
+    else
+    {
+      ip[nroute++] = ip[i];
+      continue;
+    }
+    sr_burst_done(sr, &done[ip[i]], tx_before);
+  }
+
+  // pass 3: all route lookups back to back, then forward
+  for (i = 0; i < nroute; i++)
+  {
+    sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(frames[ip[i]].buf + sizeof(sr_ethernet_hdr_t));
+
+    rt[i] = sr_lookup_route(sr, ip_hdr->ip_dst);
+    if (rt[i])
+    {
+      __builtin_prefetch(&rt[i]->adj);
+    }
+  }
+  for (i = 0; i < nroute; i++)
+  {
+    struct sr_frame *f = &frames[ip[i]];
+
+    SR_DEBUG("Forwarding!!!\n");
+    tx_before = sr_tx_count;
+    sr_forward_routed(sr, f->buf, f->len, f->iface, rt[i], rt_gen, arp_seq);
+    sr_burst_done(sr, &done[ip[i]], tx_before);
+  }
+
+  // pass 4: everything forwarded leaves in one write
+  sr_tx_batch = NULL;
+  if (sr_tx_count && sr_send_burst(sr, tx, sr_tx_count) == -1)
+  {
+    SR_ERR("Failed to forward packets\n");
+  }
+
+  // each frame's time from the start of the burst until it was dealt
+  // with, or for those in the batch until the write
+  if (sr->stats)
+  {
+    uint64_t sent = sr_stats_clock();
+
+    for (i = 0; i < n; i++)
+    {
+      sr_stats_latency(sr->stats, (done[i] ? done[i] : sent) - start);
+    }
   }
-  // free(error_pkt);
-  return;
 }
 
-void create_ip_forwarding_error_packet(uint8_t *error_pkt, uint8_t *forward_pkt, struct sr_if *incoming_if,
-                                       size_t error_pkt_len)
+/*---------------------------------------------------------------------
+ * Method: sr_handlepacket_burst(..)
+ * Scope:  Global
+ *
+ * sr_handlepacket for n frames at once, handled a stage at a time over
+ * up to SR_BURST_MAX of them: classify and check headers, look up flows,
+ * look up routes, forward, then send everything forwarded in one write.
+ * Frames, like the single packet of sr_handlepacket, are lent and must
+ * stay put until the call returns.  Frames of one flow keep their order;
+ * answers the router generates itself may overtake forwarded frames.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_handlepacket_burst(struct sr_instance *sr,
+                           struct sr_frame *frames /* lent */,
+                           unsigned int n)
 {
+  /* REQUIRES */
+  assert(sr);
+  assert(frames);
+
+  // routes looked up below stay valid until the section ends, however the
+  // routing table is replaced meanwhile
+  sr_epoch_enter();
+  while (n > 0)
+  {
+    unsigned int k = (n < SR_BURST_MAX) ? n : SR_BURST_MAX;
+
+    sr_handleburst(sr, frames, k);
+    frames += k;
+    n -= k;
+  }
+  sr_epoch_exit();
+} /* end sr_handlepacket_burst */
+
+/* ICMP errors are built here, one frame per thread, and only when one is
+   actually sent */
+static __thread uint8_t sr_icmp_scratch[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t)];
+
+/*---------------------------------------------------------------------
+ * Method: sr_send_icmp_error(..)
+ * Scope:  Global
+ *
+ * Answer the IP frame pkt with an ICMP error of the given type and code,
+ * from src_ip (network byte order), back to pkt's Ethernet source out
+ * of out_if.  The first ICMP_DATA_SIZE bytes of pkt's IP header are
+ * quoted as they are when called.
+ *
+ *---------------------------------------------------------------------*/
 
+int sr_send_icmp_error(struct sr_instance *sr, const uint8_t *pkt, uint8_t type, uint8_t code,
+                       struct sr_if *out_if, uint32_t src_ip)
+{
+  uint8_t *error_pkt = sr_icmp_scratch;
+  size_t error_pkt_len = sizeof(sr_icmp_scratch);
+  sr_ethernet_hdr_t *error_eth_hdr = (sr_ethernet_hdr_t *)error_pkt;
   sr_ip_hdr_t *error_ip_hdr = (sr_ip_hdr_t *)(error_pkt + sizeof(sr_ethernet_hdr_t));
   sr_icmp_hdr_t *error_icmp_hdr = (sr_icmp_hdr_t *)(error_pkt + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-  sr_ethernet_hdr_t *error_eth_hdr = (sr_ethernet_hdr_t *)error_pkt;
+  const sr_ip_hdr_t *orig_ip_hdr = (const sr_ip_hdr_t *)(pkt + sizeof(sr_ethernet_hdr_t));
 
   // make ethernet headers
-  memcpy(error_eth_hdr->ether_dhost, ((sr_ethernet_hdr_t *)forward_pkt)->ether_shost, ETHER_ADDR_LEN);
-  memcpy(error_eth_hdr->ether_shost, incoming_if->addr, ETHER_ADDR_LEN);
+  memcpy(error_eth_hdr->ether_dhost, ((const sr_ethernet_hdr_t *)pkt)->ether_shost, ETHER_ADDR_LEN);
+  memcpy(error_eth_hdr->ether_shost, out_if->addr, ETHER_ADDR_LEN);
   error_eth_hdr->ether_type = htons(ethertype_ip);
 
-  // grab ip header of forward packet again
-  sr_ip_hdr_t *forward_ip_hdr = (sr_ip_hdr_t *)(forward_pkt + sizeof(sr_ethernet_hdr_t)); //hop_ip_hdr
-
   // make IP headers
-  error_ip_hdr->ip_hl = forward_ip_hdr->ip_hl;
-  error_ip_hdr->ip_v = forward_ip_hdr->ip_v;
+  error_ip_hdr->ip_hl = 5;
+  error_ip_hdr->ip_v = 4;
+  error_ip_hdr->ip_tos = 0;
   error_ip_hdr->ip_len = htons(error_pkt_len - sizeof(sr_ethernet_hdr_t));
-  error_ip_hdr->ip_id = forward_ip_hdr->ip_id;
+  error_ip_hdr->ip_id = orig_ip_hdr->ip_id;
   error_ip_hdr->ip_off = htons(IP_DF);
   error_ip_hdr->ip_ttl = INIT_TTL;
   error_ip_hdr->ip_p = ip_protocol_icmp;
-  error_ip_hdr->ip_src = incoming_if->ip;
-  error_ip_hdr->ip_dst = forward_ip_hdr->ip_src;
-
+  error_ip_hdr->ip_src = src_ip;
+  error_ip_hdr->ip_dst = orig_ip_hdr->ip_src;
   error_ip_hdr->ip_sum = 0;
 
-  // icmp header will be handled in the error message functions
-}
+  // make ICMP header, quoting the original
+  error_icmp_hdr->icmp_type = type;
+  error_icmp_hdr->icmp_code = code;
+  error_icmp_hdr->icmp_sum = 0;
+  error_icmp_hdr->unused = 0;
+  memcpy(error_icmp_hdr->data, orig_ip_hdr, ICMP_DATA_SIZE);
 
-void forward_packet(struct sr_instance *sr, unsigned int len, struct sr_if *outgoing_if, uint8_t *forward_pkt, struct sr_arpentry *entry)
+  // compute checksums
+  error_ip_hdr->ip_sum = cksum(error_ip_hdr, sizeof(sr_ip_hdr_t));
+  error_icmp_hdr->icmp_sum = cksum(error_icmp_hdr, sizeof(sr_icmp_hdr_t));
+
+  if (sr_send_packet_if(sr, error_pkt, error_pkt_len, out_if) == -1)
+  {
+    SR_ERR("Failed to send ICMP type %d code %d\n", type, code);
+    return -1;
+  }
+  return 0;
+} /* end sr_send_icmp_error */
+
+void forward_packet(struct sr_instance *sr, unsigned int len, struct sr_if *outgoing_if, uint8_t *forward_pkt, const struct sr_arpentry *entry)
 {
   memcpy(((sr_ethernet_hdr_t *)forward_pkt)->ether_dhost, entry->mac, ETHER_ADDR_LEN);
   memcpy(((sr_ethernet_hdr_t *)forward_pkt)->ether_shost, outgoing_if->addr, ETHER_ADDR_LEN);
 
-  if (sr_send_packet(sr, forward_pkt, len, outgoing_if->name) == -1)
-  {
-    fprintf(stderr, "Failed to send Forwarding IP Packet\n");
-  }
-  free(entry);
+  sr_forward_send(sr, forward_pkt, len, outgoing_if);
 }
\ No newline at end of file
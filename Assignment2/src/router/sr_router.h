@@ -11,6 +11,7 @@
 #include <stdio.h>
 
 #include "sr_protocol.h"
+#include "sr_if.h"
 #include "sr_arpcache.h"
 
 /* we dont like this debug , but what to do for varargs ? */
@@ -26,10 +27,22 @@
 
 #define INIT_TTL 255
 #define PACKET_DUMP_SIZE 1024
+#define SR_FRAME_BLOCK 2048     /* pipeline slot, fits any MTU sized frame */
 
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_fib;
+struct sr_acl;
+struct sr_pipeline;
+struct sr_stats;
+struct iovec;
+struct sr_instance;
+
+/* Takes over from the VNS socket for every frame sr_send_packet emits
+   (offline replay, see sr_replay.c). Returns 0 on success, -1 on error. */
+typedef int (*sr_send_hook_fn)(struct sr_instance* sr, const uint8_t* buf,
+                               unsigned int len, const char* iface, void* arg);
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -47,30 +60,60 @@ struct sr_instance
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
     struct sr_if* if_list; /* list of interfaces */
-    struct sr_rt* routing_table; /* routing table */
+    struct sr_if_table if_table; /* O(1) lookups over if_list */
+    struct sr_fib* fib;         /* routing table, swapped whole, see sr_rt.h */
+    unsigned int rt_gen;        /* bumped each time a routing table is published */
+    struct sr_acl* acl;         /* access lists, see sr_acl.h, 0 if none */
     struct sr_arpcache cache;   /* ARP cache */
+    unsigned int arpcache_sz;   /* ARP cache capacity, 0 for default */
+    int arpq_policy;            /* SR_ARPQ_DROP_TAIL or SR_ARPQ_DROP_OLDEST */
+    uint8_t* rx_buf;            /* buffered command stream from server */
+    unsigned int rx_head;       /* first unparsed byte in rx_buf */
+    unsigned int rx_tail;       /* end of valid data in rx_buf */
+    pthread_mutex_t send_lock;  /* keeps concurrent writes to sockfd whole */
+    unsigned int nworkers;      /* forwarding threads, 0 handles packets inline */
+    struct sr_pipeline* pipe;   /* forwarding pipeline when nworkers > 0 */
+    sr_send_hook_fn send_hook;  /* replaces the server as frame sink if set */
+    void* send_hook_arg;
     pthread_attr_t attr;
-    FILE* logfile;
+    struct sr_caplog* caplog;   /* -l packet capture, 0 if off */
+    struct sr_stats* stats;     /* forwarding counters, see sr_stats.h */
 };
 
-/* -- sr_main.c -- */
+#define SR_BURST_MAX      32    /* frames handled a stage at a time */
+#define SR_BURST_PREFETCH 4     /* frames ahead to prefetch headers of */
+
+/* A frame lent to sr_handlepacket_burst, or one for sr_send_burst */
+struct sr_frame
+{
+    uint8_t* buf;
+    unsigned int len;
+    struct sr_if* iface;
+};
+
+/* -- sr_rt.c -- */
 int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_packet_if(struct sr_instance* , uint8_t* , unsigned int , const struct sr_if*);
+int sr_send_burst(struct sr_instance* , const struct sr_frame* , unsigned int );
+int sr_send_frames(struct sr_instance* , struct iovec* , int );
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
+void sr_handlepacket_if(struct sr_instance* , uint8_t * , unsigned int , struct sr_if* );
+void sr_handlepacket_burst(struct sr_instance* , struct sr_frame* , unsigned int );
 
 /* Add additional helper method declarations here! */
 void sr_handle_arprequest(struct sr_instance *sr, sr_arp_hdr_t *arp_pkt, unsigned int len,
-                          char *interface, uint8_t *packet);
+                          struct sr_if *in_if, uint8_t *packet);
 void sr_handle_arpreply(struct sr_instance *sr, sr_arp_hdr_t *arp_pkt, unsigned int len,
-                        char *interface);
-void sr_destined_for_router(struct sr_instance *sr, uint8_t *packet, unsigned int len, char *interface, struct sr_if *outgoing_iface, int echo);
+                        struct sr_if *in_if);
+void sr_destined_for_router(struct sr_instance *sr, uint8_t *packet, unsigned int len, struct sr_if *in_if, struct sr_if *outgoing_iface, int echo);
 
 void handle_arp_request(struct sr_instance *, sr_arp_hdr_t *, unsigned int, char *, uint8_t *);
 void handle_ip_request(struct sr_instance* , sr_ip_hdr_t* , unsigned int , char* , uint8_t*);
@@ -81,22 +124,18 @@ void handle_icmp_reply(struct sr_instance* , sr_icmp_hdr_t* , unsigned int , cha
 void handle_icmp_error_reply(struct sr_instance* , uint8_t *, size_t , char* , struct sr_if* , sr_ip_hdr_t*);
 void handle_icmp_echo_reply(struct sr_instance* , uint8_t*, unsigned int , char*, struct sr_if* , sr_ip_hdr_t* , sr_icmp_hdr_t*);
 
-void icmp_11_error(struct sr_instance *sr, uint8_t *error_pkt, size_t error_len, char *interface);
-void icmp_3_error(struct sr_instance *sr, uint8_t *error_pkt, size_t error_len, char *interface);
-
-void forward_packet(struct sr_instance *, unsigned int, struct sr_if *, uint8_t *, struct sr_arpentry *);
-void sr_handle_ip_forwarding(struct sr_instance *sr, uint8_t *forward_pkt, unsigned int len, char *interface);
+int sr_send_icmp_error(struct sr_instance *sr, const uint8_t *pkt, uint8_t type, uint8_t code,
+                       struct sr_if *out_if, uint32_t src_ip);
 
-void create_ip_forwarding_error_packet(uint8_t *error_pkt, uint8_t *forward_pkt, struct sr_if *incoming_if,
-                                       size_t error_pkt_len);
+void forward_packet(struct sr_instance *, unsigned int, struct sr_if *, uint8_t *, const struct sr_arpentry *);
+void sr_handle_ip_forwarding(struct sr_instance *sr, uint8_t *forward_pkt, unsigned int len, struct sr_if *in_if);
 
 uint8_t *create_icmp_reply_packet(struct sr_instance *sr, uint8_t *packet, unsigned int len,
                                       char *incoming_iface_name, struct sr_if *outgoing_iface, sr_ip_hdr_t *req_ip_hdr);
 
-struct sr_rt *sr_lookup_route(struct sr_rt *, uint32_t ip); // from sr_arpcache.h
-
 /* -- sr_if.c -- */
 struct sr_if *sr_get_interface(struct sr_instance *, const char *);
+struct sr_if *sr_get_interface_by_index(struct sr_instance *, unsigned int);
 struct sr_if *get_interface_from_ip(struct sr_instance *, uint32_t);
 struct sr_if *get_interface_from_eth(struct sr_instance *, uint8_t *);
 void sr_add_interface(struct sr_instance *, const char *);
@@ -8,6 +8,10 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <time.h>
 
 
 #include <sys/socket.h>
@@ -16,14 +20,24 @@
 #include <arpa/inet.h>
 
 #include "sr_rt.h"
+#include "sr_lpm.h"
+#include "sr_rtbin.h"
+#include "sr_epoch.h"
 #include "sr_router.h"
 
+static struct sr_fib* sr_fib_group(struct sr_fib* fib);
+
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_fib_load(..)
+ * Scope: Global
+ *
+ * Read a routing table file, text or an image compiled by sr_rtc, into
+ * a new, unpublished sr_fib with its lookup index built.  Returns NULL
+ * on error.
  *
  *---------------------------------------------------------------------*/
 
-int sr_load_rt(struct sr_instance* sr,const char* filename)
+struct sr_fib* sr_fib_load(const char* filename)
 {
     FILE* fp;
     char  line[BUFSIZ];
@@ -34,99 +48,452 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
     struct in_addr dest_addr;
     struct in_addr gw_addr;
     struct in_addr mask_addr;
-    int clear_routing_table = 0;
+    struct sr_fib* fib;
 
     /* -- REQUIRES -- */
     assert(filename);
     if( access(filename,R_OK) != 0)
     {
         perror("access");
-        return -1;
+        return 0;
     }
 
-    fp = fopen(filename,"r");
+    if(sr_rtbin_is_image(filename))
+    { return sr_rtbin_load(filename); }   /* groups come with the image */
+
+    if((fp = fopen(filename,"r")) == 0)
+    {
+        perror("fopen");
+        return 0;
+    }
+    if((fib = (struct sr_fib*)calloc(1, sizeof(struct sr_fib))) == 0)
+    {
+        fprintf(stderr, "Error loading routing table, out of memory\n");
+        fclose(fp);
+        return 0;
+    }
 
     while( fgets(line,BUFSIZ,fp) != 0)
     {
-        sscanf(line,"%s %s %s %s",dest,gw,mask,iface);
+        if(sscanf(line,"%31s %31s %31s %31s",dest,gw,mask,iface) != 4)
+        { continue; } /* -- blank line -- */
         if(inet_aton(dest,&dest_addr) == 0)
         { 
             fprintf(stderr,
                     "Error loading routing table, cannot convert %s to valid IP\n",
                     dest);
-            return -1; 
+            goto fail;
         }
         if(inet_aton(gw,&gw_addr) == 0)
         { 
             fprintf(stderr,
                     "Error loading routing table, cannot convert %s to valid IP\n",
                     gw);
-            return -1; 
+            goto fail;
         }
         if(inet_aton(mask,&mask_addr) == 0)
         { 
             fprintf(stderr,
                     "Error loading routing table, cannot convert %s to valid IP\n",
                     mask);
-            return -1; 
+            goto fail;
         }
-        if( clear_routing_table == 0 ){
-            printf("Loading routing table from server, clear local routing table.\n");
-            sr->routing_table = 0;
-            clear_routing_table = 1;
-        }
-        sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
+        sr_add_rt_entry(fib,dest_addr,gw_addr,mask_addr,iface);
     } /* -- while -- */
+    fclose(fp);
+
+    /* -- build the lookup table in one pass now that the list is complete -- */
+    if((fib->lpm = sr_lpm_build(fib->routes)) == 0)
+    {
+        fprintf(stderr, "Error building routing lookup table, out of memory\n");
+        sr_fib_destroy(fib);
+        return 0;
+    }
+    return sr_fib_group(fib);
+
+fail:
+    fclose(fp);
+    sr_fib_destroy(fib);
+    return 0;
+} /* -- sr_fib_load -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_destroy(..)
+ * Scope: Global
+ *
+ * Free a routing table that no thread can reach any more.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_destroy(struct sr_fib* fib)
+{
+    struct sr_rt_block* block;
+
+    if(!fib)
+    { return; }
+
+    while((block = fib->blocks) != 0)
+    {
+        fib->blocks = block->next;
+        free(block);
+    }
+    sr_lpm_destroy(fib->lpm);
+    free(fib->ecmp);
+    free(fib);
+} /* -- sr_fib_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_group(..)
+ * Scope: Local
+ *
+ * Last step of loading a text table: group fib's equal cost routes.  Returns fib, or
+ * NULL (with fib freed) if that fails or fib is NULL.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_fib* sr_fib_group(struct sr_fib* fib)
+{
+    if(fib && sr_ecmp_build(fib) != 0)
+    {
+        sr_fib_destroy(fib);
+        return 0;
+    }
+    return fib;
+} /* -- sr_fib_group -- */
+
+static int sr_fib_check(struct sr_instance* sr, const struct sr_fib* fib);
+
+static void sr_fib_free(void* fib)
+{
+    sr_fib_destroy((struct sr_fib*)fib);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_publish(..)
+ * Scope: Local
+ *
+ * Make fib the routing table every new lookup uses, then free the old
+ * one once the lookups still using it are done.  Blocks the caller, not
+ * forwarding, until then.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_fib_publish(struct sr_instance* sr, struct sr_fib* fib)
+{
+    struct sr_fib* old = __atomic_exchange_n(&(sr->fib), fib, __ATOMIC_SEQ_CST);
+    struct timespec nap = { 0, 1000000 };
+
+    /* -- flows learned from the old table must not outlive it -- */
+    __atomic_add_fetch(&(sr->rt_gen), 1, __ATOMIC_RELEASE);
+
+    if(old)
+    { sr_epoch_retire(sr_fib_free, old); }
+    while(sr_epoch_reclaim() > 0)
+    { nanosleep(&nap, 0); }
+} /* -- sr_fib_publish -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_load_rt(..)
+ * Scope: Global
+ *
+ * Read filename and make it the routing table, replacing any loaded
+ * before.  Returns 0 on success, -1 if the file could not be read.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_load_rt(struct sr_instance* sr,const char* filename)
+{
+    struct sr_fib* fib;
 
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if((fib = sr_fib_load(filename)) == 0)
+    { return -1; }
+
+    /* -- sr_reload_rt's watcher reports its own reloads -- */
+    if(sr->fib)
+    { printf("Loading routing table from server, clear local routing table.\n"); }
+    sr_fib_publish(sr, fib);
     return 0; /* -- success -- */
 } /* -- sr_load_rt -- */
 
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_reload_rt(..)
+ * Scope: Global
+ *
+ * sr_load_rt for a router that is already forwarding: a table that is
+ * empty or names an interface the router does not have is refused and
+ * the current one stays.  Returns 0 on success, -1 otherwise.
  *
  *---------------------------------------------------------------------*/
 
-void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
-struct in_addr gw, struct in_addr mask,char* if_name)
+int sr_reload_rt(struct sr_instance* sr,const char* filename)
 {
-    struct sr_rt* rt_walker = 0;
+    struct sr_fib* fib;
+    int bad;
 
     /* -- REQUIRES -- */
-    assert(if_name);
     assert(sr);
 
-    /* -- empty list special case -- */
-    if(sr->routing_table == 0)
+    if((fib = sr_fib_load(filename)) == 0)
+    { return -1; }
+
+    if(fib->routes == 0)
     {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-        assert(sr->routing_table);
-        sr->routing_table->next = 0;
-        sr->routing_table->dest = dest;
-        sr->routing_table->gw   = gw;
-        sr->routing_table->mask = mask;
-        strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+        fprintf(stderr, "Routing table %s is empty, keeping the current one\n",
+                filename);
+        sr_fib_destroy(fib);
+        return -1;
+    }
+    if((bad = sr_fib_check(sr, fib)) != 0)
+    {
+        fprintf(stderr, "Routing table %s has %d routes over unknown interfaces, "
+                "keeping the current one\n", filename, bad);
+        sr_fib_destroy(fib);
+        return -1;
+    }
 
-        return;
+    sr_fib_publish(sr, fib);
+    return 0;
+} /* -- sr_reload_rt -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_watch(..)
+ * Scope: Global
+ *
+ * Reload the routing table from filename, on a thread of its own, each
+ * time the process gets SIGHUP.  The handler only posts a semaphore, so
+ * forwarding is never interrupted for longer than that.  Returns 0 on
+ * success, -1 if the thread could not be started.  sr must outlive the
+ * thread, see sr_rt_unwatch.
+ *
+ *---------------------------------------------------------------------*/
+
+static sem_t sr_rt_hup;
+static struct sr_instance* sr_rt_watch_sr;
+static char* sr_rt_watch_path;
+static pthread_t sr_rt_watch_thread;
+static int sr_rt_watch_stop;
+
+static void sr_rt_hup_post(int sig)
+{
+    sem_post(&sr_rt_hup);
+}
+
+static void* sr_rt_watcher(void* arg)
+{
+    for(;;)
+    {
+        if(sem_wait(&sr_rt_hup) != 0)
+        { continue; } /* -- EINTR -- */
+        if(__atomic_load_n(&sr_rt_watch_stop, __ATOMIC_ACQUIRE))
+        { break; }
+
+        if(sr_reload_rt(sr_rt_watch_sr, sr_rt_watch_path) == 0)
+        { printf("Reloaded routing table from %s\n", sr_rt_watch_path); }
+        else
+        { fprintf(stderr, "Reloading routing table from %s failed\n", sr_rt_watch_path); }
+        fflush(stdout);
     }
+    return 0;
+}
+
+int sr_rt_watch(struct sr_instance* sr,const char* filename)
+{
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(filename);
+
+    if(sr_rt_watch_path)
+    { return -1; } /* -- one per process, SIGHUP is process wide -- */
+
+    if(sem_init(&sr_rt_hup, 0, 0) != 0 ||
+       (sr_rt_watch_path = strdup(filename)) == 0)
+    { return -1; }
+    sr_rt_watch_sr = sr;
+    sr_rt_watch_stop = 0;
 
-    /* -- find the end of the list -- */
-    rt_walker = sr->routing_table;
-    while(rt_walker->next){
-      rt_walker = rt_walker->next; 
+    if(pthread_create(&sr_rt_watch_thread, 0, sr_rt_watcher, 0) != 0)
+    {
+        free(sr_rt_watch_path);
+        sr_rt_watch_path = 0;
+        return -1;
     }
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-    assert(rt_walker->next);
-    rt_walker = rt_walker->next;
+    signal(SIGHUP, sr_rt_hup_post);
+    return 0;
+} /* -- sr_rt_watch -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_unwatch(..)
+ * Scope: Global
+ *
+ * Stop reloading on SIGHUP, waiting for a reload under way to finish.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_unwatch(void)
+{
+    if(!sr_rt_watch_path)
+    { return; }
+
+    signal(SIGHUP, SIG_IGN);
+    __atomic_store_n(&sr_rt_watch_stop, 1, __ATOMIC_RELEASE);
+    sem_post(&sr_rt_hup);
+    pthread_join(sr_rt_watch_thread, 0);
 
-    rt_walker->next = 0;
-    rt_walker->dest = dest;
-    rt_walker->gw   = gw;
-    rt_walker->mask = mask;
-    strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    sem_destroy(&sr_rt_hup);
+    free(sr_rt_watch_path);
+    sr_rt_watch_path = 0;
+} /* -- sr_rt_unwatch -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_add_rt_entry(..)
+ * Scope: Global
+ *
+ * Append a route to fib, which must not have been published yet.
+ * Routes are allocated SR_RT_BLOCK at a time and never move.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_add_rt_entry(struct sr_fib* fib, struct in_addr dest,
+struct in_addr gw, struct in_addr mask,char* if_name)
+{
+    struct sr_rt_block* block;
+    struct sr_rt* rt;
+
+    /* -- REQUIRES -- */
+    assert(if_name);
+    assert(fib);
+
+    block = fib->blocks;
+    if(block == 0 || block->used == block->cap)
+    {
+        block = (struct sr_rt_block*)malloc(sizeof(struct sr_rt_block) +
+                                            SR_RT_BLOCK * sizeof(struct sr_rt));
+        assert(block);
+        block->used = 0;
+        block->cap  = SR_RT_BLOCK;
+        block->next = fib->blocks;
+        fib->blocks = block;
+    }
+    rt = &(block->rt[block->used++]);
+
+    rt->next = 0;
+    rt->dest = dest;
+    rt->gw   = gw;
+    rt->mask = mask;
+    strncpy(rt->interface,if_name,sr_IFACE_NAMELEN);
+    sr_adj_init(&(rt->adj));
+    rt->ecmp = 0;
+
+    /* -- the tail pointer keeps this O(1), no walk down the list -- */
+    if(fib->tail)
+    { fib->tail->next = rt; }
+    else
+    { fib->routes = rt; }
+    fib->tail = rt;
+    fib->nroutes++;
 } /* -- sr_add_entry -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_lookup_route(..)
+ * Scope: Global
+ *
+ * Longest prefix match of ip (network byte order) against the routing
+ * table.  Returns NULL if no entry covers ip.  Call it, and use what it
+ * returns, inside an sr_epoch_enter/exit section.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_lookup_route(struct sr_instance* sr, uint32_t ip)
+{
+    struct sr_fib* fib;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if((fib = __atomic_load_n(&(sr->fib), __ATOMIC_ACQUIRE)) == 0)
+    { return 0; }
+
+    return sr_lpm_lookup(fib->lpm, ip);
+} /* -- sr_lookup_route -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_verify_routing_table()
+ * Scope: Global
+ *
+ * make sure the routing table is consistent with the interface list by
+ * verifying that all interfaces used in the routing table actually exist
+ * in the hardware.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  something other than zero on error
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_verify_routing_table(struct sr_instance* sr)
+{
+    struct sr_fib* fib;
+    int ret;
+
+    /* -- REQUIRES --*/
+    assert(sr);
+
+    sr_epoch_enter();
+    fib = __atomic_load_n(&(sr->fib), __ATOMIC_ACQUIRE);
+    if( (sr->if_list == 0) || (fib == 0) || (fib->routes == 0))
+    {
+        ret = 999; /* doh! */
+    }
+    else
+    {
+        ret = sr_fib_check(sr, fib);
+    }
+    sr_epoch_exit();
+
+    return ret;
+} /* -- sr_verify_routing_table -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_check(..)
+ * Scope: Local
+ *
+ * Number of routes in fib over interfaces sr does not have.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_fib_check(struct sr_instance* sr, const struct sr_fib* fib)
+{
+    const struct sr_rt* rt_walker = 0;
+    struct sr_if* if_walker = 0;
+    int ret = 0;
+
+    rt_walker = fib->routes;
+
+    while(rt_walker)
+    {
+        /* -- check to see if interface exists -- */
+        if_walker = sr->if_list;
+        while(if_walker)
+        {
+            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
+                    == 0)
+            { break; }
+            if_walker = if_walker->next;
+        }
+        if(if_walker == 0)
+        { ret++; } /* -- interface not found! -- */
+
+        rt_walker = rt_walker->next;
+    } /* -- while -- */
+
+    return ret;
+} /* -- sr_fib_check -- */
+
 /*---------------------------------------------------------------------
  * Method:
  *
@@ -134,17 +501,21 @@ struct in_addr gw, struct in_addr mask,char* if_name)
 
 void sr_print_routing_table(struct sr_instance* sr)
 {
+    struct sr_fib* fib;
     struct sr_rt* rt_walker = 0;
 
-    if(sr->routing_table == 0)
+    sr_epoch_enter();
+    fib = __atomic_load_n(&(sr->fib), __ATOMIC_ACQUIRE);
+    if(fib == 0 || fib->routes == 0)
     {
         printf(" *warning* Routing table empty \n");
+        sr_epoch_exit();
         return;
     }
 
     printf("Destination\tGateway\t\tMask\tIface\n");
 
-    rt_walker = sr->routing_table;
+    rt_walker = fib->routes;
     
     sr_print_routing_entry(rt_walker);
     while(rt_walker->next)
@@ -152,6 +523,7 @@ void sr_print_routing_table(struct sr_instance* sr)
         rt_walker = rt_walker->next; 
         sr_print_routing_entry(rt_walker);
     }
+    sr_epoch_exit();
 
 } /* -- sr_print_routing_table -- */
 
@@ -4,6 +4,24 @@
  *
  * Methods and datastructures for handeling the routing table
  *
+ * The routing table in use is a struct sr_fib: the route list and its
+ * lookup index, built together and never changed once published.  A new
+ * table is read into a fresh sr_fib off to the side and then swapped in
+ * with one atomic store, so forwarding threads see either the old table
+ * or the new one, never a mix, and take no locks for it.  The old table
+ * is freed through epoch based reclamation (sr_epoch.h) once no thread
+ * can still be using a route from it; lookups, and every use of the
+ * route they return, must run inside an sr_epoch_enter/exit section.
+ *
+ * kill -HUP rereads the routing table file (sr_rt_watch).  Replace the
+ * file with a rename so a reload never reads it half written.
+ *
+ * The file is either text, one "dest gw mask iface" route per line, or
+ * an image compiled from one by sr_rtc (sr_rtbin.h), which is mapped
+ * with its lookup index already built.  Routes to the same destination
+ * and mask are grouped for equal cost multipath (sr_ecmp.h) as a table
+ * is loaded.
+ *
  *---------------------------------------------------------------------------*/
 
 #ifndef sr_RT_H
@@ -16,6 +34,8 @@
 #include <netinet/in.h>
 
 #include "sr_if.h"
+#include "sr_adj.h"
+#include "sr_ecmp.h"
 
 /* ----------------------------------------------------------------------------
  * struct sr_rt
@@ -30,15 +50,51 @@ struct sr_rt
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    struct sr_adj adj;      /* next hop via gw, see sr_adj.h */
+    struct sr_ecmp* ecmp;   /* equal cost group this route leads, see sr_ecmp.h */
     struct sr_rt* next;
 };
 
+#define SR_RT_BLOCK 4096    /* routes per allocation */
+
+struct sr_rt_block
+{
+    struct sr_rt_block* next;
+    unsigned int used;
+    unsigned int cap;
+    struct sr_rt rt[];
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib
+ *
+ * A complete routing table, read only once published
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib
+{
+    struct sr_rt*  routes;  /* in file order */
+    struct sr_rt*  tail;    /* last of routes, sr_add_rt_entry appends here */
+    unsigned int   nroutes;
+    struct sr_rt_block* blocks; /* where routes live, newest first */
+    struct sr_lpm* lpm;     /* longest prefix match index over routes */
+    struct sr_ecmp* ecmp;   /* equal cost groups, one allocation */
+    unsigned int   necmp;
+};
+
 
 int sr_load_rt(struct sr_instance*,const char*);
-void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
+int sr_reload_rt(struct sr_instance*,const char*);
+int sr_rt_watch(struct sr_instance*,const char*);
+void sr_rt_unwatch(void);
+void sr_add_rt_entry(struct sr_fib*, struct in_addr,struct in_addr,
                   struct in_addr, char*);
+struct sr_fib* sr_fib_load(const char* filename);
+void sr_fib_destroy(struct sr_fib* fib);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
+struct sr_rt* sr_lookup_route(struct sr_instance* sr, uint32_t ip);
 
 
 #endif  /* --  sr_RT_H -- */
@@ -0,0 +1,492 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rtbin.c
+ *
+ * Description:
+ *
+ * Writing and mapping compiled routing table images, see sr_rtbin.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+
+#include "sr_rtbin.h"
+#include "sr_rt.h"
+#include "sr_lpm.h"
+
+/* bytes of the image after the header, 0 if that does not fit a size_t */
+static size_t sr_rtbin_body_len(uint32_t nroutes, uint32_t nchunks, uint32_t necmp)
+{
+    uint64_t len = (uint64_t)SR_LPM_L1_SZ * sizeof(uint32_t)
+                 + (uint64_t)nchunks * SR_LPM_CHUNK_SZ * sizeof(uint32_t)
+                 + (uint64_t)nroutes * sizeof(uint32_t)
+                 + (uint64_t)nroutes * sizeof(struct sr_rtbin_route)
+                 + (((uint64_t)necmp + 3) & ~(uint64_t)3) * sizeof(uint32_t);
+
+    return (len == (size_t)len) ? (size_t)len : 0;
+}
+
+/* Four interleaved pairs of running sums, so the additions do not all
+   wait on each other */
+struct sr_rtbin_sum
+{
+    uint64_t a[4];
+    uint64_t b[4];
+};
+
+/* add n words (a multiple of 4) to sum */
+static void sr_rtbin_sum_add(struct sr_rtbin_sum* sum, const uint32_t* w, size_t n)
+{
+    size_t i;
+    int k;
+
+    for(i = 0; i < n; i += 4)
+    {
+        for(k = 0; k < 4; k++)
+        {
+            sum->a[k] += w[i + k];
+            sum->b[k] += sum->a[k];
+        }
+    }
+}
+
+static uint64_t sr_rtbin_sum_end(const struct sr_rtbin_sum* sum)
+{
+    uint64_t h = 0;
+    int k;
+
+    for(k = 0; k < 4; k++)
+    { h = (h ^ sum->a[k] ^ (sum->b[k] * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL; }
+    return h;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_rtbin_cksum(..)
+ * Scope: Global
+ *
+ * Position dependent sum over the 32 bit words of buf (len a multiple
+ * of 16), running sums as in Fletcher's checksum.  Catches damaged,
+ * truncated and reordered images at memory speed; it is not meant to
+ * stand up to anyone forging one.
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_rtbin_cksum(const void* buf, size_t len)
+{
+    struct sr_rtbin_sum sum;
+
+    memset(&sum, 0, sizeof(sum));
+    sr_rtbin_sum_add(&sum, (const uint32_t*)buf, len / sizeof(uint32_t));
+    return sr_rtbin_sum_end(&sum);
+} /* -- sr_rtbin_cksum -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rtbin_is_image(..)
+ * Scope: Global
+ *
+ * 1 if filename starts with SR_RTBIN_MAGIC, 0 otherwise.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rtbin_is_image(const char* filename)
+{
+    char magic[sizeof(SR_RTBIN_MAGIC) - 1];
+    int fd, ret = 0;
+
+    if((fd = open(filename, O_RDONLY)) < 0)
+    { return 0; }
+    if(read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+       memcmp(magic, SR_RTBIN_MAGIC, sizeof(magic)) == 0)
+    { ret = 1; }
+    close(fd);
+    return ret;
+} /* -- sr_rtbin_is_image -- */
+
+/* 0 if every slot of n is empty, a chunk below nchunks or a route up to
+   nroutes; -1 otherwise.  Written without branches so it vectorizes. */
+static int sr_rtbin_check_slots(const uint32_t* slots, size_t n,
+                                uint32_t nchunks, uint32_t nroutes)
+{
+    uint32_t bad = 0;
+    size_t i;
+
+    for(i = 0; i < n; i++)
+    {
+        uint32_t e = slots[i];
+        uint32_t limit = (e & SR_LPM_CHUNK) ? (SR_LPM_CHUNK | nchunks) : nroutes + 1;
+
+        bad |= (e >= limit);
+    }
+    return bad ? -1 : 0;
+}
+
+/* Checksum the image body and check its trie in one pass, a block at a
+   time while it is in cache.  0 if both are fine, -1 otherwise. */
+static int sr_rtbin_verify(const struct sr_rtbin_hdr* hdr, const uint32_t* body,
+                           size_t body_len, const char** why)
+{
+    struct sr_rtbin_sum sum;
+    size_t nslots = SR_LPM_L1_SZ + (size_t)hdr->nchunks * SR_LPM_CHUNK_SZ;
+    size_t nwords = body_len / sizeof(uint32_t);
+    size_t i, step;
+    int bad = 0;
+
+    memset(&sum, 0, sizeof(sum));
+    for(i = 0; i < nslots; i += step)
+    {
+        step = (nslots - i < 4096) ? nslots - i : 4096;
+        sr_rtbin_sum_add(&sum, body + i, step);
+        bad |= sr_rtbin_check_slots(body + i, step, hdr->nchunks, hdr->nroutes);
+    }
+    sr_rtbin_sum_add(&sum, body + nslots, nwords - nslots);
+
+    if(sr_rtbin_sum_end(&sum) != hdr->cksum)
+    {
+        *why = "checksum mismatch";
+        return -1;
+    }
+    if(bad)
+    {
+        *why = "trie entry out of range";
+        return -1;
+    }
+    return 0;
+}
+
+/* Make the equal cost groups of fib from the n entries of ecmp, routes
+   by file order index in byidx.  0 on success, -1 with why set if out
+   of memory or the list is malformed. */
+static int sr_rtbin_load_ecmp(struct sr_fib* fib, const uint32_t* ecmp, uint32_t n,
+                              struct sr_rt** byidx, uint32_t nroutes, const char** why)
+{
+    struct sr_rt** members;
+    uint32_t* sizes;
+    uint32_t  i, ngroups = 0;
+    int ret = -1;
+
+    if(n == 0)
+    { return 0; }
+    members = (struct sr_rt**)malloc(n * sizeof(struct sr_rt*));
+    sizes   = (uint32_t*)malloc(n * sizeof(uint32_t));
+    if(!members || !sizes)
+    { goto done; }
+
+    *why = "equal cost group list malformed";
+    for(i = 0; i < n; i++)
+    {
+        uint32_t idx = ecmp[i] & ~SR_RTBIN_ECMP_FIRST;
+
+        if(idx >= nroutes)
+        { goto done; }
+        if(ecmp[i] & SR_RTBIN_ECMP_FIRST)
+        {
+            if(ngroups && sizes[ngroups - 1] < 2)
+            { goto done; }
+            sizes[ngroups++] = 0;
+        }
+        if(ngroups == 0 || sizes[ngroups - 1] == SR_ECMP_MAX_MEMBERS)
+        { goto done; }
+        sizes[ngroups - 1]++;
+        members[i] = byidx[idx];
+    }
+    if(sizes[ngroups - 1] < 2)
+    { goto done; }
+
+    *why = "out of memory";
+    ret = sr_ecmp_set(fib, members, sizes, ngroups);
+
+done:
+    free(members);
+    free(sizes);
+    return ret;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_rtbin_load(..)
+ * Scope: Global
+ *
+ * Map the image in filename and make an unpublished sr_fib of it.  The
+ * trie is used in place; the fib owns the mapping from here on and
+ * unmaps it in sr_fib_destroy.  Returns NULL, having said why, if the
+ * image cannot be read or fails any check.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_fib* sr_rtbin_load(const char* filename)
+{
+    const struct sr_rtbin_hdr*   hdr;
+    const struct sr_rtbin_route* routes;
+    const uint32_t* l1;
+    const uint32_t* chunks;
+    const uint32_t* order;
+    const uint32_t* ecmp;
+    struct sr_fib*  fib = 0;
+    struct sr_lpm*  lpm = 0;
+    struct sr_rt**  byidx = 0;
+    const char*     why = "out of memory";
+    struct stat     st;
+    uint8_t* map;
+    size_t   len, body;
+    uint32_t i;
+    int      fd, flags = MAP_PRIVATE;
+
+    if((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "Error loading routing table image %s: %s\n",
+                filename, strerror(errno));
+        if(fd >= 0)
+        { close(fd); }
+        return 0;
+    }
+    len = (size_t)st.st_size;
+    if(len < sizeof(struct sr_rtbin_hdr))
+    {
+        fprintf(stderr, "Error loading routing table image %s: truncated\n", filename);
+        close(fd);
+        return 0;
+    }
+
+#ifdef MAP_POPULATE
+    /* -- every page is read by the checksum anyway, fault them in at once -- */
+    flags |= MAP_POPULATE;
+#endif
+    map = (uint8_t*)mmap(0, len, PROT_READ, flags, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        fprintf(stderr, "Error loading routing table image %s: %s\n",
+                filename, strerror(errno));
+        return 0;
+    }
+
+    hdr = (const struct sr_rtbin_hdr*)map;
+    body = sr_rtbin_body_len(hdr->nroutes, hdr->nchunks, hdr->necmp);
+    if(memcmp(hdr->magic, SR_RTBIN_MAGIC, sizeof(hdr->magic)) != 0)
+    { why = "not a routing table image"; goto fail; }
+    if(hdr->endian != SR_RTBIN_ENDIAN)
+    { why = "written on a machine of the other byte order"; goto fail; }
+    if(hdr->version != SR_RTBIN_VERSION)
+    { why = "unsupported version, recompile it with this sr_rtc"; goto fail; }
+    if(hdr->l1_bits != SR_LPM_L1_BITS || hdr->chunk_sz != SR_LPM_CHUNK_SZ)
+    { why = "built for another trie layout, recompile it with this sr_rtc"; goto fail; }
+    if(body == 0 || hdr->size != len || len != sizeof(struct sr_rtbin_hdr) + body)
+    { why = "truncated or size mismatch"; goto fail; }
+
+    l1     = (const uint32_t*)(map + sizeof(struct sr_rtbin_hdr));
+    chunks = l1 + SR_LPM_L1_SZ;
+    order  = chunks + (size_t)hdr->nchunks * SR_LPM_CHUNK_SZ;
+    routes = (const struct sr_rtbin_route*)(order + hdr->nroutes);
+    ecmp   = (const uint32_t*)(routes + hdr->nroutes);
+
+    if(sr_rtbin_verify(hdr, l1, body, &why) != 0)
+    { goto fail; }
+    for(i = 0; i < hdr->nroutes; i++)
+    {
+        if(order[i] >= hdr->nroutes)
+        { why = "route index out of range"; goto fail; }
+    }
+
+    /* -- routes are copied out, their adjacencies get written to -- */
+    if((fib = (struct sr_fib*)calloc(1, sizeof(struct sr_fib))) == 0 ||
+       (lpm = (struct sr_lpm*)calloc(1, sizeof(struct sr_lpm))) == 0 ||
+       (hdr->nroutes &&
+        ((byidx = (struct sr_rt**)malloc(hdr->nroutes * sizeof(struct sr_rt*))) == 0 ||
+         (lpm->routes = (struct sr_rt**)malloc(hdr->nroutes * sizeof(struct sr_rt*))) == 0)))
+    { goto fail; }
+
+    for(i = 0; i < hdr->nroutes; i++)
+    {
+        struct in_addr dest, gw, mask;
+        char iface[sr_IFACE_NAMELEN];
+
+        dest.s_addr = routes[i].dest;
+        gw.s_addr   = routes[i].gw;
+        mask.s_addr = routes[i].mask;
+        memcpy(iface, routes[i].iface, sr_IFACE_NAMELEN);
+        iface[sr_IFACE_NAMELEN - 1] = 0;
+
+        sr_add_rt_entry(fib, dest, gw, mask, iface);
+        byidx[i] = fib->tail;
+    }
+    for(i = 0; i < hdr->nroutes; i++)
+    { lpm->routes[i] = byidx[order[i]]; }
+    if(sr_rtbin_load_ecmp(fib, ecmp, hdr->necmp, byidx, hdr->nroutes, &why) != 0)
+    { goto fail; }
+    free(byidx);
+
+    lpm->l1        = (uint32_t*)l1;
+    lpm->chunks    = (uint32_t*)chunks;
+    lpm->nchunks   = hdr->nchunks;
+    lpm->chunk_cap = hdr->nchunks;
+    lpm->nroutes   = hdr->nroutes;
+    lpm->route_cap = hdr->nroutes;
+    lpm->map       = map;
+    lpm->map_len   = len;
+    fib->lpm = lpm;
+    return fib;
+
+fail:
+    fprintf(stderr, "Error loading routing table image %s: %s\n", filename, why);
+    if(lpm)
+    { free(lpm->routes); }
+    free(lpm);
+    free(byidx);
+    sr_fib_destroy(fib);
+    munmap(map, len);
+    return 0;
+} /* -- sr_rtbin_load -- */
+
+/* for finding a route's position in file order by its address */
+struct sr_rtbin_pos
+{
+    const struct sr_rt* rt;
+    uint32_t idx;
+};
+
+static int sr_rtbin_pos_cmp(const void* a, const void* b)
+{
+    const struct sr_rt* x = ((const struct sr_rtbin_pos*)a)->rt;
+    const struct sr_rt* y = ((const struct sr_rtbin_pos*)b)->rt;
+
+    return (x > y) - (x < y);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_rtbin_write(..)
+ * Scope: Global
+ *
+ * Write fib, routes and trie, as an image to filename.  The image goes
+ * to filename.tmp first and is renamed over filename when complete, so a
+ * router reloading filename never maps half of one.  Returns 0 on
+ * success, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rtbin_write(const struct sr_fib* fib, const char* filename)
+{
+    const struct sr_lpm*   lpm = fib->lpm;
+    const struct sr_rt*    rt;
+    struct sr_rtbin_hdr    hdr;
+    struct sr_rtbin_route* routes;
+    struct sr_rtbin_pos*   pos = 0;
+    uint32_t* l1;
+    uint32_t* chunks;
+    uint32_t* order;
+    uint32_t* ecmp;
+    uint8_t*  body = 0;
+    size_t    body_len;
+    char      tmp[BUFSIZ];
+    uint32_t  i, m, n = lpm->nroutes, necmp = 0;
+    FILE*     fp;
+
+    for(i = 0; i < fib->necmp; i++)
+    { necmp += fib->ecmp[i].nmembers; }
+    if(n != fib->nroutes || n > SR_RTBIN_ECMP_FIRST ||
+       (body_len = sr_rtbin_body_len(n, lpm->nchunks, necmp)) == 0 ||
+       (size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", filename) >= sizeof(tmp))
+    {
+        fprintf(stderr, "sr_rtbin_write: table too large\n");
+        return -1;
+    }
+    if((body = (uint8_t*)calloc(1, body_len)) == 0 ||
+       (n && (pos = (struct sr_rtbin_pos*)malloc(n * sizeof(struct sr_rtbin_pos))) == 0))
+    {
+        fprintf(stderr, "sr_rtbin_write: out of memory\n");
+        free(body);
+        return -1;
+    }
+
+    l1     = (uint32_t*)body;
+    chunks = l1 + SR_LPM_L1_SZ;
+    order  = chunks + (size_t)lpm->nchunks * SR_LPM_CHUNK_SZ;
+    routes = (struct sr_rtbin_route*)(order + n);
+    ecmp   = (uint32_t*)(routes + n);
+
+    memcpy(l1, lpm->l1, SR_LPM_L1_SZ * sizeof(uint32_t));
+    memcpy(chunks, lpm->chunks, (size_t)lpm->nchunks * SR_LPM_CHUNK_SZ * sizeof(uint32_t));
+
+    for(rt = fib->routes, i = 0; rt; rt = rt->next, i++)
+    {
+        routes[i].dest = rt->dest.s_addr;
+        routes[i].gw   = rt->gw.s_addr;
+        routes[i].mask = rt->mask.s_addr;
+        memcpy(routes[i].iface, rt->interface,
+               strnlen(rt->interface, sr_IFACE_NAMELEN - 1));
+        pos[i].rt  = rt;
+        pos[i].idx = i;
+    }
+
+    /* -- the trie numbers routes in insertion order, shortest prefix
+          first; order maps that back to file order -- */
+    qsort(pos, n, sizeof(struct sr_rtbin_pos), sr_rtbin_pos_cmp);
+    for(i = 0; i < n; i++)
+    {
+        struct sr_rtbin_pos key, *hit;
+
+        key.rt = lpm->routes[i];
+        hit = (struct sr_rtbin_pos*)bsearch(&key, pos, n, sizeof(struct sr_rtbin_pos),
+                                            sr_rtbin_pos_cmp);
+        order[i] = hit->idx;
+    }
+    for(i = 0; i < fib->necmp; i++)
+    {
+        for(m = 0; m < fib->ecmp[i].nmembers; m++)
+        {
+            struct sr_rtbin_pos key, *hit;
+
+            key.rt = fib->ecmp[i].members[m];
+            hit = (struct sr_rtbin_pos*)bsearch(&key, pos, n, sizeof(struct sr_rtbin_pos),
+                                                sr_rtbin_pos_cmp);
+            *ecmp++ = hit->idx | (m == 0 ? SR_RTBIN_ECMP_FIRST : 0);
+        }
+    }
+    free(pos);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SR_RTBIN_MAGIC, sizeof(hdr.magic));
+    hdr.version  = SR_RTBIN_VERSION;
+    hdr.endian   = SR_RTBIN_ENDIAN;
+    hdr.l1_bits  = SR_LPM_L1_BITS;
+    hdr.chunk_sz = SR_LPM_CHUNK_SZ;
+    hdr.nroutes  = n;
+    hdr.nchunks  = lpm->nchunks;
+    hdr.necmp    = necmp;
+    hdr.size     = sizeof(hdr) + body_len;
+    hdr.cksum    = sr_rtbin_cksum(body, body_len);
+
+    if((fp = fopen(tmp, "wb")) == 0)
+    {
+        perror("fopen(..):sr_rtbin_write");
+        free(body);
+        return -1;
+    }
+    if(fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+       fwrite(body, body_len, 1, fp) != 1 ||
+       fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+    {
+        perror("fwrite(..):sr_rtbin_write");
+        fclose(fp);
+        unlink(tmp);
+        free(body);
+        return -1;
+    }
+    fclose(fp);
+    free(body);
+
+    if(rename(tmp, filename) != 0)
+    {
+        perror("rename(..):sr_rtbin_write");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+} /* -- sr_rtbin_write -- */
@@ -0,0 +1,87 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rtbin.h
+ *
+ * Description:
+ *
+ * Compiled routing table image.  sr_rtc reads a text routing table once,
+ * builds its lookup index, and writes both out; the router then maps the
+ * image instead of parsing text and building the index again.  The first
+ * and second level arrays of the trie (sr_lpm.h) are used straight from
+ * the mapping.  Only the route entries themselves are copied out, since
+ * each carries a next hop adjacency the router writes to.
+ *
+ * Layout, every field in the byte order of the machine that wrote it (a
+ * router refuses an image of the other order):
+ *
+ *    struct sr_rtbin_hdr                 56 bytes
+ *    uint32_t l1[SR_LPM_L1_SZ]           first level of the trie
+ *    uint32_t chunks[nchunks * 256]      second and third levels
+ *    uint32_t order[nroutes]             trie route index -> route
+ *    struct sr_rtbin_route[nroutes]      routes in text file order
+ *    uint32_t ecmp[necmp]                equal cost groups (sr_ecmp.h)
+ *    uint32_t pad[]                      zeros, up to a multiple of 16 bytes
+ *
+ * ecmp lists the members of every group by file order index, a group's
+ * first member with SR_RTBIN_ECMP_FIRST set, so a router loading the
+ * image does not have to find them again.
+ *
+ * cksum covers everything after the header.  An image is also checked
+ * for trie entries pointing past the chunks or routes it holds, so a
+ * damaged image is refused instead of crashing the router.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RTBIN_H
+#define SR_RTBIN_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+#include "sr_protocol.h"
+
+#define SR_RTBIN_MAGIC   "SRRTBIN\n"
+#define SR_RTBIN_VERSION 2
+#define SR_RTBIN_ENDIAN  0x01020304u
+
+#define SR_RTBIN_ECMP_FIRST 0x80000000u
+
+struct sr_fib;
+
+struct sr_rtbin_hdr
+{
+    char     magic[8];          /* SR_RTBIN_MAGIC, no terminating 0 */
+    uint32_t version;           /* SR_RTBIN_VERSION */
+    uint32_t endian;            /* SR_RTBIN_ENDIAN as written */
+    uint32_t l1_bits;           /* SR_LPM_L1_BITS */
+    uint32_t chunk_sz;          /* SR_LPM_CHUNK_SZ */
+    uint32_t nroutes;
+    uint32_t nchunks;
+    uint64_t size;              /* whole image, header included */
+    uint64_t cksum;             /* sr_rtbin_cksum of the rest */
+    uint32_t necmp;             /* entries of ecmp */
+    uint8_t  pad[4];
+};
+
+_Static_assert(sizeof(struct sr_rtbin_hdr) == 56, "sr_rtbin_hdr is part of the image format");
+
+struct sr_rtbin_route
+{
+    uint32_t dest;              /* network byte order */
+    uint32_t gw;
+    uint32_t mask;
+    char     iface[sr_IFACE_NAMELEN];
+};
+
+int            sr_rtbin_is_image(const char* filename);
+struct sr_fib* sr_rtbin_load(const char* filename);
+int            sr_rtbin_write(const struct sr_fib* fib, const char* filename);
+uint64_t       sr_rtbin_cksum(const void* buf, size_t len);
+
+#endif /* -- SR_RTBIN_H -- */
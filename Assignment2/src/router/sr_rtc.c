@@ -0,0 +1,188 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rtc.c
+ *
+ * Description:
+ *
+ * Routing table compiler.  Reads a text routing table, builds its lookup
+ * trie and writes both as an image (sr_rtbin.h) that sr -r, sr_replay -r
+ * and the SIGHUP reload map directly, skipping the parse and the build.
+ *
+ * Usage: sr_rtc rtable image
+ *        sr_rtc -c image [rtable]
+ *
+ * -c checks an image and times loading it.  Given the text table it was
+ * compiled from, it also times loading that and compares the two: every
+ * route's first and last address and RTC_CHECK_RANDOM random ones must
+ * find the same route in both, and where that route leads an equal cost
+ * group, the same member for the same flow hash.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include <netinet/in.h>
+
+#include "sr_rt.h"
+#include "sr_lpm.h"
+#include "sr_rtbin.h"
+
+#define RTC_CHECK_RANDOM 1000000
+
+static double rtc_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(char* argv0)
+{
+    printf("Routing table compiler\n");
+    printf("Format: %s rtable image\n", argv0);
+    printf("        %s -c image [rtable]\n", argv0);
+} /* -- usage -- */
+
+static struct sr_fib* rtc_load(const char* filename, const char* what)
+{
+    struct sr_fib* fib;
+    double t0 = rtc_now();
+
+    if((fib = sr_fib_load(filename)) == 0)
+    {
+        fprintf(stderr, "Error loading %s\n", filename);
+        exit(1);
+    }
+    printf("%s %s: %u routes, %u trie chunks, loaded in %.3f ms\n", what, filename,
+           fib->nroutes, fib->lpm->nchunks, (rtc_now() - t0) * 1e3);
+    return fib;
+}
+
+/* 1 if a and b are the same route, or both no route */
+static int rtc_same(const struct sr_rt* a, const struct sr_rt* b)
+{
+    if(!a || !b)
+    { return a == b; }
+    return a->dest.s_addr == b->dest.s_addr && a->mask.s_addr == b->mask.s_addr &&
+           a->gw.s_addr == b->gw.s_addr &&
+           strncmp(a->interface, b->interface, sr_IFACE_NAMELEN) == 0;
+}
+
+/* rtc_same for the routes found, and for the members they pick for hash */
+static int rtc_same_path(const struct sr_rt* a, const struct sr_rt* b, uint32_t hash)
+{
+    if(!rtc_same(a, b))
+    { return 0; }
+    if(!a || (!a->ecmp && !b->ecmp))
+    { return 1; }
+    if(!a->ecmp || !b->ecmp)
+    { return 0; }
+    return rtc_same(sr_ecmp_pick(a->ecmp, hash), sr_ecmp_pick(b->ecmp, hash));
+}
+
+static unsigned long rtc_compare(const struct sr_fib* image, const struct sr_fib* text)
+{
+    const struct sr_rt* rt;
+    unsigned long bad = 0, n = 0;
+    uint64_t rng = 0x5eed5eedULL;
+    uint32_t i;
+
+    for(rt = text->routes; rt; rt = rt->next)
+    {
+        uint32_t first = rt->dest.s_addr & rt->mask.s_addr;
+        uint32_t last  = first | ~rt->mask.s_addr;
+
+        bad += !rtc_same_path(sr_lpm_lookup(image->lpm, first), sr_lpm_lookup(text->lpm, first), first);
+        bad += !rtc_same_path(sr_lpm_lookup(image->lpm, last), sr_lpm_lookup(text->lpm, last), last);
+        n += 2;
+    }
+    for(i = 0; i < RTC_CHECK_RANDOM; i++)
+    {
+        uint32_t ip;
+
+        /* -- xorshift64* -- */
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        ip = (uint32_t)((rng * 2685821657736338717ULL) >> 32);
+        bad += !rtc_same_path(sr_lpm_lookup(image->lpm, ip), sr_lpm_lookup(text->lpm, ip),
+                              (uint32_t)rng);
+        n++;
+    }
+    printf("compared %lu lookups, %lu mismatches\n", n, bad);
+    return bad;
+}
+
+int main(int argc, char** argv)
+{
+    int c;
+    int check = 0;
+    struct sr_fib* fib;
+    struct sr_fib* text;
+    double t0;
+
+    while((c = getopt(argc, argv, "hc")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'c':
+                check = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        } /* switch */
+    } /* -- while -- */
+
+    if(check)
+    {
+        if(optind != argc - 1 && optind != argc - 2)
+        {
+            usage(argv[0]);
+            exit(1);
+        }
+        if(!sr_rtbin_is_image(argv[optind]))
+        {
+            fprintf(stderr, "%s is not a routing table image\n", argv[optind]);
+            exit(1);
+        }
+        fib = rtc_load(argv[optind], "image");
+        if(optind == argc - 2)
+        {
+            text = rtc_load(argv[optind + 1], "text");
+            if(rtc_compare(fib, text) != 0)
+            { exit(1); }
+            sr_fib_destroy(text);
+        }
+        sr_fib_destroy(fib);
+        return 0;
+    }
+
+    if(optind != argc - 2)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+    fib = rtc_load(argv[optind], "text");
+
+    t0 = rtc_now();
+    if(sr_rtbin_write(fib, argv[optind + 1]) != 0)
+    {
+        fprintf(stderr, "Error writing %s\n", argv[optind + 1]);
+        exit(1);
+    }
+    printf("image %s: written in %.3f ms\n", argv[optind + 1], (rtc_now() - t0) * 1e3);
+
+    sr_fib_destroy(fib);
+    return 0;
+} /* -- main -- */
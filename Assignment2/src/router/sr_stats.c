@@ -0,0 +1,249 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Summing, printing and serving the counters of sr_stats.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "sr_stats.h"
+#include "sr_router.h"
+#include "sr_if.h"
+
+#define SR_STATS_POLL_MS 250    /* how quickly the server notices stop */
+
+__thread unsigned int sr_stats_slot;
+
+static const char* sr_drop_names[sr_drop_reasons] =
+{ "short", "bad_cksum", "ttl", "no_route", "arp_timeout", "bad_arp", "acl" };
+
+struct sr_stats* sr_stats_create(void)
+{
+    struct sr_stats* st;
+
+    if((st = (struct sr_stats*)aligned_alloc(64, sizeof(struct sr_stats))) == 0)
+    { return 0; }
+    memset(st, 0, sizeof(struct sr_stats));
+    st->fd = -1;
+    return st;
+}
+
+unsigned int sr_stats_claim(struct sr_stats* st)
+{
+    return __atomic_fetch_add(&st->next_shard, 1, __ATOMIC_RELAXED) % SR_STATS_SHARDS;
+}
+
+static uint64_t sr_stats_bucket_value(unsigned int b)
+{
+    unsigned int msb;
+
+    if(b < SR_STATS_HIST_SUB)
+    { return b; }
+    msb = b / SR_STATS_HIST_SUB + 2;
+    return ((uint64_t)(SR_STATS_HIST_SUB + b % SR_STATS_HIST_SUB)) << (msb - 3);
+}
+
+static uint64_t sr_stats_pct(const uint64_t* hist, uint64_t count, double p)
+{
+    uint64_t want = (uint64_t)(p / 100.0 * count);
+    uint64_t seen = 0;
+    unsigned int b;
+
+    for(b = 0; b < SR_STATS_HIST_SZ; b++)
+    {
+        seen += hist[b];
+        if(seen > want)
+        { return sr_stats_bucket_value(b); }
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_print(..)
+ * Scope: Global
+ *
+ * Sum the shards and print one line per interface, drop reason and
+ * summary, as "what name value name value ..." so it greps and parses
+ * easily.  Latency percentiles are bucket lower bounds, ~12% low at
+ * worst.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_print(struct sr_instance* sr, FILE* out)
+{
+    struct sr_stats* st = sr->stats;
+    struct sr_stats_shard* sum;
+    struct sr_if* iface;
+    unsigned int i, j;
+
+    if(!st)
+    { return; }
+
+    /* -- a shard is large, keep the sum off the stack -- */
+    if((sum = (struct sr_stats_shard*)calloc(1, sizeof(struct sr_stats_shard))) == 0)
+    { return; }
+
+    for(i = 0; i < SR_STATS_SHARDS; i++)
+    {
+        const uint64_t* src = (const uint64_t*)&(st->shards[i]);
+        uint64_t* dst = (uint64_t*)sum;
+
+        for(j = 0; j < sizeof(struct sr_stats_shard) / sizeof(uint64_t); j++)
+        { dst[j] += __atomic_load_n(&src[j], __ATOMIC_RELAXED); }
+    }
+
+    for(iface = sr->if_list; iface; iface = iface->next)
+    {
+        if(iface->index >= SR_STATS_MAX_IF)
+        { continue; }
+        fprintf(out, "if %s rx_packets %lu rx_bytes %lu tx_packets %lu tx_bytes %lu\n",
+                iface->name,
+                (unsigned long)sum->if_rx_packets[iface->index],
+                (unsigned long)sum->if_rx_bytes[iface->index],
+                (unsigned long)sum->if_tx_packets[iface->index],
+                (unsigned long)sum->if_tx_bytes[iface->index]);
+    }
+
+    for(i = 0; i < sr_drop_reasons; i++)
+    { fprintf(out, "drop %s %lu\n", sr_drop_names[i], (unsigned long)sum->drops[i]); }
+    fprintf(out, "drop arp_queue %lu\n",
+            sr->cache.drops_tail + sr->cache.drops_oldest);
+
+    fprintf(out, "arp hits %lu misses %lu hit_rate %.1f%%\n",
+            (unsigned long)sum->arp_hits, (unsigned long)sum->arp_misses,
+            (sum->arp_hits + sum->arp_misses) ?
+            100.0 * sum->arp_hits / (sum->arp_hits + sum->arp_misses) : 0.0);
+    fprintf(out, "arp refreshes %lu expired %lu\n",
+            sr->cache.refreshes, sr->cache.expired);
+
+    fprintf(out, "flow hits %lu misses %lu hit_rate %.1f%%\n",
+            (unsigned long)sum->flow_hits, (unsigned long)sum->flow_misses,
+            (sum->flow_hits + sum->flow_misses) ?
+            100.0 * sum->flow_hits / (sum->flow_hits + sum->flow_misses) : 0.0);
+
+    fprintf(out, "latency_ns frames %lu mean %lu p50 %lu p90 %lu p99 %lu p99.9 %lu\n",
+            (unsigned long)sum->lat_count,
+            (unsigned long)(sum->lat_count ? sum->lat_sum_ns / sum->lat_count : 0),
+            (unsigned long)sr_stats_pct(sum->lat_hist, sum->lat_count, 50),
+            (unsigned long)sr_stats_pct(sum->lat_hist, sum->lat_count, 90),
+            (unsigned long)sr_stats_pct(sum->lat_hist, sum->lat_count, 99),
+            (unsigned long)sr_stats_pct(sum->lat_hist, sum->lat_count, 99.9));
+
+    free(sum);
+} /* -- sr_stats_print -- */
+
+static void* sr_stats_server(void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_stats* st = sr->stats;
+    struct pollfd pfd;
+
+    pfd.fd = st->fd;
+    pfd.events = POLLIN;
+
+    while(!__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE))
+    {
+        int cfd;
+        FILE* out;
+
+        if(poll(&pfd, 1, SR_STATS_POLL_MS) <= 0)
+        { continue; }
+        if((cfd = accept(st->fd, 0, 0)) < 0)
+        { continue; }
+
+        /* -- one snapshot per connection, then hang up -- */
+        if((out = fdopen(cfd, "w")) == 0)
+        {
+            close(cfd);
+            continue;
+        }
+        sr_stats_print(sr, out);
+        fclose(out);
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_serve(..)
+ * Scope: Global
+ *
+ * Listen on a Unix domain socket at path, replacing whatever is there,
+ * and answer each connection with sr_stats_print.  0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_stats_serve(struct sr_instance* sr, const char* path)
+{
+    struct sr_stats* st = sr->stats;
+    struct sockaddr_un addr;
+
+    /* -- REQUIRES -- */
+    assert(st);
+    assert(path);
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "sr_stats_serve: socket path too long\n");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if((st->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket(..):sr_stats.c::sr_stats_serve");
+        return -1;
+    }
+    unlink(path);
+    if(bind(st->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+       listen(st->fd, 8) != 0)
+    {
+        perror("bind(..):sr_stats.c::sr_stats_serve");
+        close(st->fd);
+        st->fd = -1;
+        return -1;
+    }
+
+    st->path = strdup(path);
+    if(pthread_create(&st->thread, 0, sr_stats_server, sr) != 0)
+    {
+        close(st->fd);
+        unlink(path);
+        free(st->path);
+        st->path = 0;
+        st->fd = -1;
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_stats_serve -- */
+
+void sr_stats_destroy(struct sr_stats* st)
+{
+    if(!st)
+    { return; }
+
+    if(st->fd >= 0)
+    {
+        __atomic_store_n(&st->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(st->thread, 0);
+        close(st->fd);
+        unlink(st->path);
+    }
+    free(st->path);
+    free(st);
+}
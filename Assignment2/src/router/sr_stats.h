@@ -0,0 +1,186 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ *
+ * Description:
+ *
+ * Forwarding counters: packets and bytes per interface and direction,
+ * drops per reason, ARP and flow cache hits and misses, and a histogram
+ * of each frame's latency: the time from the start of the burst it came
+ * in until sr_handlepacket_burst is done with it or writes it out.
+ *
+ * Counters are split into SR_STATS_SHARDS cache line aligned shards and
+ * each thread sticks to one of them, so the reader, the pipeline workers
+ * and the ARP timer thread do not bounce lines between them.  Updates
+ * are relaxed atomic adds, no locks; a reader sums the shards and may see
+ * a snapshot a few packets old.
+ *
+ * sr -S path serves a text snapshot to anyone connecting to the Unix
+ * domain socket at path, e.g. socat - UNIX-CONNECT:path.  The same text
+ * is printed when sr exits.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_STATS_H
+#define SR_STATS_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_STATS_SHARDS     8
+#define SR_STATS_MAX_IF     16      /* interfaces counted by index */
+#define SR_STATS_HIST_SUB   8       /* linear sub-buckets per power of 2 */
+#define SR_STATS_HIST_SZ    (40 * SR_STATS_HIST_SUB)    /* up to 2^41 ns */
+
+struct sr_instance;
+
+enum sr_drop_reason
+{
+    sr_drop_short,          /* IP header cut short */
+    sr_drop_bad_cksum,      /* IP header checksum */
+    sr_drop_ttl,            /* TTL expired, time exceeded sent */
+    sr_drop_no_route,       /* no route, net unreachable sent */
+    sr_drop_arp_timeout,    /* next hop never answered, host unreachable sent */
+    sr_drop_bad_arp,        /* ARP with an unknown opcode */
+    sr_drop_acl,            /* denied by an access list */
+    sr_drop_reasons
+};
+
+struct sr_stats_shard
+{
+    uint64_t if_rx_packets[SR_STATS_MAX_IF];
+    uint64_t if_rx_bytes[SR_STATS_MAX_IF];
+    uint64_t if_tx_packets[SR_STATS_MAX_IF];
+    uint64_t if_tx_bytes[SR_STATS_MAX_IF];
+    uint64_t drops[sr_drop_reasons];
+    uint64_t arp_hits;
+    uint64_t arp_misses;
+    uint64_t flow_hits;
+    uint64_t flow_misses;
+    uint64_t lat_count;
+    uint64_t lat_sum_ns;
+    uint64_t lat_hist[SR_STATS_HIST_SZ];
+} __attribute__((aligned(64)));
+
+struct sr_stats
+{
+    struct sr_stats_shard shards[SR_STATS_SHARDS];
+    unsigned int    next_shard;     /* handed to threads round robin */
+    int             fd;             /* stats socket, -1 if none */
+    char*           path;
+    pthread_t       thread;
+    int             stop;
+};
+
+struct sr_stats* sr_stats_create(void);
+void sr_stats_destroy(struct sr_stats* st);
+unsigned int sr_stats_claim(struct sr_stats* st);
+int  sr_stats_serve(struct sr_instance* sr, const char* path);
+void sr_stats_print(struct sr_instance* sr, FILE* out);
+
+#define SR_STATS_ADD(field, n) __atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED)
+
+extern __thread unsigned int sr_stats_slot;    /* shard + 1, 0 until claimed */
+
+static inline struct sr_stats_shard* sr_stats_shard(struct sr_stats* st)
+{
+    if(!sr_stats_slot)
+    { sr_stats_slot = sr_stats_claim(st) + 1; }
+    return &(st->shards[sr_stats_slot - 1]);
+}
+
+static inline uint64_t sr_stats_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void sr_stats_rx(struct sr_stats* st, unsigned int ifidx, unsigned int len)
+{
+    struct sr_stats_shard* s;
+
+    if(!st || ifidx >= SR_STATS_MAX_IF)
+    { return; }
+    s = sr_stats_shard(st);
+    SR_STATS_ADD(s->if_rx_packets[ifidx], 1);
+    SR_STATS_ADD(s->if_rx_bytes[ifidx], len);
+}
+
+static inline void sr_stats_tx(struct sr_stats* st, unsigned int ifidx, unsigned int len)
+{
+    struct sr_stats_shard* s;
+
+    if(!st || ifidx >= SR_STATS_MAX_IF)
+    { return; }
+    s = sr_stats_shard(st);
+    SR_STATS_ADD(s->if_tx_packets[ifidx], 1);
+    SR_STATS_ADD(s->if_tx_bytes[ifidx], len);
+}
+
+static inline void sr_stats_drop(struct sr_stats* st, enum sr_drop_reason why)
+{
+    if(st)
+    { SR_STATS_ADD(sr_stats_shard(st)->drops[why], 1); }
+}
+
+static inline void sr_stats_arp(struct sr_stats* st, int hit)
+{
+    struct sr_stats_shard* s;
+
+    if(!st)
+    { return; }
+    s = sr_stats_shard(st);
+    if(hit)
+    { SR_STATS_ADD(s->arp_hits, 1); }
+    else
+    { SR_STATS_ADD(s->arp_misses, 1); }
+}
+
+static inline void sr_stats_flow(struct sr_stats* st, int hit)
+{
+    struct sr_stats_shard* s;
+
+    if(!st)
+    { return; }
+    s = sr_stats_shard(st);
+    if(hit)
+    { SR_STATS_ADD(s->flow_hits, 1); }
+    else
+    { SR_STATS_ADD(s->flow_misses, 1); }
+}
+
+static inline unsigned int sr_stats_bucket(uint64_t ns)
+{
+    int msb;
+    unsigned int b;
+
+    if(ns < SR_STATS_HIST_SUB)
+    { return (unsigned int)ns; }
+    msb = 63 - __builtin_clzll(ns);
+    b = (msb - 2) * SR_STATS_HIST_SUB + ((ns >> (msb - 3)) & (SR_STATS_HIST_SUB - 1));
+    return (b < SR_STATS_HIST_SZ) ? b : SR_STATS_HIST_SZ - 1;
+}
+
+static inline void sr_stats_latency(struct sr_stats* st, uint64_t ns)
+{
+    struct sr_stats_shard* s;
+
+    if(!st)
+    { return; }
+    s = sr_stats_shard(st);
+    SR_STATS_ADD(s->lat_count, 1);
+    SR_STATS_ADD(s->lat_sum_ns, ns);
+    SR_STATS_ADD(s->lat_hist[sr_stats_bucket(ns)], 1);
+}
+
+#endif /* -- SR_STATS_H -- */
@@ -0,0 +1,256 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.c
+ *
+ * Description:
+ *
+ * Hierarchical timer wheel, see sr_timer.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sr_timer.h"
+
+#define SR_TW_MASK       (SR_TW_SLOTS - 1)
+#define SR_TW_MAX_DELTA  ((uint64_t)1 << (SR_TW_BITS * SR_TW_LEVELS))
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_now(..)
+ * Scope: Global
+ *
+ * Milliseconds on the monotonic clock, the time base of every wheel.
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_timer_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} /* -- sr_timer_now -- */
+
+void sr_timer_wheel_init(struct sr_timer_wheel* tw, uint64_t now)
+{
+    memset(tw, 0, sizeof(struct sr_timer_wheel));
+    tw->now = now;
+} /* -- sr_timer_wheel_init -- */
+
+void sr_timer_init(struct sr_timer* t, sr_timer_fn fn, void* arg)
+{
+    memset(t, 0, sizeof(struct sr_timer));
+    t->fn  = fn;
+    t->arg = arg;
+} /* -- sr_timer_init -- */
+
+static void sr_timer_link(struct sr_timer_wheel* tw, struct sr_timer* t)
+{
+    uint64_t delta;
+    struct sr_timer** head;
+    int level;
+
+    /* anything already due fires on the next tick */
+    if(t->expires <= tw->now)
+    { t->expires = tw->now + 1; }
+
+    delta = t->expires - tw->now;
+    if(delta >= SR_TW_MAX_DELTA)
+    {
+        /* park in the top level as far out as it reaches; the cascade puts
+           it back up until it is really due */
+        level = SR_TW_LEVELS - 1;
+        head = &tw->slots[level][((tw->now + SR_TW_MAX_DELTA - 1)
+                                  >> (SR_TW_BITS * level)) & SR_TW_MASK];
+    }
+    else
+    {
+        for(level = 0; delta >= ((uint64_t)1 << (SR_TW_BITS * (level + 1))); level++)
+        { }
+        head = &tw->slots[level][(t->expires >> (SR_TW_BITS * level)) & SR_TW_MASK];
+    }
+
+    t->next = *head;
+    if(t->next)
+    { t->next->pprev = &t->next; }
+    t->pprev = head;
+    *head = t;
+}
+
+static void sr_timer_unlink(struct sr_timer* t)
+{
+    *t->pprev = t->next;
+    if(t->next)
+    { t->next->pprev = t->pprev; }
+    t->next  = 0;
+    t->pprev = 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_add(..)
+ * Scope: Global
+ *
+ * (Re)arm a timer to fire at expires.  A pending timer is moved.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_timer_add(struct sr_timer_wheel* tw, struct sr_timer* t, uint64_t expires)
+{
+    /* -- REQUIRES -- */
+    assert(tw);
+    assert(t && t->fn);
+
+    if(sr_timer_pending(t))
+    { sr_timer_unlink(t); }
+    else
+    { tw->count++; }
+
+    t->expires = expires;
+    sr_timer_link(tw, t);
+} /* -- sr_timer_add -- */
+
+void sr_timer_del(struct sr_timer_wheel* tw, struct sr_timer* t)
+{
+    if(sr_timer_pending(t))
+    {
+        sr_timer_unlink(t);
+        tw->count--;
+    }
+} /* -- sr_timer_del -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_move(..)
+ * Scope: Global
+ *
+ * The timer at from has been relocated (copied) to to; point the wheel
+ * at the new address.  from must not be used afterwards without
+ * sr_timer_init.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_timer_move(struct sr_timer* from, struct sr_timer* to)
+{
+    if(from != to)
+    { *to = *from; }
+
+    if(sr_timer_pending(to))
+    {
+        *to->pprev = to;
+        if(to->next)
+        { to->next->pprev = &to->next; }
+    }
+    if(from != to)
+    {
+        from->next  = 0;
+        from->pprev = 0;
+    }
+} /* -- sr_timer_move -- */
+
+/* move every timer of one slot down to where it belongs now */
+static void sr_timer_cascade(struct sr_timer_wheel* tw, int level, unsigned int idx)
+{
+    struct sr_timer* t = tw->slots[level][idx];
+
+    tw->slots[level][idx] = 0;
+    while(t)
+    {
+        struct sr_timer* next = t->next;
+        sr_timer_link(tw, t);
+        t = next;
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_advance(..)
+ * Scope: Global
+ *
+ * Run the wheel up to now, firing every timer that came due.  A timer
+ * is no longer pending when its function runs, so the function may
+ * re-arm it, free it, or touch any other timer on the wheel.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_timer_advance(struct sr_timer_wheel* tw, uint64_t now)
+{
+    while(tw->now < now)
+    {
+        unsigned int idx;
+        int level;
+
+        if(tw->count == 0)
+        {
+            tw->now = now;
+            break;
+        }
+
+        tw->now++;
+        idx = tw->now & SR_TW_MASK;
+
+        /* at each wrap of level l-1, pull the current slot of level l down */
+        for(level = 1; level < SR_TW_LEVELS && idx == 0; level++)
+        {
+            idx = (tw->now >> (SR_TW_BITS * level)) & SR_TW_MASK;
+            sr_timer_cascade(tw, level, idx);
+        }
+
+        idx = tw->now & SR_TW_MASK;
+        while(tw->slots[0][idx])
+        {
+            struct sr_timer* t = tw->slots[0][idx];
+
+            sr_timer_unlink(t);
+            tw->count--;
+            t->fn(t, t->arg);
+        }
+    }
+} /* -- sr_timer_advance -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_next(..)
+ * Scope: Global
+ *
+ * Earliest tick at which sr_timer_advance has work to do: a level 0
+ * expiry, or a cascade of a non-empty higher slot, whichever comes
+ * first.  Costs at most SR_TW_LEVELS * SR_TW_SLOTS probes.  Returns
+ * UINT64_MAX if the wheel is empty.
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_timer_next(const struct sr_timer_wheel* tw)
+{
+    uint64_t best = UINT64_MAX;
+    unsigned int d;
+    int level;
+
+    if(tw->count == 0)
+    { return best; }
+
+    for(d = 1; d < SR_TW_SLOTS; d++)
+    {
+        if(tw->slots[0][(tw->now + d) & SR_TW_MASK])
+        {
+            best = tw->now + d;
+            break;
+        }
+    }
+
+    for(level = 1; level < SR_TW_LEVELS; level++)
+    {
+        int shift = SR_TW_BITS * level;
+        uint64_t base = tw->now >> shift;
+
+        for(d = 1; d <= SR_TW_SLOTS; d++)
+        {
+            if(tw->slots[level][(base + d) & SR_TW_MASK])
+            {
+                uint64_t when = (base + d) << shift;
+                if(when < best)
+                { best = when; }
+                break;
+            }
+        }
+    }
+
+    return best;
+} /* -- sr_timer_next -- */
@@ -0,0 +1,66 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.h
+ *
+ * Description:
+ *
+ * Hierarchical timer wheel with millisecond ticks.
+ *
+ * SR_TW_LEVELS levels of SR_TW_SLOTS slots each; level l covers deltas
+ * below SR_TW_SLOTS^(l+1) ms, so five levels of 64 reach about 12 days.
+ * A timer sits in the slot picked by the matching bits of its expiry and
+ * is moved one level down each time the wheel below it wraps (cascade),
+ * so adding, deleting and firing are O(1) and an idle wheel costs nothing
+ * however many timers it holds.
+ *
+ * Timers are intrusive: embed a struct sr_timer in the object it times.
+ * The wheel does no locking; callers serialize every call on one wheel.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TIMER_H
+#define SR_TIMER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_TW_BITS   6
+#define SR_TW_SLOTS  (1 << SR_TW_BITS)
+#define SR_TW_LEVELS 5
+
+struct sr_timer;
+typedef void (*sr_timer_fn)(struct sr_timer* t, void* arg);
+
+struct sr_timer
+{
+    struct sr_timer*  next;
+    struct sr_timer** pprev;    /* NULL when not pending */
+    uint64_t          expires;  /* ms, sr_timer_now() clock */
+    sr_timer_fn       fn;
+    void*             arg;
+};
+
+struct sr_timer_wheel
+{
+    uint64_t         now;       /* last tick processed */
+    unsigned int     count;     /* pending timers */
+    struct sr_timer* slots[SR_TW_LEVELS][SR_TW_SLOTS];
+};
+
+uint64_t sr_timer_now(void);
+
+void sr_timer_wheel_init(struct sr_timer_wheel* tw, uint64_t now);
+void sr_timer_init(struct sr_timer* t, sr_timer_fn fn, void* arg);
+void sr_timer_add(struct sr_timer_wheel* tw, struct sr_timer* t, uint64_t expires);
+void sr_timer_del(struct sr_timer_wheel* tw, struct sr_timer* t);
+void sr_timer_move(struct sr_timer* from, struct sr_timer* to);
+void sr_timer_advance(struct sr_timer_wheel* tw, uint64_t now);
+uint64_t sr_timer_next(const struct sr_timer_wheel* tw);
+
+#define sr_timer_pending(t) ((t)->pprev != 0)
+
+#endif /* -- SR_TIMER_H -- */
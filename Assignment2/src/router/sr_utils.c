@@ -3,22 +3,48 @@
 #include <string.h>
 #include "sr_protocol.h"
 #include "sr_utils.h"
+#include "inet_cksum.h"
 
 
 uint16_t cksum (const void *_data, int len) {
-  const uint8_t *data = _data;
-  uint32_t sum;
-
-  for (sum = 0;len >= 2; data += 2, len -= 2)
-    sum += data[0] << 8 | data[1];
-  if (len > 0)
-    sum += data[0] << 8;
-  while (sum > 0xffff)
-    sum = (sum >> 16) + (sum & 0xffff);
-  sum = htons (~sum);
+  uint16_t sum = csum_fold(csum_partial(_data, len, 0));
+
   return sum ? sum : 0xffff;
 }
 
+int cksum_valid (const void *_data, int len) {
+  return csum_fold(csum_partial(_data, len, 0)) == 0;
+}
+
+uint16_t cksum_update16 (uint16_t sum, uint16_t old_val, uint16_t new_val) {
+  uint32_t s = (uint16_t)~sum + (uint16_t)~old_val + new_val;
+
+  s = (s >> 16) + (s & 0xffff);
+  s += s >> 16;
+  return (uint16_t)~s;
+}
+
+uint16_t cksum_update32 (uint16_t sum, uint32_t old_val, uint32_t new_val) {
+  sum = cksum_update16(sum, (uint16_t)(old_val >> 16), (uint16_t)(new_val >> 16));
+  return cksum_update16(sum, (uint16_t)old_val, (uint16_t)new_val);
+}
+
+void ip_decrement_ttl (struct sr_ip_hdr *iphdr) {
+  uint16_t old_word, new_word;
+
+  /* ttl and protocol share the 16 bit word at offset 8 */
+  memcpy(&old_word, &iphdr->ip_ttl, sizeof(old_word));
+  iphdr->ip_ttl--;
+  memcpy(&new_word, &iphdr->ip_ttl, sizeof(new_word));
+
+  iphdr->ip_sum = cksum_update16(iphdr->ip_sum, old_word, new_word);
+}
+
+void copy_ifname(char *dst, unsigned int size, const char *name) {
+  memset(dst, 0, size);
+  memcpy(dst, name, strnlen(name, size));
+}
+
 
 uint16_t ethertype(uint8_t *buf) {
   sr_ethernet_hdr_t *ehdr = (sr_ethernet_hdr_t *)buf;
@@ -30,6 +30,24 @@
 
 uint16_t cksum(const void *_data, int len);
 
+/* Returns 1 if the Internet checksum over len bytes, checksum field
+   included, verifies. Does not modify the data. */
+int cksum_valid(const void *_data, int len);
+
+/* Incremental checksum update (RFC 1624 eqn. 3). sum is the checksum field
+   and old/new the rewritten 16 or 32 bit field, all exactly as stored in
+   the packet. Returns the new checksum field. */
+uint16_t cksum_update16(uint16_t sum, uint16_t old_val, uint16_t new_val);
+uint16_t cksum_update32(uint16_t sum, uint32_t old_val, uint32_t new_val);
+
+/* Decrements ip_ttl and patches ip_sum without resumming the header. */
+struct sr_ip_hdr;
+void ip_decrement_ttl(struct sr_ip_hdr *iphdr);
+
+/* Copies an interface name into a field of size bytes, such as a VNS
+   header's mInterfaceName: zero padded, unterminated if the name fills it. */
+void copy_ifname(char *dst, unsigned int size, const char *name);
+
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
 
@@ -32,23 +32,32 @@
 #include <errno.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 
 #include "sr_dumper.h"
+#include "sr_caplog.h"
+#include "sr_log.h"
+#include "sr_stats.h"
 #include "sr_router.h"
 #include "sr_if.h"
+#include "sr_acl.h"
 #include "sr_protocol.h"
+#include "sr_pipeline.h"
+#include "sr_utils.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
+#define SR_VNS_CMD_MAX 10000    /* largest command the server sends */
+#define SR_RXBUF_SZ    65536    /* receive buffer, several commands deep */
+
 static void sr_log_packet(struct sr_instance* , uint8_t* , int );
-static int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                                  uint8_t * packet /* lent */,
+static int  sr_arp_req_not_for_us(uint8_t * packet /* lent */,
                                   unsigned int len,
-                                  char* interface  /* lent */);
+                                  const struct sr_if* iface /* lent */);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
 
 /*-----------------------------------------------------------------------------
@@ -170,6 +179,8 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
  *
  *
  * Read, from the server, the hardware information for the reserved host.
+ * Returns the number of entries, or -1 if there are more interfaces than
+ * the router can look up.
  *
  *---------------------------------------------------------------------------*/
 
@@ -226,6 +237,9 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
         } /* -- switch -- */
     } /* -- for -- */
 
+    if(sr_if_table_build(sr) != 0)
+    { return -1; }
+
     printf("Router interfaces:\n");
     sr_print_if_list(sr);
 
@@ -319,96 +333,163 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
 }
 
 /*-----------------------------------------------------------------------------
- * Method: sr_read_from_server(..)
- * Scope: global
+ * Method: sr_rx_next(..)
+ * Scope: Local
  *
- * Houses main while loop for communicating with the virtual router server.
+ * Look at the buffered command stream.  Returns the length of the command
+ * at the head of the buffer if it is complete, 0 if more bytes are needed
+ * and -1 if the stream is corrupt.
  *
  *---------------------------------------------------------------------------*/
 
-int sr_read_from_server(struct sr_instance* sr /* borrowed */)
+static int sr_rx_next(struct sr_instance* sr)
 {
-    return sr_read_from_server_expect(sr, 0);
-}
+    unsigned int avail = sr->rx_tail - sr->rx_head;
+    int len;
 
-int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
-{
-    int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    if ( avail < sizeof(uint32_t) )
+    { return 0; }
 
-    /* REQUIRES */
-    assert(sr);
+    len = ntohl(((c_base*)(sr->rx_buf + sr->rx_head))->mLen);
 
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
+    if ( len > SR_VNS_CMD_MAX || len < (int)sizeof(c_base) )
+    {
+        fprintf(stderr,"Error: command length to large %d\n",len);
+        close(sr->sockfd);
+        return -1;
+    }
 
-    bytes_read = 0;
+    return (avail < (unsigned int)len) ? 0 : len;
+} /* -- sr_rx_next -- */
 
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
-    {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
+/*-----------------------------------------------------------------------------
+ * Method: sr_rx_fill(..)
+ * Scope: Local
+ *
+ * Slide any partial command to the front of the buffer and pull as many
+ * bytes as the socket has ready with a single recv.  Returns the number of
+ * bytes read, 0 if the server closed the connection, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
 
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
+static int sr_rx_fill(struct sr_instance* sr)
+{
+    int ret;
 
+    if ( sr->rx_buf == 0 )
+    {
+        if ( (sr->rx_buf = (uint8_t*)malloc(SR_RXBUF_SZ)) == 0 )
+        {
+            fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+            return -1;
+        }
+        sr->rx_head = sr->rx_tail = 0;
     }
 
-    len = ntohl(len);
+    if ( sr->rx_head > 0 )
+    {
+        memmove(sr->rx_buf, sr->rx_buf + sr->rx_head, sr->rx_tail - sr->rx_head);
+        sr->rx_tail -= sr->rx_head;
+        sr->rx_head = 0;
+    }
+
+    do
+    { /* -- just in case SIGALRM breaks recv -- */
+        ret = recv(sr->sockfd, sr->rx_buf + sr->rx_tail,
+                   SR_RXBUF_SZ - sr->rx_tail, 0);
+    } while ( ret == -1 && errno == EINTR ); /* be mindful of signals */
 
-    if ( len > 10000 || len < 0 )
+    if ( ret == -1 )
     {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
+        perror("recv(..):sr_client.c::sr_read_from_server");
         return -1;
     }
+    if ( ret == 0 )
+    {
+        fprintf(stderr,"Error: server closed connection\n");
+        return 0;
+    }
+
+    sr->rx_tail += ret;
+    return ret;
+} /* -- sr_rx_fill -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rx_wait(..)
+ * Scope: Local
+ *
+ * Block until a complete command is buffered.  Returns its length or -1.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_rx_wait(struct sr_instance* sr)
+{
+    int len;
 
-    if((buf = malloc(len)) == 0)
+    while ( (len = sr_rx_next(sr)) == 0 )
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
-        return -1;
+        if ( sr_rx_fill(sr) <= 0 )
+        { return -1; }
     }
+    return len;
+} /* -- sr_rx_wait -- */
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
+/*-----------------------------------------------------------------------------
+ * Method: sr_rx_packet(..)
+ * Scope: Local
+ *
+ * Unwrap the VNSPACKET command in buf into frame, still pointing into
+ * the receive buffer.  Returns 0 if the frame is to be dropped: unknown
+ * interface, or an ARP request for another router.
+ *
+ *---------------------------------------------------------------------------*/
 
-    bytes_read = 0;
+static int sr_rx_packet(struct sr_instance* sr, uint8_t* buf, int len,
+                        struct sr_frame* frame)
+{
+    c_packet_ethernet_header* sr_pkt = (c_packet_ethernet_header *)buf;
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
+    /* -- the one name lookup a frame costs, after this it is sr_if -- */
+    if ( (frame->iface = sr_get_interface(sr, (char*)(buf + sizeof(c_base)))) == 0 )
     {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
+        SR_ERR("** Error, packet on unknown interface %.16s\n",
+                (char*)(buf + sizeof(c_base)));
+        return 0;
     }
 
+    frame->buf = buf + sizeof(c_packet_header);
+    frame->len = len - sizeof(c_packet_ethernet_header) +
+        sizeof(struct sr_ethernet_hdr);
+
+    /* -- check if it is an ARP to another router if so drop   -- */
+    if ( sr_arp_req_not_for_us(frame->buf, frame->len, frame->iface) )
+    { return 0; }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, frame->buf, ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
+
+    return 1;
+} /* -- sr_rx_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dispatch_command(..)
+ * Scope: Local
+ *
+ * Handle one complete command that sits in the receive buffer.  The
+ * command is handled in place; packets are lent to sr_handlepacket
+ * straight out of the buffer.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_dispatch_command(struct sr_instance* sr, uint8_t* buf,
+                               int len, int expected_cmd)
+{
+    int command, ret;
+    struct sr_frame frame;
+
     /* My entry for most unreadable line of code - guido */
     /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+    command = ((c_base*)buf)->mType = ntohl(((c_base*)buf)->mType);
 
     /* make sure the command is what we expected if we were expecting something */
     if(expected_cmd && command!=expected_cmd) {
@@ -424,27 +505,14 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         /* -------------        VNSPACKET     -------------------- */
 
         case VNSPACKET:
-            sr_pkt = (c_packet_ethernet_header *)buf;
-
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
-            { break; }
-
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
-
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base)));
-
+            if ( sr_rx_packet(sr, buf, len, &frame) )
+            {
+                /* -- pass to router, student's code should take over here -- */
+                if ( sr->pipe )
+                { sr_pipeline_rx(sr->pipe, frame.buf, frame.len, frame.iface); }
+                else
+                { sr_handlepacket_if(sr, frame.buf, frame.len, frame.iface); }
+            }
             break;
 
             /* -------------        VNSCLOSE      -------------------- */
@@ -454,8 +522,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
 
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -468,12 +534,21 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             /* -------------     VNSHWINFO     -------------------- */
 
         case VNSHWINFO:
-            sr_handle_hwinfo(sr,(c_hwinfo*)buf);
+            if(sr_handle_hwinfo(sr,(c_hwinfo*)buf) < 0)
+            {
+                fprintf(stderr,"Interfaces not usable by this router\n");
+                return -1;
+            }
             if(sr_verify_routing_table(sr) != 0)
             {
                 fprintf(stderr,"Routing table not consistent with hardware\n");
                 return -1;
             }
+            if(sr->acl && sr_acl_bind(sr->acl, sr->if_list) != 0)
+            {
+                fprintf(stderr,"Access lists not consistent with hardware\n");
+                return -1;
+            }
             printf(" <-- Ready to process packets --> \n");
             break;
 
@@ -501,10 +576,91 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
-}/* -- sr_read_from_server -- */
+} /* -- sr_dispatch_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server(..)
+ * Scope: global
+ *
+ * Houses main while loop for communicating with the virtual router server.
+ *
+ * Each call waits for at least one complete command, then handles every
+ * complete command that the last recv brought in before returning.
+ * Runs of packets among them go to sr_handlepacket_burst together.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server(struct sr_instance* sr /* borrowed */)
+{
+    struct sr_frame burst[SR_BURST_MAX];
+    unsigned int n = 0;
+    int len, ret;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ( (len = sr_rx_wait(sr)) < 0 )
+    { return -1; }
+
+    do
+    {
+        uint8_t* buf = sr->rx_buf + sr->rx_head;
+        sr->rx_head += len;
+
+        /* -- back to back packets are handed over as one burst; they stay
+              in the buffer until the next sr_rx_fill -- */
+        if ( !sr->pipe && ntohl(((c_base*)buf)->mType) == VNSPACKET )
+        {
+            if ( sr_rx_packet(sr, buf, len, &burst[n]) && ++n == SR_BURST_MAX )
+            {
+                sr_handlepacket_burst(sr, burst, n);
+                n = 0;
+            }
+            continue;
+        }
+
+        if ( n )
+        {
+            sr_handlepacket_burst(sr, burst, n);
+            n = 0;
+        }
+        if ( (ret = sr_dispatch_command(sr, buf, len, 0)) != 1 )
+        { return ret; }
+    } while ( (len = sr_rx_next(sr)) > 0 );
+
+    if ( n )
+    { sr_handlepacket_burst(sr, burst, n); }
+
+    return (len < 0) ? -1 : 1;
+} /* -- sr_read_from_server -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_expect(..)
+ * Scope: global
+ *
+ * Handle exactly one command, which must be expected_cmd (or VNSCLOSE)
+ * unless expected_cmd is 0.  Used during session setup; anything that
+ * arrived behind it stays buffered for sr_read_from_server.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+{
+    int len;
+    uint8_t* buf;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ( (len = sr_rx_wait(sr)) < 0 )
+    { return -1; }
+
+    buf = sr->rx_buf + sr->rx_head;
+    sr->rx_head += len;
+
+    return sr_dispatch_command(sr, buf, len, expected_cmd);
+}/* -- sr_read_from_server_expect -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_ether_addrs_match_interface(..)
@@ -515,28 +671,19 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
  *----------------------------------------------------------------------------*/
 
 static int
-sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
-                                uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+sr_ether_addrs_match_interface( uint8_t* buf, /* borrowed */
+                                const struct sr_if* iface /* borrowed */ )
 {
     struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
 
     /* -- REQUIRES -- */
-    assert(sr);
     assert(buf);
-    assert(name);
+    assert(iface);
 
     ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
-
-    if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
-        return 0;
-    }
 
     if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
-        fprintf( stderr, "** Error, source address does not match interface\n");
+        SR_ERR("** Error, source address does not match interface\n");
         return 0;
     }
 
@@ -550,6 +697,66 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
 
 } /* -- sr_ether_addrs_match_interface -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_writev_full(..)
+ * Scope: Local
+ *
+ * writev(..) until every byte of the vector is out.  The vector is
+ * consumed in place.  Returns 0 on success, -1 on error.
+ *
+ *----------------------------------------------------------------------------*/
+
+static int sr_writev_full(int fd, struct iovec* iov, int iovcnt)
+{
+    ssize_t ret;
+
+    while ( iovcnt > 0 )
+    {
+        if ( (ret = writev(fd, iov, iovcnt)) < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            perror("writev(..):sr_vns_comm.c::sr_writev_full");
+            return -1;
+        }
+
+        /* -- skip what was written, handle short writes -- */
+        while ( iovcnt > 0 && (size_t)ret >= iov->iov_len )
+        {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if ( iovcnt > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+} /* -- sr_writev_full -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_frames(..)
+ * Scope: Global
+ *
+ * Write complete VNS commands to the server.  Takes the send lock so that
+ * commands from different threads never interleave on the socket.
+ *
+ *----------------------------------------------------------------------------*/
+
+int sr_send_frames(struct sr_instance* sr, struct iovec* iov, int iovcnt)
+{
+    int ret;
+
+    pthread_mutex_lock(&(sr->send_lock));
+    ret = sr_writev_full(sr->sockfd, iov, iovcnt);
+    pthread_mutex_unlock(&(sr->send_lock));
+
+    return ret;
+} /* -- sr_send_frames -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_send_packet(..)
  * Scope: Global
@@ -564,49 +771,158 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          unsigned int len,
                          const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct sr_if* out_if;
 
     /* REQUIRES */
     assert(sr);
-    assert(buf);
     assert(iface);
 
+    if ( (out_if = sr_get_interface(sr, iface)) == 0 ){
+        SR_ERR("** Error, interface %s, does not exist\n", iface);
+        return -1;
+    }
+
+    return sr_send_packet_if(sr, buf, len, out_if);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_prepare(..)
+ * Scope: Local
+ *
+ * Everything sending a frame takes short of writing it to the server:
+ * checks, capture, counters, and the replay hook or pipeline if either
+ * takes it.  Returns 1 if the frame still has to be written, 0 if it has
+ * been taken care of, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_send_prepare(struct sr_instance* sr, uint8_t* buf,
+                           unsigned int len, const struct sr_if* out_if)
+{
     /* don't waste my time ... */
     if ( len < sizeof(struct sr_ethernet_hdr) ){
-        fprintf(stderr , "** Error: packet is wayy to short \n");
+        SR_ERR("** Error: packet is wayy to short \n");
         return -1;
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
-
     /* -- log packet -- */
     sr_log_packet(sr,buf,len);
 
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
-        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
+    if ( ! sr_ether_addrs_match_interface( buf, out_if) ){
+        SR_ERR("*** Error: problem with ethernet header, check log\n");
         return -1;
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
+    sr_stats_tx(sr->stats, out_if->index, len);
+
+    /* -- no server: the frame goes wherever the hook puts it -- */
+    if ( sr->send_hook )
+    { return sr->send_hook(sr, buf, len, out_if->name, sr->send_hook_arg) == 0 ? 0 : -1; }
+
+    /* -- worker threads hand the frame to the pipeline's writer -- */
+    if ( sr->pipe && sr_pipeline_tx(sr->pipe, buf, len, out_if) == 0 )
+    { return 0; }
+
+    return 1;
+} /* -- sr_send_prepare -- */
+
+static void sr_send_header(c_packet_header* hdr, unsigned int len,
+                           const struct sr_if* out_if)
+{
+    hdr->mLen  = htonl(len + sizeof(c_packet_header));
+    hdr->mType = htonl(VNSPACKET);
+    copy_ifname(hdr->mInterfaceName, sizeof(hdr->mInterfaceName), out_if->name);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet_if(..)
+ * Scope: Global
+ *
+ * sr_send_packet for callers that already hold the outgoing interface.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet_if(struct sr_instance* sr /* borrowed */,
+                      uint8_t* buf /* borrowed */ ,
+                      unsigned int len,
+                      const struct sr_if* out_if /* borrowed */)
+{
+    c_packet_header sr_pkt;
+    struct iovec iov[2];
+    int ret;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(buf);
+    assert(out_if);
+
+    if ( (ret = sr_send_prepare(sr, buf, len, out_if)) <= 0 )
+    { return ret; }
+
+    /* -- VNS header lives on the stack, frame is gathered in place -- */
+    sr_send_header(&sr_pkt, len, out_if);
+
+    iov[0].iov_base = &sr_pkt;
+    iov[0].iov_len  = sizeof(c_packet_header);
+    iov[1].iov_base = buf;
+    iov[1].iov_len  = len;
+
+    if( sr_send_frames(sr, iov, 2) != 0 ){
+        SR_ERR("Error writing packet\n");
         return -1;
     }
 
-    free(sr_pkt);
-
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_send_packet_if -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_burst(..)
+ * Scope: Global
+ *
+ * sr_send_packet_if for up to SR_BURST_MAX frames, written to the server
+ * with a single writev.  Frames that fail their checks are left out.
+ * Returns -1 if any frame failed, 0 otherwise.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_burst(struct sr_instance* sr /* borrowed */,
+                  const struct sr_frame* frames /* borrowed */,
+                  unsigned int n)
+{
+    c_packet_header hdrs[SR_BURST_MAX];
+    struct iovec iov[2 * SR_BURST_MAX];
+    unsigned int i, k = 0;
+    int ret = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(frames);
+    assert(n <= SR_BURST_MAX);
+
+    for ( i = 0; i < n; i++ )
+    {
+        int r = sr_send_prepare(sr, frames[i].buf, frames[i].len, frames[i].iface);
+
+        if ( r < 0 )
+        { ret = -1; }
+        if ( r <= 0 )
+        { continue; }
+
+        sr_send_header(&hdrs[k], frames[i].len, frames[i].iface);
+        iov[2 * k].iov_base     = &hdrs[k];
+        iov[2 * k].iov_len      = sizeof(c_packet_header);
+        iov[2 * k + 1].iov_base = frames[i].buf;
+        iov[2 * k + 1].iov_len  = frames[i].len;
+        k++;
+    }
+
+    if( k && sr_send_frames(sr, iov, 2 * k) != 0 ){
+        SR_ERR("Error writing packets\n");
+        return -1;
+    }
+
+    return ret;
+} /* -- sr_send_burst -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
@@ -616,23 +932,14 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
 
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 {
-    struct pcap_pkthdr h;
-    int size;
-
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
+    if(!sr->caplog)
     {return; }
 
-    size = min(PACKET_DUMP_SIZE, len);
-
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
-
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
+    /* -- copied into the capture ring, written out by its own thread -- */
+    sr_caplog_packet(sr->caplog, buf, len);
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------
@@ -641,12 +948,10 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
  *
  *---------------------------------------------------------------------------*/
 
-int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                           uint8_t * packet /* lent */,
+int  sr_arp_req_not_for_us(uint8_t * packet /* lent */,
                            unsigned int len,
-                           char* interface  /* lent */)
+                           const struct sr_if* iface /* lent */)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
     struct sr_ethernet_hdr* e_hdr = 0;
     struct sr_arp_hdr*       a_hdr = 0;
 
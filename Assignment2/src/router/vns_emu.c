@@ -0,0 +1,1003 @@
+/*-----------------------------------------------------------------------------
+ * file:  vns_emu.c
+ *
+ * Description:
+ *
+ * Loopback stand-in for the VNS server (the POX module) to load test sr
+ * end to end on one machine.  It listens for a single sr session, runs
+ * the VNS_AUTH_REQUEST/REPLY/STATUS handshake and the VNSOPEN, sends
+ * VNSHWINFO for the interfaces of a topology file, and then plays every
+ * host in that topology at once:
+ *
+ *  - UDP frames are sent from each host to every host behind another
+ *    interface, round robin, at a fixed rate (or as fast as the socket
+ *    takes them).  Each one carries a sequence number and its send time.
+ *  - ARP requests from the router for a host are answered with the
+ *    host's MAC.
+ *  - Frames the router forwards are checked (egress interface, MACs,
+ *    TTL, IP checksum) and their one-way latency recorded.
+ *
+ * One frame per host pair goes out first and is allowed to resolve ARP
+ * before the timed run starts.  At the end the session is closed with
+ * VNSCLOSE and offered/delivered rates, loss and latency percentiles are
+ * printed.
+ *
+ * The topology file has the format sr_replay reads (see topo.conf):
+ *
+ *   iface eth1 02:00:00:00:00:01 192.168.2.1
+ *   host  192.168.2.2 0b:00:00:00:00:01 eth1
+ *
+ * Usage: vns_emu [-p port] [-t topo] [-k auth_key] [-r pps] [-d seconds]
+ *                [-s frame bytes] [-f ports per host pair] [-b batch]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "vnscommand.h"
+#include "inet_cksum.h"
+#include "sha1.h"
+
+#define DEFAULT_PORT  8888
+#define DEFAULT_TOPO  "topo.conf"
+
+#define EMU_MAX_IFACES 16
+#define EMU_MAX_HOSTS  64
+#define EMU_AUTH_KEY_LEN 64
+#define EMU_SALT_LEN   16
+#define EMU_SHA1_LEN   20
+
+#define EMU_CMD_MAX    (64 * 1024)      /* longest command we accept */
+#define EMU_RXBUF_SZ   (1024 * 1024)
+#define EMU_FRAME_MAX  1514
+#define EMU_MAGIC      0x564e5345       /* "VNSE" */
+#define EMU_UDP_DPORT  9                /* discard */
+#define EMU_DRAIN_NS   1000000000ULL    /* wait for stragglers after the run */
+
+/* latency histogram: 16 linear sub-buckets per power of two, ~6% error */
+#define EMU_HIST_SUB   16
+#define EMU_HIST_SZ    (64 * EMU_HIST_SUB)
+
+struct emu_iface
+{
+    char     name[sr_IFACE_NAMELEN];
+    uint8_t  mac[ETHER_ADDR_LEN];
+    uint32_t ip;                        /* network byte order */
+};
+
+struct emu_host
+{
+    uint32_t ip;                        /* network byte order */
+    uint8_t  mac[ETHER_ADDR_LEN];
+    int      iface;
+};
+
+struct emu_flow
+{
+    int      src, dst;                  /* host indices */
+    uint64_t seq;
+};
+
+/* what every generated frame carries after the UDP header */
+struct emu_payload
+{
+    uint32_t magic;
+    uint32_t flow;
+    uint64_t seq;
+    uint64_t sent_ns;
+} __attribute__ ((packed));
+
+struct emu
+{
+    int fd;
+    pthread_mutex_t tx_lock;            /* sender and ARP replies share fd */
+
+    struct emu_iface ifaces[EMU_MAX_IFACES];
+    int nifaces;
+    struct emu_host hosts[EMU_MAX_HOSTS];
+    int nhosts;
+    struct emu_flow* flows;
+    int nflows;
+
+    unsigned int rate;                  /* frames/s, 0 for unpaced */
+    double       duration;              /* seconds */
+    unsigned int frame_sz;
+    unsigned int ports;                 /* UDP source ports per flow */
+    unsigned int batch;                 /* frames per write */
+
+    int          warm;                  /* counting the timed run */
+    int          done;                  /* sender finished */
+    int          stop;                  /* sender: give up early */
+    uint64_t     t_start, t_end;
+
+    /* sender */
+    unsigned long tx_frames;
+    unsigned long tx_short;             /* writes that could not catch up */
+
+    /* receiver */
+    unsigned long rx_frames;
+    unsigned long rx_bytes;
+    unsigned long rx_bad;               /* forwarded frame failed a check */
+    unsigned long rx_other;             /* not ours: ICMP, unknown ARP, ... */
+    unsigned long arp_replies;
+    unsigned long hist[EMU_HIST_SZ];
+    uint64_t      lat_max;
+
+    uint8_t* rx_buf;
+    unsigned int rx_head, rx_tail;
+};
+
+static uint64_t emu_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage(char* argv0)
+{
+    printf("VNS server stand-in for load testing sr\n");
+    printf("Format: %s [-p port] [-t topo] [-k auth_key] [-r pps] [-d seconds]\n", argv0);
+    printf("           [-s frame bytes] [-f ports per host pair] [-b batch]\n");
+    printf("   defaults port=%d topo=%s rate=10000 duration=5 size=128 ports=16 batch=32\n",
+           DEFAULT_PORT, DEFAULT_TOPO);
+    printf("   -r 0 sends as fast as sr reads; without -k any password is accepted\n");
+} /* -- usage -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_load_topo(..)
+ * Scope: Local
+ *
+ * Read iface and host lines; anything else sr_replay understands (arp)
+ * is skipped.  Returns 0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_parse_mac(const char* s, uint8_t* mac)
+{
+    unsigned int b[ETHER_ADDR_LEN];
+    int i;
+
+    if(sscanf(s, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+    { return -1; }
+    for(i = 0; i < ETHER_ADDR_LEN; i++)
+    {
+        if(b[i] > 0xff)
+        { return -1; }
+        mac[i] = (uint8_t)b[i];
+    }
+    return 0;
+}
+
+static int emu_load_topo(struct emu* emu, const char* filename)
+{
+    FILE* fp;
+    char  line[BUFSIZ];
+    char  kw[32], a[64], b[64], c[64];
+    unsigned int lineno = 0;
+
+    if((fp = fopen(filename, "r")) == 0)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    while(fgets(line, BUFSIZ, fp) != 0)
+    {
+        char* hash = strchr(line, '#');
+        struct in_addr ip;
+        int n, i;
+
+        lineno++;
+        if(hash)
+        { *hash = '\0'; }
+        if((n = sscanf(line, "%31s %63s %63s %63s", kw, a, b, c)) <= 0)
+        { continue; }
+
+        if(strcmp(kw, "iface") == 0 && n == 4 && emu->nifaces < EMU_MAX_IFACES &&
+           strlen(a) < sr_IFACE_NAMELEN && inet_aton(c, &ip) != 0 &&
+           emu_parse_mac(b, emu->ifaces[emu->nifaces].mac) == 0)
+        {
+            strcpy(emu->ifaces[emu->nifaces].name, a);
+            emu->ifaces[emu->nifaces].ip = ip.s_addr;
+            emu->nifaces++;
+        }
+        else if(strcmp(kw, "host") == 0 && n == 4 && emu->nhosts < EMU_MAX_HOSTS &&
+                inet_aton(a, &ip) != 0 && emu_parse_mac(b, emu->hosts[emu->nhosts].mac) == 0)
+        {
+            for(i = 0; i < emu->nifaces; i++)
+            {
+                if(strcmp(emu->ifaces[i].name, c) == 0)
+                { break; }
+            }
+            if(i == emu->nifaces)
+            {
+                fprintf(stderr, "%s:%u: host on unknown interface %s\n", filename, lineno, c);
+                fclose(fp);
+                return -1;
+            }
+            emu->hosts[emu->nhosts].ip = ip.s_addr;
+            emu->hosts[emu->nhosts].iface = i;
+            emu->nhosts++;
+        }
+        else if(strcmp(kw, "arp") != 0)
+        {
+            fprintf(stderr, "%s:%u: cannot parse: %s", filename, lineno, line);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+
+    if(emu->nifaces == 0 || emu->nhosts < 2)
+    {
+        fprintf(stderr, "%s: need interfaces and at least two hosts\n", filename);
+        return -1;
+    }
+    return 0;
+} /* -- emu_load_topo -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_write(..)
+ * Scope: Local
+ *
+ * Write a whole iovec to the router, serialized with the other writer.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_write(struct emu* emu, struct iovec* iov, int iovcnt)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&emu->tx_lock);
+    while(iovcnt > 0)
+    {
+        ssize_t n = writev(emu->fd, iov, iovcnt);
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            ret = -1;
+            break;
+        }
+        while(iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    pthread_mutex_unlock(&emu->tx_lock);
+    return ret;
+} /* -- emu_write -- */
+
+static int emu_send_cmd(struct emu* emu, void* cmd, unsigned int len)
+{
+    struct iovec iov;
+
+    iov.iov_base = cmd;
+    iov.iov_len  = len;
+    return emu_write(emu, &iov, 1);
+}
+
+/*---------------------------------------------------------------------
+ * Method: emu_read_cmd(..)
+ * Scope: Local
+ *
+ * Next complete command in the buffered stream, through *cmd (valid
+ * until the next call) and *len.  Waits at most timeout_ns, or forever
+ * if it is 0.  Returns 1 for a command, 0 on timeout and -1 if the
+ * router went away or the stream is corrupt.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_read_cmd(struct emu* emu, uint8_t** cmd, unsigned int* len,
+                        uint64_t timeout_ns)
+{
+    uint64_t deadline = timeout_ns ? emu_now_ns() + timeout_ns : 0;
+
+    while(1)
+    {
+        unsigned int avail = emu->rx_tail - emu->rx_head;
+        ssize_t n;
+
+        if(avail >= sizeof(uint32_t))
+        {
+            unsigned int l = ntohl(((c_base*)(emu->rx_buf + emu->rx_head))->mLen);
+
+            if(l < sizeof(c_base) || l > EMU_CMD_MAX)
+            {
+                fprintf(stderr, "vns_emu: bad command length %u\n", l);
+                return -1;
+            }
+            if(avail >= l)
+            {
+                *cmd = emu->rx_buf + emu->rx_head;
+                *len = l;
+                emu->rx_head += l;
+                return 1;
+            }
+        }
+
+        if(emu->rx_head > 0)
+        {
+            memmove(emu->rx_buf, emu->rx_buf + emu->rx_head, avail);
+            emu->rx_head = 0;
+            emu->rx_tail = avail;
+        }
+
+        if(deadline)
+        {
+            struct pollfd pfd;
+            uint64_t now = emu_now_ns();
+
+            if(now >= deadline)
+            { return 0; }
+            pfd.fd = emu->fd;
+            pfd.events = POLLIN;
+            if(poll(&pfd, 1, (int)((deadline - now + 999999) / 1000000)) <= 0)
+            { continue; }
+        }
+
+        n = recv(emu->fd, emu->rx_buf + emu->rx_tail, EMU_RXBUF_SZ - emu->rx_tail, 0);
+        if(n < 0 && errno == EINTR)
+        { continue; }
+        if(n <= 0)
+        { return -1; }
+        emu->rx_tail += n;
+    }
+} /* -- emu_read_cmd -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_handshake(..)
+ * Scope: Local
+ *
+ * The server side of sr_connect_to_server: auth request with a random
+ * salt, check the reply against key (if any), auth status, then wait
+ * for VNSOPEN and answer with VNSHWINFO.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_handshake(struct emu* emu, const char* key)
+{
+    uint8_t req[sizeof(c_auth_request) + EMU_SALT_LEN];
+    c_auth_request* ar = (c_auth_request*)req;
+    c_auth_status st;
+    c_hwinfo hw;
+    c_auth_reply* rep;
+    uint8_t* cmd;
+    unsigned int len, i;
+    int ok = 1, n = 0;
+
+    ar->mLen  = htonl(sizeof(req));
+    ar->mType = htonl(VNS_AUTH_REQUEST);
+    for(i = 0; i < EMU_SALT_LEN; i++)
+    { ar->salt[i] = (uint8_t)rand(); }
+    if(emu_send_cmd(emu, req, sizeof(req)) != 0)
+    { return -1; }
+
+    if(emu_read_cmd(emu, &cmd, &len, 0) != 1 ||
+       ntohl(((c_base*)cmd)->mType) != VNS_AUTH_REPLY)
+    {
+        fprintf(stderr, "vns_emu: expected an auth reply\n");
+        return -1;
+    }
+    rep = (c_auth_reply*)cmd;
+
+    if(key)
+    {
+        SHA1Context sha1;
+        uint32_t ulen = ntohl(rep->usernameLen);
+
+        SHA1Reset(&sha1);
+        SHA1Input(&sha1, ar->salt, EMU_SALT_LEN);
+        SHA1Input(&sha1, (const unsigned char*)key, EMU_AUTH_KEY_LEN);
+        ok = SHA1Result(&sha1) &&
+             len == sizeof(c_auth_reply) + ulen + EMU_SHA1_LEN;
+        for(i = 0; ok && i < 5; i++)
+        {
+            uint32_t d = htonl(sha1.Message_Digest[i]);
+            ok = memcmp(rep->username + ulen + 4 * i, &d, 4) == 0;
+        }
+    }
+
+    memset(&st, 0, sizeof(st));
+    st.mLen    = htonl(sizeof(st));
+    st.mType   = htonl(VNS_AUTH_STATUS);
+    st.auth_ok = ok;
+    if(emu_send_cmd(emu, &st, sizeof(st)) != 0 || !ok)
+    {
+        fprintf(stderr, "vns_emu: authentication failed\n");
+        return -1;
+    }
+
+    if(emu_read_cmd(emu, &cmd, &len, 0) != 1 ||
+       ntohl(((c_base*)cmd)->mType) != VNSOPEN)
+    {
+        fprintf(stderr, "vns_emu: expected VNSOPEN (templates are not supported)\n");
+        return -1;
+    }
+    printf("vns_emu: %.32s opened topology %u\n", ((c_open*)cmd)->mUID,
+           ntohs(((c_open*)cmd)->topoID));
+
+    memset(&hw, 0, sizeof(hw));
+    for(i = 0; i < (unsigned int)emu->nifaces; i++)
+    {
+        hw.mHWInfo[n].mKey = htonl(HWINTERFACE);
+        strncpy(hw.mHWInfo[n++].value, emu->ifaces[i].name, 32);
+        hw.mHWInfo[n].mKey = htonl(HWETHER);
+        memcpy(hw.mHWInfo[n++].value, emu->ifaces[i].mac, ETHER_ADDR_LEN);
+        hw.mHWInfo[n].mKey = htonl(HWETHIP);
+        memcpy(hw.mHWInfo[n++].value, &emu->ifaces[i].ip, 4);
+    }
+    len = 2 * sizeof(uint32_t) + n * sizeof(c_hw_entry);
+    hw.mLen  = htonl(len);
+    hw.mType = htonl(VNSHWINFO);
+    return emu_send_cmd(emu, &hw, len);
+} /* -- emu_handshake -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_build_frame(..)
+ * Scope: Local
+ *
+ * VNS header plus a UDP frame of flow f, as its source host sends it to
+ * the router.  Returns the command length.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int emu_build_frame(struct emu* emu, int f, uint8_t* out)
+{
+    struct emu_flow* flow = &emu->flows[f];
+    struct emu_host* src = &emu->hosts[flow->src];
+    struct emu_host* dst = &emu->hosts[flow->dst];
+    c_packet_header* vns = (c_packet_header*)out;
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)(out + sizeof(c_packet_header));
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    uint16_t* udp = (uint16_t*)(ip + 1);
+    struct emu_payload* pl = (struct emu_payload*)(udp + 4);
+    unsigned int iplen = emu->frame_sz - sizeof(sr_ethernet_hdr_t);
+
+    vns->mLen  = htonl(sizeof(c_packet_header) + emu->frame_sz);
+    vns->mType = htonl(VNSPACKET);
+    memset(vns->mInterfaceName, 0, sizeof(vns->mInterfaceName));
+    strncpy(vns->mInterfaceName, emu->ifaces[src->iface].name, sizeof(vns->mInterfaceName) - 1);
+
+    memcpy(eth->ether_dhost, emu->ifaces[src->iface].mac, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, src->mac, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_hl  = 5;
+    ip->ip_v   = 4;
+    ip->ip_tos = 0;
+    ip->ip_len = htons(iplen);
+    ip->ip_id  = htons((uint16_t)flow->seq);
+    ip->ip_off = htons(IP_DF);
+    ip->ip_ttl = 64;
+    ip->ip_p   = IPPROTO_UDP;
+    ip->ip_sum = 0;
+    ip->ip_src = src->ip;
+    ip->ip_dst = dst->ip;
+    ip->ip_sum = csum_fold(csum_partial(ip, sizeof(sr_ip_hdr_t), 0));
+
+    udp[0] = htons(1024 + (uint16_t)(flow->seq % emu->ports));
+    udp[1] = htons(EMU_UDP_DPORT);
+    udp[2] = htons(iplen - sizeof(sr_ip_hdr_t));
+    udp[3] = 0;
+
+    pl->magic   = htonl(EMU_MAGIC);
+    pl->flow    = f;
+    pl->seq     = flow->seq++;
+    pl->sent_ns = emu_now_ns();
+
+    return sizeof(c_packet_header) + emu->frame_sz;
+} /* -- emu_build_frame -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_sender(..)
+ * Scope: Local
+ *
+ * Offer frames round robin over the flows for emu->duration seconds.
+ * With a rate, frames due are sent in batches of up to emu->batch and
+ * the thread sleeps until the next one is due.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* emu_sender(void* arg)
+{
+    struct emu* emu = (struct emu*)arg;
+    unsigned int cmd_sz = sizeof(c_packet_header) + emu->frame_sz;
+    uint8_t* buf = (uint8_t*)malloc((size_t)emu->batch * cmd_sz);
+    uint64_t t0, now, end;
+    unsigned long sent = 0;
+    int f = 0;
+
+    assert(buf);
+    t0  = emu_now_ns();
+    end = t0 + (uint64_t)(emu->duration * 1e9);
+    emu->t_start = t0;
+
+    while((now = emu_now_ns()) < end && !__atomic_load_n(&emu->stop, __ATOMIC_RELAXED))
+    {
+        unsigned long due = emu->rate ?
+            (unsigned long)((double)(now - t0) * emu->rate / 1e9) + 1 : sent + emu->batch;
+        unsigned int n, i;
+        struct iovec iov;
+
+        if(due <= sent)
+        {
+            struct timespec ts;
+            uint64_t next = t0 + (uint64_t)((double)sent * 1e9 / emu->rate);
+
+            ts.tv_sec  = next / 1000000000ULL;
+            ts.tv_nsec = next % 1000000000ULL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+            continue;
+        }
+
+        n = (due - sent > emu->batch) ? emu->batch : (unsigned int)(due - sent);
+        if(emu->rate && due - sent > emu->batch)
+        { emu->tx_short++; }
+
+        for(i = 0; i < n; i++)
+        {
+            emu_build_frame(emu, f, buf + (size_t)i * cmd_sz);
+            if(++f == emu->nflows)
+            { f = 0; }
+        }
+
+        iov.iov_base = buf;
+        iov.iov_len  = (size_t)n * cmd_sz;
+        if(emu_write(emu, &iov, 1) != 0)
+        { break; }
+        sent += n;
+    }
+
+    emu->tx_frames = sent;
+    emu->t_end = emu_now_ns();
+    __atomic_store_n(&emu->done, 1, __ATOMIC_RELEASE);
+    free(buf);
+    return 0;
+} /* -- emu_sender -- */
+
+static unsigned int emu_hist_bucket(uint64_t v)
+{
+    int msb;
+
+    if(v < EMU_HIST_SUB)
+    { return (unsigned int)v; }
+    msb = 63 - __builtin_clzll(v);
+    return (msb - 3) * EMU_HIST_SUB + ((v >> (msb - 4)) & (EMU_HIST_SUB - 1));
+}
+
+static uint64_t emu_hist_value(unsigned int b)
+{
+    unsigned int msb;
+
+    if(b < EMU_HIST_SUB)
+    { return b; }
+    msb = b / EMU_HIST_SUB + 3;
+    return ((uint64_t)(EMU_HIST_SUB + b % EMU_HIST_SUB)) << (msb - 4);
+}
+
+static uint64_t emu_hist_pct(struct emu* emu, double p)
+{
+    unsigned long want = (unsigned long)(p / 100.0 * emu->rx_frames);
+    unsigned long seen = 0;
+    unsigned int b;
+
+    for(b = 0; b < EMU_HIST_SZ; b++)
+    {
+        seen += emu->hist[b];
+        if(seen > want)
+        { return emu_hist_value(b); }
+    }
+    return emu->lat_max;
+}
+
+/*---------------------------------------------------------------------
+ * Method: emu_arp_reply(..)
+ * Scope: Local
+ *
+ * Answer an ARP request from the router on behalf of the host it asks
+ * for, if that host sits behind the interface it asked on.  ifname is
+ * the 16 byte interface field of the VNS header, not terminated if full.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_arp_reply(struct emu* emu, const char* ifname, const uint8_t* frame,
+                         unsigned int len)
+{
+    const sr_arp_hdr_t* req = (const sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    uint8_t out[sizeof(c_packet_header) + sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
+    c_packet_header* vns = (c_packet_header*)out;
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)(vns + 1);
+    sr_arp_hdr_t* rep = (sr_arp_hdr_t*)(eth + 1);
+    int h;
+
+    if(len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t) ||
+       ntohs(req->ar_op) != arp_op_request)
+    { return -1; }
+
+    for(h = 0; h < emu->nhosts; h++)
+    {
+        if(emu->hosts[h].ip == req->ar_tip &&
+           strncmp(emu->ifaces[emu->hosts[h].iface].name, ifname, 16) == 0)
+        { break; }
+    }
+    if(h == emu->nhosts)
+    { return -1; }
+
+    vns->mLen  = htonl(sizeof(out));
+    vns->mType = htonl(VNSPACKET);
+    memcpy(vns->mInterfaceName, ifname, sizeof(vns->mInterfaceName));
+
+    memcpy(eth->ether_dhost, req->ar_sha, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, emu->hosts[h].mac, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_arp);
+
+    rep->ar_hrd = htons(arp_hrd_ethernet);
+    rep->ar_pro = htons(ethertype_ip);
+    rep->ar_hln = ETHER_ADDR_LEN;
+    rep->ar_pln = 4;
+    rep->ar_op  = htons(arp_op_reply);
+    memcpy(rep->ar_sha, emu->hosts[h].mac, ETHER_ADDR_LEN);
+    rep->ar_sip = req->ar_tip;
+    memcpy(rep->ar_tha, req->ar_sha, ETHER_ADDR_LEN);
+    rep->ar_tip = req->ar_sip;
+
+    emu->arp_replies++;
+    return emu_send_cmd(emu, out, sizeof(out));
+} /* -- emu_arp_reply -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_rx_frame(..)
+ * Scope: Local
+ *
+ * Account for one frame the router sent.
+ *
+ *---------------------------------------------------------------------*/
+
+static void emu_rx_frame(struct emu* emu, const uint8_t* cmd, unsigned int len, uint64_t now)
+{
+    const c_packet_header* vns = (const c_packet_header*)cmd;
+    const uint8_t* frame = cmd + sizeof(c_packet_header);
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)frame;
+    const sr_ip_hdr_t* ip = (const sr_ip_hdr_t*)(eth + 1);
+    const struct emu_payload* pl = (const struct emu_payload*)((const uint8_t*)(ip + 1) + 8);
+    const struct emu_flow* flow;
+    const struct emu_host* dst;
+    unsigned int flen = len - sizeof(c_packet_header);
+    uint64_t lat;
+
+    if(len < sizeof(c_packet_header) + sizeof(sr_ethernet_hdr_t))
+    {
+        emu->rx_other++;
+        return;
+    }
+
+    if(ntohs(eth->ether_type) == ethertype_arp)
+    {
+        if(emu_arp_reply(emu, vns->mInterfaceName, frame, flen) != 0)
+        { emu->rx_other++; }
+        return;
+    }
+
+    if(ntohs(eth->ether_type) != ethertype_ip ||
+       flen < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8 + sizeof(struct emu_payload) ||
+       ip->ip_p != IPPROTO_UDP || ntohl(pl->magic) != EMU_MAGIC ||
+       pl->flow >= (uint32_t)emu->nflows)
+    {
+        emu->rx_other++;
+        return;
+    }
+
+    flow = &emu->flows[pl->flow];
+    dst  = &emu->hosts[flow->dst];
+    if(strncmp(vns->mInterfaceName, emu->ifaces[dst->iface].name, 16) != 0 ||
+       memcmp(eth->ether_dhost, dst->mac, ETHER_ADDR_LEN) != 0 ||
+       memcmp(eth->ether_shost, emu->ifaces[dst->iface].mac, ETHER_ADDR_LEN) != 0 ||
+       ip->ip_ttl != 63 || csum_fold(csum_partial(ip, sizeof(sr_ip_hdr_t), 0)) != 0)
+    {
+        emu->rx_bad++;
+        return;
+    }
+
+    if(!emu->warm)
+    { return; }
+
+    lat = now - pl->sent_ns;
+    emu->rx_frames++;
+    emu->rx_bytes += flen;
+    emu->hist[emu_hist_bucket(lat)]++;
+    if(lat > emu->lat_max)
+    { emu->lat_max = lat; }
+} /* -- emu_rx_frame -- */
+
+/*---------------------------------------------------------------------
+ * Method: emu_serve(..)
+ * Scope: Local
+ *
+ * Warm up ARP, run the sender and account for everything the router
+ * sends until it is done and the stragglers have had EMU_DRAIN_NS.
+ *
+ *---------------------------------------------------------------------*/
+
+static int emu_serve(struct emu* emu)
+{
+    uint8_t buf[sizeof(c_packet_header) + EMU_FRAME_MAX];
+    pthread_t sender;
+    uint64_t until;
+    unsigned long warm_rx = 0;
+    unsigned int len;
+    uint8_t* cmd;
+    int f;
+
+    /* -- one frame per flow, so ARP is resolved before the clock runs -- */
+    for(f = 0; f < emu->nflows; f++)
+    {
+        unsigned int l = emu_build_frame(emu, f, buf);
+        if(emu_send_cmd(emu, buf, l) != 0)
+        { return -1; }
+    }
+    until = emu_now_ns() + 3000000000ULL;
+    while(warm_rx < (unsigned long)emu->nflows)
+    {
+        uint64_t now = emu_now_ns();
+        int ret;
+
+        if(now >= until)
+        { break; }
+        if((ret = emu_read_cmd(emu, &cmd, &len, until - now)) < 0)
+        { return -1; }
+        if(ret == 1 && ntohl(((c_base*)cmd)->mType) == VNSPACKET)
+        {
+            unsigned long bad = emu->rx_bad, other = emu->rx_other;
+            uint16_t type = ntohs(((sr_ethernet_hdr_t*)(cmd + sizeof(c_packet_header)))->ether_type);
+
+            emu_rx_frame(emu, cmd, len, emu_now_ns());
+            if(type == ethertype_ip && emu->rx_bad == bad && emu->rx_other == other)
+            { warm_rx++; }
+        }
+    }
+    printf("vns_emu: warm-up %lu/%d flows forwarded, %lu ARP replies\n",
+           warm_rx, emu->nflows, emu->arp_replies);
+    fflush(stdout);
+    emu->rx_bad = emu->rx_other = 0;
+    emu->warm = 1;
+
+    pthread_create(&sender, 0, emu_sender, emu);
+
+    /* -- until the sender is done and everything it sent is back, or
+          EMU_DRAIN_NS after it finished -- */
+    until = 0;
+    while(1)
+    {
+        int ret;
+
+        if(__atomic_load_n(&emu->done, __ATOMIC_ACQUIRE))
+        {
+            uint64_t now = emu_now_ns();
+
+            if(until == 0)
+            { until = now + EMU_DRAIN_NS; }
+            if(now >= until || emu->rx_frames + emu->rx_bad >= emu->tx_frames)
+            { break; }
+        }
+
+        if((ret = emu_read_cmd(emu, &cmd, &len, 100000000ULL)) < 0)
+        {
+            fprintf(stderr, "vns_emu: router closed the session\n");
+            break;
+        }
+        if(ret == 0)
+        { continue; }
+
+        if(ntohl(((c_base*)cmd)->mType) == VNSPACKET)
+        { emu_rx_frame(emu, cmd, len, emu_now_ns()); }
+        else
+        { emu->rx_other++; }
+    }
+
+    __atomic_store_n(&emu->stop, 1, __ATOMIC_RELAXED);
+    pthread_join(sender, 0);
+    return 0;
+} /* -- emu_serve -- */
+
+static void emu_report(struct emu* emu)
+{
+    double secs = (emu->t_end - emu->t_start) / 1e9;
+    unsigned long lost = emu->tx_frames > emu->rx_frames + emu->rx_bad ?
+                         emu->tx_frames - emu->rx_frames - emu->rx_bad : 0;
+
+    printf("offered   %lu frames of %u bytes in %.2fs, %.0f pps, %lu writes behind schedule\n",
+           emu->tx_frames, emu->frame_sz, secs, secs > 0 ? emu->tx_frames / secs : 0.0,
+           emu->tx_short);
+    printf("delivered %lu frames, %.0f pps, %.1f Mbit/s\n",
+           emu->rx_frames, secs > 0 ? emu->rx_frames / secs : 0.0,
+           secs > 0 ? emu->rx_bytes * 8 / secs / 1e6 : 0.0);
+    printf("lost      %lu (%.3f%%), mangled %lu, other %lu, ARP replies %lu\n",
+           lost, emu->tx_frames ? 100.0 * lost / emu->tx_frames : 0.0,
+           emu->rx_bad, emu->rx_other, emu->arp_replies);
+    if(emu->rx_frames)
+    {
+        printf("latency   us  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               emu_hist_pct(emu, 50) / 1e3, emu_hist_pct(emu, 90) / 1e3,
+               emu_hist_pct(emu, 99) / 1e3, emu_hist_pct(emu, 99.9) / 1e3,
+               emu->lat_max / 1e3);
+    }
+} /* -- emu_report -- */
+
+int main(int argc, char **argv)
+{
+    int c, lfd, one = 1;
+    unsigned int port = DEFAULT_PORT;
+    char* topo = DEFAULT_TOPO;
+    char* keyfile = 0;
+    char key[EMU_AUTH_KEY_LEN + 1];
+    struct sockaddr_in addr;
+    struct emu emu;
+    c_close bye;
+    int i, j;
+
+    memset(&emu, 0, sizeof(emu));
+    emu.rate     = 10000;
+    emu.duration = 5.0;
+    emu.frame_sz = 128;
+    emu.ports    = 16;
+    emu.batch    = 32;
+
+    while((c = getopt(argc, argv, "hp:t:k:r:d:s:f:b:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'p':
+                port = atoi((char *) optarg);
+                break;
+            case 't':
+                topo = optarg;
+                break;
+            case 'k':
+                keyfile = optarg;
+                break;
+            case 'r':
+                emu.rate = atoi((char *) optarg);
+                break;
+            case 'd':
+                emu.duration = atof((char *) optarg);
+                break;
+            case 's':
+                emu.frame_sz = atoi((char *) optarg);
+                break;
+            case 'f':
+                emu.ports = atoi((char *) optarg);
+                break;
+            case 'b':
+                emu.batch = atoi((char *) optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        } /* switch */
+    } /* -- while -- */
+
+    if(emu.frame_sz < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8 +
+                      sizeof(struct emu_payload) || emu.frame_sz > EMU_FRAME_MAX ||
+       emu.ports == 0 || emu.batch == 0 || emu.duration <= 0)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if(keyfile)
+    {
+        FILE* fp = fopen(keyfile, "r");
+        if(!fp || fgets(key, sizeof(key), fp) != key || strlen(key) != EMU_AUTH_KEY_LEN)
+        {
+            fprintf(stderr, "vns_emu: cannot read a %d byte key from %s\n",
+                    EMU_AUTH_KEY_LEN, keyfile);
+            exit(1);
+        }
+        fclose(fp);
+    }
+
+    if(emu_load_topo(&emu, topo) != 0)
+    { exit(1); }
+
+    /* -- every host talks to every host behind another interface -- */
+    emu.flows = (struct emu_flow*)calloc(emu.nhosts * emu.nhosts, sizeof(struct emu_flow));
+    assert(emu.flows);
+    for(i = 0; i < emu.nhosts; i++)
+    {
+        for(j = 0; j < emu.nhosts; j++)
+        {
+            if(emu.hosts[i].iface != emu.hosts[j].iface)
+            {
+                emu.flows[emu.nflows].src = i;
+                emu.flows[emu.nflows].dst = j;
+                emu.nflows++;
+            }
+        }
+    }
+    if(emu.nflows == 0)
+    {
+        fprintf(stderr, "vns_emu: all hosts are behind one interface\n");
+        exit(1);
+    }
+
+    emu.rx_buf = (uint8_t*)malloc(EMU_RXBUF_SZ);
+    assert(emu.rx_buf);
+    pthread_mutex_init(&emu.tx_lock, 0);
+    srand((unsigned int)emu_now_ns());
+
+    if((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket");
+        exit(1);
+    }
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0)
+    {
+        perror("bind/listen");
+        exit(1);
+    }
+
+    printf("vns_emu: %d interfaces, %d hosts, %d flows; waiting for sr on port %u\n",
+           emu.nifaces, emu.nhosts, emu.nflows, port);
+    fflush(stdout);
+    if((emu.fd = accept(lfd, 0, 0)) < 0)
+    {
+        perror("accept");
+        exit(1);
+    }
+    close(lfd);
+    setsockopt(emu.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if(emu_handshake(&emu, keyfile ? key : 0) != 0 || emu_serve(&emu) != 0)
+    {
+        close(emu.fd);
+        exit(1);
+    }
+
+    memset(&bye, 0, sizeof(bye));
+    bye.mLen  = htonl(sizeof(bye));
+    bye.mType = htonl(VNSCLOSE);
+    strncpy(bye.mErrorMessage, "vns_emu: run complete", sizeof(bye.mErrorMessage) - 1);
+    emu_send_cmd(&emu, &bye, sizeof(bye));
+    close(emu.fd);
+
+    emu_report(&emu);
+    return 0;
+} /* -- main -- */
@@ -6,10 +6,12 @@
 #include "mysock_impl.h"
 #include "transport.h"
 #include "tcp_sum.h"
+#include "inet_cksum.h"
 
 
 /* computes checksum for TCP segment, based on description in RFCs 793 and
- * 1071, and Berkeley in_cksum().
+ * 1071, and Berkeley in_cksum().  The summing itself is the router's
+ * inet_cksum.c kernel.
  */
 uint16_t _mysock_tcp_checksum(uint32_t src_addr /*network byte order*/,
                               uint32_t dst_addr /*network byte order*/,
@@ -28,8 +30,8 @@ uint16_t _mysock_tcp_checksum(uint32_t src_addr /*network byte order*/,
         src_addr, dst_addr, 0, IPPROTO_TCP, htons(len)
     };
 
-    unsigned int k;
-    int32_t sum = 0;
+    uint32_t sum;
+    uint16_t th_sum_neg;
 
     assert(packet && len >= sizeof(struct tcphdr));
     assert(sizeof(pseudo_header) == 12);
@@ -38,32 +40,17 @@ uint16_t _mysock_tcp_checksum(uint32_t src_addr /*network byte order*/,
     assert(src_addr > 0);
     assert(dst_addr > 0);
 
-    /* process 96-bit pseudo header */
-    for (k = 0; k < sizeof(pseudo_header) / sizeof(uint16_t); ++k)
-        sum += ((uint16_t *) &pseudo_header)[k];
+    /* process 96-bit pseudo header, then TCP header and payload */
+    sum = csum_partial(&pseudo_header, sizeof(pseudo_header), 0);
+    sum = csum_partial(packet, len, sum);
 
-    /* process TCP header and payload */
-    assert(((long)packet & 2) == 0);
-    assert((offsetof(struct tcphdr, th_sum) & 2) == 0);
-    for (k = 0; k < (len >> 1); ++k)
-    {
-        if (k == (offsetof(struct tcphdr, th_sum) >> 1))
-            continue;   /* th_sum == 0 during checksum computation */
-        sum += ((uint16_t *) packet)[k];
-    }
-
-    if (len & 1)
-    {
-        uint16_t tmp = 0;
-        *(uint8_t *) &tmp = ((uint8_t *) packet)[len - 1];
-        sum += tmp;
-    }
-
-    /* fold 32-bit sum to 16 bits */
-    sum = (sum >> 16) + (sum & 0xffff);
-    sum += (sum >> 16);
+    /* th_sum == 0 during checksum computation: cancel whatever the field
+     * holds by adding its one's complement, rather than splitting the
+     * segment around it */
+    th_sum_neg = (uint16_t) ~((const struct tcphdr *) packet)->th_sum;
+    sum = csum_partial(&th_sum_neg, sizeof(th_sum_neg), sum);
 
-    return (uint16_t) ~sum;
+    return csum_fold(sum);
 }
 
 /* update checksum in the given STCP segment */